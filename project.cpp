@@ -1,9 +1,58 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
 #include <exception>
 #include <stdexcept>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <iterator>
+#include <cstdio>
+#include <unordered_map>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cctype>
+#include <limits>
+#include <random>
+#include <shared_mutex>
+#include <csignal>
+#include <cerrno>
+#include <optional>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define STOCK_SIMD_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 using namespace std;
 
@@ -23,449 +72,3973 @@ public:
     NotFoundException(const string& msg) : runtime_error(msg) {}
 };
 
-// --------- PRODUCT CLASS ---------
-class Product {
+class ParseException : public runtime_error {
 public:
-    int productID;
-    string name;
-    double price;
-    string category;
+    ParseException(const string& msg) : runtime_error(msg) {}
+};
 
-    Product() : productID(0), price(0.0) {}
-    Product(int id, const string& n, double p, const string& c)
-        : productID(id), name(n), price(p), category(c) {}
+class IntegrityException : public runtime_error {
+public:
+    IntegrityException(const string& msg) : runtime_error(msg) {}
+};
 
-    void display() const {
-        cout << "Product ID: " << productID
-             << ", Name: " << name
-             << ", Price: $" << price
-             << ", Category: " << category << endl;
+// --------- HASH INDEX ---------
+// Open-addressing map from a 64-bit key to a small value, using linear
+// probing over a power-of-two table. Deletion shifts later entries back so
+// no tombstones are needed and probe chains stay short.
+inline uint64_t mixHash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+template <typename V>
+class HashIndex {
+private:
+    struct Slot {
+        uint64_t key;
+        V value;
+        bool used;
+    };
+
+    vector<Slot> slots;
+    size_t mask;
+    size_t used;
+
+    void rehash(size_t capacity) {
+        vector<Slot> old;
+        old.swap(slots);
+        slots.assign(capacity, Slot{0, V(), false});
+        mask = capacity - 1;
+        used = 0;
+        for (const Slot& s : old)
+            if (s.used) insert(s.key, s.value);
     }
 
-    string toString() const {
-        stringstream ss;
-        ss << productID << "," << name << "," << price << "," << category;
-        return ss.str();
+public:
+    HashIndex() : mask(0), used(0) {
+        rehash(16);
     }
 
-    static Product fromString(const string& line) {
-        stringstream ss(line);
-        string token;
-        int id;
-        string name;
-        double price;
-        string category;
+    size_t size() const { return used; }
+    size_t capacity() const { return slots.size(); }
+
+    // Sizes the table so that n entries fit without rehashing
+    void reserve(size_t n) {
+        size_t capacity = 16;
+        while (capacity * 7 / 10 < n) capacity *= 2;
+        if (capacity > slots.size()) rehash(capacity);
+    }
+
+    void clear() {
+        slots.clear();
+        rehash(16);
+    }
+
+    V* find(uint64_t key) {
+        size_t i = mixHash(key) & mask;
+        while (slots[i].used) {
+            if (slots[i].key == key) return &slots[i].value;
+            i = (i + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    // Returns false if the key was already present (value left unchanged)
+    bool insert(uint64_t key, const V& value) {
+        if ((used + 1) * 10 > slots.size() * 7) rehash(slots.size() * 2);
+        size_t i = mixHash(key) & mask;
+        while (slots[i].used) {
+            if (slots[i].key == key) return false;
+            i = (i + 1) & mask;
+        }
+        slots[i].key = key;
+        slots[i].value = value;
+        slots[i].used = true;
+        used++;
+        return true;
+    }
 
-        getline(ss, token, ','); id = stoi(token);
-        getline(ss, name, ',');
-        getline(ss, token, ','); price = stod(token);
-        getline(ss, category, ',');
+    bool erase(uint64_t key) {
+        size_t i = mixHash(key) & mask;
+        while (slots[i].used && slots[i].key != key)
+            i = (i + 1) & mask;
+        if (!slots[i].used) return false;
 
-        return Product(id, name, price, category);
+        // Backward-shift: pull later entries of the probe chain into the gap
+        size_t gap = i;
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (!slots[j].used) break;
+            size_t home = mixHash(slots[j].key) & mask;
+            bool movable = gap <= j ? (home <= gap || home > j) : (home <= gap && home > j);
+            if (movable) {
+                slots[gap] = slots[j];
+                gap = j;
+            }
+        }
+        slots[gap].used = false;
+        used--;
+        return true;
     }
 };
 
-// --------- PRODUCT BST NODE ---------
-class ProductNode {
-public:
-    Product data;
-    ProductNode* left;
-    ProductNode* right;
+// Composite key for a (productID, supplierID) pair
+inline uint64_t stockKey(int productID, int supplierID) {
+    return ((uint64_t)(uint32_t)productID << 32) | (uint32_t)supplierID;
+}
 
-    ProductNode(const Product& p) : data(p), left(nullptr), right(nullptr) {}
+// --------- NODE POOL ---------
+// Slab allocator for record and tree nodes. Nodes are carved out of 64 KiB
+// slabs in allocation order, so one allocation serves hundreds of records
+// and list or leaf traversals walk mostly contiguous memory. Released nodes
+// go on a freelist and are reused first.
+//
+// A released slot keeps a default-constructed T until it is reused, so
+// every slot handed out so far is a live object. clear() gives all slabs
+// back at once; for types that need destructors (records holding strings)
+// it first runs them in one sequential pass over the slabs.
+const size_t NODE_POOL_SLAB_BYTES = 64 * 1024;
+
+struct PoolStats {
+    size_t live = 0;        // nodes in use
+    size_t capacity = 0;    // nodes the slabs can hold
+    size_t bytes = 0;       // slab memory plus bookkeeping
 };
 
-// --------- PRODUCT BST ---------
-class ProductBST {
+template <typename T>
+class NodePool {
 private:
-    ProductNode* root;
+    static constexpr size_t SLAB_NODES = sizeof(T) < NODE_POOL_SLAB_BYTES ? NODE_POOL_SLAB_BYTES / sizeof(T) : 1;
 
-    ProductNode* insertHelper(ProductNode* node, const Product& p) {
-        if (!node) return new ProductNode(p);
+    vector<T*> slabs;
+    vector<T*> freeList;
+    size_t used;    // slots taken in the last slab
+    size_t live;
 
-        if (p.productID < node->data.productID)
-            node->left = insertHelper(node->left, p);
-        else if (p.productID > node->data.productID)
-            node->right = insertHelper(node->right, p);
-        else
-            throw DuplicateIDException("Duplicate Product ID: " + to_string(p.productID));
+public:
+    NodePool() : used(SLAB_NODES), live(0) {}
 
-        return node;
+    ~NodePool() {
+        clear();
     }
 
-    ProductNode* findMin(ProductNode* node) {
-        while (node && node->left)
-            node = node->left;
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+        T* node;
+        if (!freeList.empty()) {
+            node = freeList.back();
+            freeList.pop_back();
+            *node = T(std::forward<Args>(args)...);
+        } else {
+            if (used == SLAB_NODES) {
+                slabs.push_back(static_cast<T*>(::operator new(SLAB_NODES * sizeof(T))));
+                used = 0;
+            }
+            node = new (slabs.back() + used) T(std::forward<Args>(args)...);
+            used++;
+        }
+        live++;
         return node;
     }
 
-    ProductNode* removeHelper(ProductNode* node, int productID) {
-        if (!node)
-            throw NotFoundException("Product ID not found: " + to_string(productID));
+    void release(T* node) {
+        if (!is_trivially_destructible<T>::value)
+            *node = T();
+        freeList.push_back(node);
+        live--;
+    }
 
-        if (productID < node->data.productID)
-            node->left = removeHelper(node->left, productID);
-        else if (productID > node->data.productID)
-            node->right = removeHelper(node->right, productID);
-        else {
-            // node to delete found
-            if (!node->left) {
-                ProductNode* rightChild = node->right;
-                delete node;
-                return rightChild;
-            }
-            else if (!node->right) {
-                ProductNode* leftChild = node->left;
-                delete node;
-                return leftChild;
-            }
-            else {
-                ProductNode* minRight = findMin(node->right);
-                node->data = minRight->data;
-                node->right = removeHelper(node->right, minRight->data.productID);
+    void clear() {
+        if (!is_trivially_destructible<T>::value) {
+            for (size_t s = 0; s < slabs.size(); ++s) {
+                size_t n = s + 1 == slabs.size() ? used : SLAB_NODES;
+                for (size_t i = 0; i < n; ++i)
+                    slabs[s][i].~T();
             }
         }
-        return node;
+        for (T* slab : slabs)
+            ::operator delete(slab);
+        slabs.clear();
+        freeList.clear();
+        used = SLAB_NODES;
+        live = 0;
     }
 
-    ProductNode* searchHelper(ProductNode* node, int productID) {
-        if (!node) return nullptr;
-        if (productID == node->data.productID) return node;
-        if (productID < node->data.productID) return searchHelper(node->left, productID);
-        else return searchHelper(node->right, productID);
+    PoolStats stats() const {
+        PoolStats st;
+        st.live = live;
+        st.capacity = slabs.size() * SLAB_NODES;
+        st.bytes = st.capacity * sizeof(T) + (slabs.capacity() + freeList.capacity()) * sizeof(T*);
+        return st;
     }
+};
 
-    void inorderHelper(ProductNode* node) {
-        if (!node) return;
-        inorderHelper(node->left);
-        node->data.display();
-        inorderHelper(node->right);
-    }
+// --------- RECORD PARSING ---------
+// Hand-written field scanners used by the loaders. They work in place on a
+// [begin, end) character range, so a record can be parsed straight out of a
+// mapped file without copying the line or building a stringstream. Each
+// returns false on malformed input instead of throwing.
+
+// Returns the end of the field starting at p (the next ',' or end)
+inline const char* fieldEnd(const char* p, const char* end) {
+    const char* comma = (const char*)memchr(p, ',', end - p);
+    return comma ? comma : end;
+}
+
+inline bool isBlank(char c) {
+    return c == ' ' || c == '\t';
+}
 
-    void collectInorder(ProductNode* node, Product* arr[], int& idx, int capacity) {
-        if (!node || idx >= capacity) return;
-        collectInorder(node->left, arr, idx, capacity);
-        arr[idx++] = &(node->data);
-        collectInorder(node->right, arr, idx, capacity);
+// Parses a decimal int filling the whole of [p, end), allowing surrounding blanks
+inline bool parseIntField(const char* p, const char* end, int& out) {
+    while (p < end && isBlank(*p)) ++p;
+    while (end > p && isBlank(end[-1])) --end;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
     }
+    if (p == end || end - p > 10) return false;
 
-    void clearHelper(ProductNode* node) {
-        if (!node) return;
-        clearHelper(node->left);
-        clearHelper(node->right);
-        delete node;
+    long long value = 0;
+    for (; p < end; ++p) {
+        unsigned digit = (unsigned)(*p - '0');
+        if (digit > 9) return false;
+        value = value * 10 + digit;
     }
+    if (negative) value = -value;
+    if (value < INT32_MIN || value > INT32_MAX) return false;
+    out = (int)value;
+    return true;
+}
 
-public:
-    ProductBST() : root(nullptr) {}
+// Parses a decimal number such as 120000, 3.5 or 1e3 filling [p, end).
+// Short inputs are computed exactly from an integer mantissa and a power
+// of ten; anything longer falls back to strtod on a small local copy.
+inline bool parseDoubleField(const char* p, const char* end, double& out) {
+    static const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
 
-    ~ProductBST() {
-        clearHelper(root);
+    while (p < end && isBlank(*p)) ++p;
+    while (end > p && isBlank(end[-1])) --end;
+    const char* start = p;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
     }
 
-    void insert(const Product& p) {
-        root = insertHelper(root, p);
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int scale = 0;
+    bool sawDigit = false;
+    for (; p < end && (unsigned)(*p - '0') <= 9; ++p, sawDigit = true)
+        if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; }
+        else scale++;
+    if (p < end && *p == '.') {
+        for (++p; p < end && (unsigned)(*p - '0') <= 9; ++p, sawDigit = true)
+            if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; scale--; }
     }
+    if (!sawDigit) return false;
 
-    void remove(int productID) {
-        root = removeHelper(root, productID);
+    int exponent = 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        if (p == end || !parseIntField(p, end, exponent)) return false;
+        p = end;
     }
+    if (p != end) return false;
 
-    Product* search(int productID) {
-        ProductNode* node = searchHelper(root, productID);
-        return node ? &(node->data) : nullptr;
+    int power = scale + exponent;
+    if (mantissa < (1ULL << 53) && power >= -22 && power <= 22) {
+        double value = (double)mantissa;
+        value = power < 0 ? value / powersOfTen[-power] : value * powersOfTen[power];
+        out = negative ? -value : value;
+        return true;
     }
 
-    void displayAll() {
-        if (!root) {
-            cout << "No products to display." << endl;
-            return;
+    char buffer[64];
+    size_t length = end - start;
+    if (length >= sizeof(buffer)) return false;
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    char* stop = nullptr;
+    out = strtod(buffer, &stop);
+    return stop == buffer + length;
+}
+
+// Splits the next line off [p, end), dropping the newline and any '\r'
+inline bool nextLine(const char*& p, const char* end, const char*& lineBegin, const char*& lineEnd) {
+    if (p >= end) return false;
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    lineBegin = p;
+    lineEnd = newline ? newline : end;
+    p = newline ? newline + 1 : end;
+    if (lineEnd > lineBegin && lineEnd[-1] == '\r') --lineEnd;
+    return true;
+}
+
+// --------- OUTPUT BUFFERING ---------
+// Listings and exports are formatted into a large reusable buffer and
+// handed on in big writes, instead of going field by field through cout
+// with a flush (endl) per row. Numbers are formatted with to_chars.
+// Nothing is written until the buffer fills or flush() is called.
+const size_t OUT_BUFFER_SIZE = 1 << 20;
+
+// Appends the shortest text that parses back to the same value
+inline void appendNumber(string& out, long long value) {
+    char text[24];
+    out.append(text, to_chars(text, text + sizeof(text), value).ptr);
+}
+
+inline void appendNumber(string& out, int value) {
+    appendNumber(out, (long long)value);
+}
+
+inline void appendNumber(string& out, double value) {
+    char text[32];
+    out.append(text, to_chars(text, text + sizeof(text), value).ptr);
+}
+
+class OutBuffer {
+public:
+    explicit OutBuffer(size_t capacity = OUT_BUFFER_SIZE) : buffer(capacity), used(0) {}
+    virtual ~OutBuffer() {}
+
+    OutBuffer& write(const char* data, size_t n) {
+        while (n > 0) {
+            if (used == buffer.size()) drain();
+            size_t chunk = min(n, buffer.size() - used);
+            memcpy(buffer.data() + used, data, chunk);
+            used += chunk;
+            data += chunk;
+            n -= chunk;
         }
-        cout << "--- Products List ---" << endl;
-        inorderHelper(root);
-        cout << "------------------------------" << endl;
+        return *this;
     }
 
-    // Get count of nodes for array allocation
-    int countNodes(ProductNode* node) {
-        if (!node) return 0;
-        return 1 + countNodes(node->left) + countNodes(node->right);
+    OutBuffer& operator<<(char c) {
+        if (used == buffer.size()) drain();
+        buffer[used++] = c;
+        return *this;
     }
+    OutBuffer& operator<<(const char* s) { return write(s, strlen(s)); }
+    OutBuffer& operator<<(const string& s) { return write(s.data(), s.size()); }
+    OutBuffer& operator<<(string_view s) { return write(s.data(), s.size()); }
+    OutBuffer& operator<<(int value) { return *this << (long long)value; }
 
-    int getCount() {
-        return countNodes(root);
+    OutBuffer& operator<<(long long value) {
+        reserve(24);
+        used = to_chars(buffer.data() + used, buffer.data() + buffer.size(), value).ptr - buffer.data();
+        return *this;
     }
 
-    // Get all products into an array (for sorting/searching)
-    int getAllProducts(Product* arr[], int capacity) {
-        int idx = 0;
-        collectInorder(root, arr, idx, capacity);
-        return idx;
+    // Six significant digits, the same text cout prints by default
+    OutBuffer& operator<<(double value) {
+        reserve(32);
+        used = to_chars(buffer.data() + used, buffer.data() + buffer.size(), value,
+                        chars_format::general, 6).ptr - buffer.data();
+        return *this;
     }
-};
-
-// --------- SUPPLIER CLASS ---------
-class Supplier {
-public:
-    int supplierID;
-    string name;
-    string contactInfo;
 
-    Supplier() : supplierID(0) {}
-    Supplier(int id, const string& n, const string& c)
-        : supplierID(id), name(n), contactInfo(c) {}
-
-    void display() const {
-        cout << "Supplier ID: " << supplierID
-             << ", Name: " << name
-             << ", Contact: " << contactInfo << endl;
+    // Fixed-point with the given number of decimals, e.g. money
+    OutBuffer& fixed(double value, int decimals) {
+        reserve(352);    // enough for any double in fixed notation
+        used = to_chars(buffer.data() + used, buffer.data() + buffer.size(), value,
+                        chars_format::fixed, decimals).ptr - buffer.data();
+        return *this;
     }
 
-    string toString() const {
-        stringstream ss;
-        ss << supplierID << "," << name << "," << contactInfo;
-        return ss.str();
-    }
+    virtual void flush() { drain(); }
 
-    static Supplier fromString(const string& line) {
-        stringstream ss(line);
-        string token;
-        int id;
-        string name;
-        string contact;
+protected:
+    vector<char> buffer;
+    size_t used;
 
-        getline(ss, token, ','); id = stoi(token);
-        getline(ss, name, ',');
-        getline(ss, contact, ',');
+    // Hands off buffer[0, used) and resets used
+    virtual void drain() = 0;
 
-        return Supplier(id, name, contact);
+    void reserve(size_t n) {
+        if (buffer.size() - used < n) drain();
     }
 };
 
-// --------- SUPPLIER NODE & LINKED LIST ---------
-class SupplierNode {
+// Buffers in front of an ostream such as cout
+class StreamOut : public OutBuffer {
 public:
-    Supplier data;
-    SupplierNode* next;
+    explicit StreamOut(ostream& os, size_t capacity = OUT_BUFFER_SIZE) : OutBuffer(capacity), os(os) {}
+    ~StreamOut() { drain(); }
 
-    SupplierNode(const Supplier& s) : data(s), next(nullptr) {}
-};
+    void flush() override {
+        drain();
+        os.flush();
+    }
+
+protected:
+    void drain() override {
+        os.write(buffer.data(), (streamsize)used);
+        used = 0;
+    }
 
-class SupplierList {
 private:
-    SupplierNode* head;
+    ostream& os;
+};
 
-public:
-    SupplierList() : head(nullptr) {}
+// Shared console buffer; flush it before going back to cout or cin
+inline StreamOut& console() {
+    static StreamOut out(cout);
+    return out;
+}
 
-    ~SupplierList() {
-        while (head) {
-            SupplierNode* temp = head;
-            head = head->next;
-            delete temp;
-        }
+// Streams to a file or pipe ("-" is stdout) in fixed-size chunks. Records
+// are formatted into one chunk while a background thread writes the other,
+// so formatting and I/O overlap. Write errors are reported by close().
+class AsyncFileWriter : public OutBuffer {
+public:
+    explicit AsyncFileWriter(const string& path, size_t chunkSize = OUT_BUFFER_SIZE)
+        : OutBuffer(chunkSize), path(path), spare(chunkSize), pending(0), written(0),
+          busy(false), stopping(false), failed(false) {
+        file = path == "-" ? stdout : fopen(path.c_str(), "wb");
+        if (!file) throw FileException("Cannot open file for writing: " + path);
+        if (file != stdout) setvbuf(file, nullptr, _IONBF, 0);
+        writer = thread(&AsyncFileWriter::run, this);
     }
 
-    void addSupplier(const Supplier& s) {
-        if (findSupplier(s.supplierID)) {
-            throw DuplicateIDException("Duplicate Supplier ID: " + to_string(s.supplierID));
-        }
-        SupplierNode* newNode = new SupplierNode(s);
-        newNode->next = head;
-        head = newNode;
+    ~AsyncFileWriter() {
+        try { close(); } catch (...) {}
     }
 
-    Supplier* findSupplier(int supplierID) {
-        SupplierNode* current = head;
-        while (current) {
-            if (current->data.supplierID == supplierID)
-                return &(current->data);
-            current = current->next;
-        }
-        return nullptr;
+    // Waits until everything formatted so far has reached the file
+    void flush() override {
+        drain();
+        unique_lock<mutex> lock(mtx);
+        idle.wait(lock, [this] { return !busy; });
+        fflush(file);
     }
 
-    void displayAll() {
-        if (!head) {
-            cout << "No suppliers to display." << endl;
-            return;
-        }
-        cout << "--- Suppliers List ---" << endl;
-        SupplierNode* current = head;
-        while (current) {
-            current->data.display();
-            current = current->next;
+    void close() {
+        if (!file) return;
+        drain();
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
         }
-        cout << "----------------------" << endl;
+        ready.notify_one();
+        writer.join();
+
+        bool ok = !failed && fflush(file) == 0;
+        if (file != stdout && fclose(file) != 0) ok = false;
+        file = nullptr;
+        if (!ok) throw FileException("Error writing to: " + path);
     }
 
-    // Count suppliers
-    int count() {
-        int cnt = 0;
-        SupplierNode* current = head;
-        while (current) {
-            cnt++;
-            current = current->next;
-        }
-        return cnt;
+    long long bytesWritten() const { return written; }
+
+protected:
+    void drain() override {
+        if (used == 0) return;
+        unique_lock<mutex> lock(mtx);
+        idle.wait(lock, [this] { return !busy; });
+        buffer.swap(spare);
+        pending = used;
+        used = 0;
+        busy = true;
+        lock.unlock();
+        ready.notify_one();
     }
 
-    // Get all suppliers in array for sorting/searching
-    int getAllSuppliers(Supplier* arr[], int capacity) {
-        int idx = 0;
-        SupplierNode* current = head;
-        while (current && idx < capacity) {
-            arr[idx++] = &(current->data);
-            current = current->next;
+private:
+    string path;
+    FILE* file;
+    vector<char> spare;      // the chunk being written while busy
+    size_t pending;
+    long long written;
+    bool busy;
+    bool stopping;
+    bool failed;
+    mutex mtx;
+    condition_variable ready;
+    condition_variable idle;
+    thread writer;
+
+    void run() {
+        unique_lock<mutex> lock(mtx);
+        for (;;) {
+            ready.wait(lock, [this] { return busy || stopping; });
+            if (!busy) return;
+            size_t n = pending;
+            lock.unlock();
+            bool ok = fwrite(spare.data(), 1, n, file) == n;
+            lock.lock();
+            if (!ok) failed = true;
+            written += (long long)n;
+            busy = false;
+            idle.notify_all();
         }
-        return idx;
     }
 };
 
-// --------- STOCK CLASS ---------
-class Stock {
-public:
-    int productID;
-    int supplierID;
-    int quantity;
+// --------- METRICS ---------
+// Per-operation counters and latency histograms for the hot paths, plus a
+// few gauges (tree depth, list lengths). Each thread records into its own
+// counters with plain relaxed stores; readers merge every thread's
+// recordings when metrics are rendered. Histograms are log-linear like HDR
+// histograms: values below 8 ns are exact, above that each power of two is
+// split into 8 buckets (12.5% resolution) up to 2^40 ns.
+//
+// Every call is counted, but reading the clock twice costs about as much
+// as a lookup itself, so per-record operations time only one call in
+// METRIC_SAMPLE_RATE (per thread). Loads, saves, commits and name searches
+// time every call.
+//
+// Build with -DINVENTORY_METRICS=0 to compile the instrumentation out; the
+// METRIC_* macros then expand to nothing.
+#ifndef INVENTORY_METRICS
+#define INVENTORY_METRICS 1
+#endif
 
-    Stock() : productID(0), supplierID(0), quantity(0) {}
-    Stock(int pID, int sID, int qty) : productID(pID), supplierID(sID), quantity(qty) {}
+enum MetricOp {
+    OP_PRODUCT_INSERT,
+    OP_PRODUCT_SEARCH,
+    OP_PRODUCT_REMOVE,
+    OP_SUPPLIER_ADD,
+    OP_SUPPLIER_FIND,
+    OP_STOCK_ADD,
+    OP_LOAD_PRODUCTS,
+    OP_LOAD_SUPPLIERS,
+    OP_LOAD_STOCKS,
+    OP_SAVE_PRODUCTS,
+    OP_SAVE_SUPPLIERS,
+    OP_SAVE_STOCKS,
+    OP_LOAD_SNAPSHOT,
+    OP_SAVE_SNAPSHOT,
+    OP_JOURNAL_COMMIT,
+    OP_PRODUCT_NAME_SEARCH,
+    METRIC_OP_COUNT
+};
 
-    void display() const {
-        cout << "Product ID: " << productID
-             << ", Supplier ID: " << supplierID
-             << ", Quantity: " << quantity << endl;
-    }
+const uint64_t METRIC_SAMPLE_RATE = 16;    // a power of two
 
-    string toString() const {
-        stringstream ss;
-        ss << productID << "," << supplierID << "," << quantity;
-        return ss.str();
+// Whether every call of op is timed, not only a sample
+inline bool metricTimesEveryCall(int op) {
+    return op >= OP_LOAD_PRODUCTS;
+}
+
+const char* const METRIC_OP_NAMES[METRIC_OP_COUNT] = {
+    "product_insert", "product_search", "product_remove", "supplier_add", "supplier_find", "stock_add",
+    "load_products", "load_suppliers", "load_stocks", "save_products", "save_suppliers", "save_stocks",
+    "load_snapshot", "save_snapshot", "journal_commit", "product_name_search"};
+
+enum MetricGauge {
+    GAUGE_PRODUCT_TREE_DEPTH,
+    GAUGE_PRODUCTS,
+    GAUGE_SUPPLIERS,
+    GAUGE_STOCK_RECORDS,
+    METRIC_GAUGE_COUNT
+};
+
+const char* const METRIC_GAUGE_NAMES[METRIC_GAUGE_COUNT] = {
+    "inventory_product_tree_depth", "inventory_products", "inventory_supplier_list_length",
+    "inventory_stock_list_length"};
+
+const char* const METRIC_GAUGE_HELP[METRIC_GAUGE_COUNT] = {
+    "Levels in the product B+tree, leaves included.", "Products in the index.",
+    "Suppliers in the supplier list.", "Records in the stock list."};
+
+const int HISTOGRAM_SUB_BITS = 3;
+const int HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS;
+const int HISTOGRAM_MAX_BITS = 40;
+const int HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS;
+
+// Index of the highest set bit; value must be non-zero
+inline int highestBit(uint64_t value) {
+    int bit = 0;
+    for (int shift = 32; shift > 0; shift /= 2) {
+        if (value >> shift) {
+            value >>= shift;
+            bit += shift;
+        }
     }
+    return bit;
+}
 
-    static Stock fromString(const string& line) {
-        stringstream ss(line);
-        string token;
-        int pID, sID, qty;
+inline int histogramBucket(uint64_t ns) {
+    if (ns < (uint64_t)HISTOGRAM_SUB_BUCKETS) return (int)ns;
+    int exponent = highestBit(ns);
+    if (exponent >= HISTOGRAM_MAX_BITS) return HISTOGRAM_BUCKETS - 1;
+    int sub = (int)(ns >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
 
-        getline(ss, token, ','); pID = stoi(token);
-        getline(ss, token, ','); sID = stoi(token);
-        getline(ss, token, ','); qty = stoi(token);
+// Smallest value that falls into bucket; the bucket ends where the next begins
+inline uint64_t histogramBucketStart(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) return (uint64_t)bucket;
+    int exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(bucket % HISTOGRAM_SUB_BUCKETS);
+    return (HISTOGRAM_SUB_BUCKETS + sub) << (exponent - HISTOGRAM_SUB_BITS);
+}
+
+// Merged view of one operation's timings
+struct LatencyHistogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS] = {};
+    uint64_t count = 0;        // timed calls
+    uint64_t sumNanos = 0;
+    uint64_t calls = 0;        // all calls, timed or not
 
-        return Stock(pID, sID, qty);
+    // Upper end of the bucket holding the q-th quantile
+    uint64_t quantile(double q) const {
+        if (count == 0) return 0;
+        uint64_t rank = (uint64_t)(q * (double)(count - 1)) + 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+            seen += buckets[b];
+            if (seen >= rank)
+                return b + 1 < HISTOGRAM_BUCKETS ? histogramBucketStart(b + 1) - 1 : histogramBucketStart(b);
+        }
+        return histogramBucketStart(HISTOGRAM_BUCKETS - 1);
     }
 };
 
-// --------- STOCK NODE & LINKED LIST ---------
-class StockNode {
+struct MetricsSnapshot {
+    LatencyHistogram ops[METRIC_OP_COUNT];
+    long long gauges[METRIC_GAUGE_COUNT];
+};
+
+// Adds to a counter that only the calling thread writes: a relaxed load and
+// store instead of a locked add
+inline void bumpOwned(atomic<uint64_t>& counter, uint64_t n) {
+    counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+class MetricsRegistry {
 public:
-    Stock data;
-    StockNode* next;
+    // One thread's recordings
+    struct ThreadMetrics {
+        atomic<uint64_t> buckets[METRIC_OP_COUNT][HISTOGRAM_BUCKETS];
+        atomic<uint64_t> sumNanos[METRIC_OP_COUNT];
+        atomic<uint64_t> calls[METRIC_OP_COUNT];
 
-    StockNode(const Stock& s) : data(s), next(nullptr) {}
-};
+        ThreadMetrics() {
+            for (int op = 0; op < METRIC_OP_COUNT; ++op) {
+                for (atomic<uint64_t>& b : buckets[op]) b.store(0, memory_order_relaxed);
+                sumNanos[op].store(0, memory_order_relaxed);
+                calls[op].store(0, memory_order_relaxed);
+            }
+        }
+
+        // Counts a call and says whether to time it
+        bool startCall(MetricOp op) {
+            uint64_t n = calls[op].load(memory_order_relaxed);
+            calls[op].store(n + 1, memory_order_relaxed);
+            return metricTimesEveryCall(op) || (n & (METRIC_SAMPLE_RATE - 1)) == 0;
+        }
+
+        void record(MetricOp op, uint64_t ns) {
+            bumpOwned(buckets[op][histogramBucket(ns)], 1);
+            bumpOwned(sumNanos[op], ns);
+        }
+    };
 
-class StockList {
 private:
-    StockNode* head;
 
-public:
-    StockList() : head(nullptr) {}
+    // Registers the thread's metrics on first use and folds them into
+    // retired when the thread exits
+    struct ThreadHandle {
+        ThreadMetrics* metrics;
 
-    ~StockList() {
-        while (head) {
-            StockNode* temp = head;
-            head = head->next;
-            delete temp;
+        ThreadHandle() : metrics(new ThreadMetrics()) {
+            MetricsRegistry& r = metricsRegistry();
+            lock_guard<mutex> lock(r.threadsMutex);
+            r.threads.push_back(metrics);
+        }
+
+        ~ThreadHandle() {
+            MetricsRegistry& r = metricsRegistry();
+            lock_guard<mutex> lock(r.threadsMutex);
+            r.mergeInto(*metrics, r.retired);
+            r.threads.erase(find(r.threads.begin(), r.threads.end(), metrics));
+            delete metrics;
         }
+    };
+
+    mutex threadsMutex;
+    vector<ThreadMetrics*> threads;
+    MetricsSnapshot retired;    // from threads that have exited
+    atomic<long long> gauges[METRIC_GAUGE_COUNT];
+
+    MetricsRegistry() {
+        for (atomic<long long>& g : gauges) g.store(0, memory_order_relaxed);
     }
 
-    void addStock(const Stock& s) {
-        // If product-supplier pair exists, update quantity instead of adding new
-        StockNode* current = head;
-        while (current) {
-            if (current->data.productID == s.productID && current->data.supplierID == s.supplierID) {
-                current->data.quantity += s.quantity;
-                return;
+    static void mergeInto(const ThreadMetrics& from, MetricsSnapshot& to) {
+        for (int op = 0; op < METRIC_OP_COUNT; ++op) {
+            LatencyHistogram& h = to.ops[op];
+            for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+                uint64_t n = from.buckets[op][b].load(memory_order_relaxed);
+                h.buckets[b] += n;
+                h.count += n;
             }
-            current = current->next;
+            h.sumNanos += from.sumNanos[op].load(memory_order_relaxed);
+            h.calls += from.calls[op].load(memory_order_relaxed);
         }
-        StockNode* newNode = new StockNode(s);
-        newNode->next = head;
-        head = newNode;
     }
 
-    // Display all stocks
-    void displayAll() {
-        if (!head) {
-            cout << "No stock records to display." << endl;
-            return;
-        }
-        cout << "--- Stock List ---" << endl;
-        StockNode* current = head;
-        while (current) {
-            current->data.display();
-            current = current->next;
-        }
-        cout << "------------------" << endl;
+public:
+    // The calling thread's recordings
+    static ThreadMetrics& local() {
+        thread_local ThreadHandle handle;
+        return *handle.metrics;
     }
 
-    // Find stock by product and supplier
-    Stock* findStock(int productID, int supplierID) {
-        StockNode* current = head;
-        while (current) {
-            if (current->data.productID == productID && current->data.supplierID == supplierID)
-                return &(current->data);
-            current = current->next;
-        }
-        return nullptr;
+    // Never destroyed, so threads exiting during shutdown can still report
+    static MetricsRegistry& metricsRegistry() {
+        static MetricsRegistry* registry = new MetricsRegistry();
+        return *registry;
     }
 
-    // Count stocks
-    int count() {
-        int cnt = 0;
-        StockNode* current = head;
-        while (current) {
-            cnt++;
-            current = current->next;
-        }
-        return cnt;
+    void setGauge(MetricGauge gauge, long long value) {
+        gauges[gauge].store(value, memory_order_relaxed);
     }
 
-    // Get all stocks in array for sorting/searching
-    int getAllStocks(Stock* arr[], int capacity) {
-        int idx = 0;
-        StockNode* current = head;
-        while (current && idx < capacity) {
-            arr[idx++] = &(current->data);
-            current = current->next;
+    // Every thread's recordings merged, plus the current gauges
+    unique_ptr<MetricsSnapshot> snapshot() {
+        unique_ptr<MetricsSnapshot> merged(new MetricsSnapshot());
+        {
+            lock_guard<mutex> lock(threadsMutex);
+            *merged = retired;
+            for (const ThreadMetrics* t : threads) mergeInto(*t, *merged);
         }
-        return idx;
+        for (int g = 0; g < METRIC_GAUGE_COUNT; ++g)
+            merged->gauges[g] = gauges[g].load(memory_order_relaxed);
+        return merged;
     }
 };
 
-// --------- Sorting Functions ---------
+// Counts the enclosing scope as one operation and times it if sampled
+class ScopedOpTimer {
+private:
+    MetricOp op;
+    MetricsRegistry::ThreadMetrics& metrics;
+    bool timed;
+    chrono::steady_clock::time_point started;
 
-// Bubble Sort for Products by productID
-void bubbleSortProducts(Product* arr[], int n) {
-    bool swapped;
-    for (int i = 0; i < n -1; ++i) {
-        swapped = false;
-        for (int j = 0; j < n - i -1; ++j) {
-            if (arr[j]->productID > arr[j+1]->productID) {
-                swap(arr[j], arr[j+1]);
-                swapped = true;
-            }
-        }
-        if (!swapped) break;
+public:
+    explicit ScopedOpTimer(MetricOp o) : op(o), metrics(MetricsRegistry::local()), timed(metrics.startCall(o)) {
+        if (timed) started = chrono::steady_clock::now();
     }
-}
 
-// Bubble Sort for Suppliers by supplierID
-void bubbleSortSuppliers(Supplier* arr[], int n) {
-    bool swapped;
-    for (int i = 0; i < n -1; ++i) {
+    ~ScopedOpTimer() {
+        if (!timed) return;
+        metrics.record(op, (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                               chrono::steady_clock::now() - started).count());
+    }
+
+    ScopedOpTimer(const ScopedOpTimer&) = delete;
+    ScopedOpTimer& operator=(const ScopedOpTimer&) = delete;
+};
+
+#if INVENTORY_METRICS
+#define METRIC_TIMER(op) ScopedOpTimer metricTimer(op)
+#define METRIC_GAUGE(gauge, value) MetricsRegistry::metricsRegistry().setGauge(gauge, value)
+// A store's gauge; only the store marked by its publishMetrics() writes
+// it, so scratch stores leave the gauges on the live inventory
+#define STORE_GAUGE(gauge, value) \
+    do { \
+        if (publishing) METRIC_GAUGE(gauge, value); \
+    } while (0)
+#else
+#define METRIC_TIMER(op) ((void)0)
+#define METRIC_GAUGE(gauge, value) ((void)0)
+#define STORE_GAUGE(gauge, value) ((void)0)
+#endif
+
+// Prometheus text exposition of everything recorded so far. Latencies are
+// a histogram in seconds over the timed calls, with a bucket boundary at
+// each power of two nanoseconds (le is 2^k - 1 ns, since durations are
+// whole nanoseconds); the finer buckets feed the quantile gauges alongside.
+string renderMetrics() {
+    unique_ptr<MetricsSnapshot> m = MetricsRegistry::metricsRegistry().snapshot();
+    string out;
+#if !INVENTORY_METRICS
+    out += "# Instrumentation was compiled out (INVENTORY_METRICS=0).\n";
+#endif
+    out += "# HELP inventory_operations_total Completed operations.\n"
+           "# TYPE inventory_operations_total counter\n";
+    for (int op = 0; op < METRIC_OP_COUNT; ++op) {
+        out += "inventory_operations_total{op=\"";
+        out += METRIC_OP_NAMES[op];
+        out += "\"} ";
+        appendNumber(out, (long long)m->ops[op].calls);
+        out += '\n';
+    }
+
+    out += "# HELP inventory_operation_duration_seconds Time per timed operation (per-record operations are sampled).\n"
+           "# TYPE inventory_operation_duration_seconds histogram\n";
+    for (int op = 0; op < METRIC_OP_COUNT; ++op) {
+        const LatencyHistogram& h = m->ops[op];
+        if (h.count == 0) continue;
+        string label = string("{op=\"") + METRIC_OP_NAMES[op] + "\"";
+        uint64_t cumulative = 0;
+        int last = HISTOGRAM_BUCKETS - 1;
+        while (last > 0 && h.buckets[last] == 0) --last;
+        for (int b = 0; b <= last; ++b) {
+            cumulative += h.buckets[b];
+            // Emit where a power of two begins
+            if (b + 1 < HISTOGRAM_BUCKETS && (b + 1) % HISTOGRAM_SUB_BUCKETS == 0) {
+                out += "inventory_operation_duration_seconds_bucket" + label + ",le=\"";
+                appendNumber(out, (double)(histogramBucketStart(b + 1) - 1) / 1e9);
+                out += "\"} ";
+                appendNumber(out, (long long)cumulative);
+                out += '\n';
+            }
+        }
+        out += "inventory_operation_duration_seconds_bucket" + label + ",le=\"+Inf\"} ";
+        appendNumber(out, (long long)h.count);
+        out += "\ninventory_operation_duration_seconds_sum" + label + "} ";
+        appendNumber(out, (double)h.sumNanos / 1e9);
+        out += "\ninventory_operation_duration_seconds_count" + label + "} ";
+        appendNumber(out, (long long)h.count);
+        out += '\n';
+    }
+
+    out += "# HELP inventory_operation_latency_seconds Latency quantiles (within 12.5%).\n"
+           "# TYPE inventory_operation_latency_seconds gauge\n";
+    const char* const quantileNames[] = {"0.5", "0.9", "0.99", "0.999"};
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for (int op = 0; op < METRIC_OP_COUNT; ++op) {
+        if (m->ops[op].count == 0) continue;
+        for (int q = 0; q < 4; ++q) {
+            out += string("inventory_operation_latency_seconds{op=\"") + METRIC_OP_NAMES[op] + "\",quantile=\"" +
+                   quantileNames[q] + "\"} ";
+            appendNumber(out, (double)m->ops[op].quantile(quantiles[q]) / 1e9);
+            out += '\n';
+        }
+    }
+
+    for (int g = 0; g < METRIC_GAUGE_COUNT; ++g) {
+        out += string("# HELP ") + METRIC_GAUGE_NAMES[g] + " " + METRIC_GAUGE_HELP[g] + "\n# TYPE " +
+               METRIC_GAUGE_NAMES[g] + " gauge\n" + METRIC_GAUGE_NAMES[g] + " ";
+        appendNumber(out, m->gauges[g]);
+        out += '\n';
+    }
+    return out;
+}
+
+// --------- STRING POOL ---------
+// Text fields live outside the records so that Product and Supplier are
+// small fixed-size PODs. Names and contact details are appended to an
+// arena and referenced by offset and length (TextRef). Category names are
+// interned once and referenced by a small ID, so a category shared by
+// thousands of products is stored once.
+//
+// Each store owns an arena and releases it when it is cleared, so a reload,
+// a journal replay or a background compaction frees the text of the copy
+// it replaces instead of piling up. Text goes to the calling thread's
+// current arena (see TextScope): loaders and command parsers point it at
+// the store being filled, and ThreadPool::run carries it over to its
+// tasks. A record inserted with text from another arena has its text
+// copied in. Text of records removed one at a time stays until the next
+// clear.
+//
+// Arenas are carved into 1 MiB chunks registered in one process-wide
+// chunk table, so a TextRef can be read without knowing its arena. Each
+// thread appends into a chunk of its own, so parallel parsers add text
+// without taking a lock. Offsets are 32-bit, which allows 4 GiB of live
+// text.
+struct TextRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Chunks of every arena, indexed by the top bits of a TextRef offset
+class TextChunks {
+public:
+    static const int CHUNK_BITS = 20;
+    static const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+    static const uint32_t MAX_CHUNKS = 4096;
+
+private:
+    atomic<char*> chunks[MAX_CHUNKS];
+    atomic<uint64_t> owners[MAX_CHUNKS];    // epoch of the arena holding each chunk, 0 if free
+    mutex lock;                             // guards the members below
+    uint32_t used;                          // slots handed out at least once
+    vector<uint32_t> freeSlots;
+    size_t liveChunks;
+
+    TextChunks() : used(0), liveChunks(0) {
+        for (uint32_t i = 0; i < MAX_CHUNKS; ++i) {
+            chunks[i].store(nullptr, memory_order_relaxed);
+            owners[i].store(0, memory_order_relaxed);
+        }
+    }
+
+public:
+    // Never destroyed, so records in static objects stay readable at exit
+    static TextChunks& instance() {
+        static TextChunks* table = new TextChunks();
+        return *table;
+    }
+
+    // Registers count consecutive chunks starting at block; returns the
+    // first slot. Runs longer than one chunk need fresh consecutive slots.
+    uint32_t add(char* block, uint32_t count, uint64_t owner) {
+        lock_guard<mutex> guard(lock);
+        uint32_t first;
+        if (count == 1 && !freeSlots.empty()) {
+            first = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            if (used + count > MAX_CHUNKS)
+                throw runtime_error("Text arena is full (4 GiB of names and contacts).");
+            first = used;
+            used += count;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            owners[first + i].store(owner, memory_order_relaxed);
+            chunks[first + i].store(block + (size_t)i * CHUNK_SIZE, memory_order_release);
+        }
+        liveChunks += count;
+        return first;
+    }
+
+    void remove(uint32_t first, uint32_t count) {
+        lock_guard<mutex> guard(lock);
+        for (uint32_t i = first; i < first + count; ++i) {
+            chunks[i].store(nullptr, memory_order_relaxed);
+            owners[i].store(0, memory_order_relaxed);
+            freeSlots.push_back(i);
+        }
+        liveChunks -= count;
+    }
+
+    const char* chunk(uint32_t slot) const {
+        return chunks[slot].load(memory_order_acquire);
+    }
+
+    uint64_t owner(uint32_t slot) const {
+        return owners[slot].load(memory_order_relaxed);
+    }
+
+    // Bytes of chunks held by all arenas
+    size_t reservedBytes() {
+        lock_guard<mutex> guard(lock);
+        return liveChunks * CHUNK_SIZE;
+    }
+};
+
+class TextArena {
+private:
+    static const int CHUNK_BITS = TextChunks::CHUNK_BITS;
+    static const uint32_t CHUNK_SIZE = TextChunks::CHUNK_SIZE;
+    static const int THREAD_CURSORS = 8;
+
+    // A run of chunks allocated together
+    struct Run {
+        uint32_t first;
+        uint32_t count;
+        unique_ptr<char[]> block;
+    };
+
+    // Where a thread appends next into the arena with this epoch
+    struct Cursor {
+        uint64_t epoch;    // 0 = unused
+        uint64_t lastUse;
+        uint32_t chunk;
+        uint32_t used;
+    };
+
+    vector<Run> runs;
+    mutex runMutex;    // guards runs
+    // Renewed on every release, so cursors left in other threads' caches
+    // never point into freed chunks
+    atomic<uint64_t> epoch;
+
+    static uint64_t newEpoch() {
+        static atomic<uint64_t> next(1);
+        return next.fetch_add(1);
+    }
+
+    // The calling thread's cursor for epoch e, taking over the least
+    // recently used one if the thread has none yet
+    static Cursor& cursor(uint64_t e) {
+        thread_local Cursor cursors[THREAD_CURSORS] = {};
+        thread_local uint64_t uses = 0;
+        Cursor* oldest = &cursors[0];
+        for (Cursor& c : cursors) {
+            if (c.epoch == e) {
+                c.lastUse = ++uses;
+                return c;
+            }
+            if (c.lastUse < oldest->lastUse) oldest = &c;
+        }
+        *oldest = Cursor{0, ++uses, 0, 0};
+        return *oldest;
+    }
+
+    // Gives the thread a fresh run of chunks, long enough for length bytes
+    void startChunk(Cursor& c, uint64_t e, size_t length) {
+        uint32_t count = (uint32_t)((length + CHUNK_SIZE - 1) / CHUNK_SIZE);
+        unique_ptr<char[]> block(new char[(size_t)count * CHUNK_SIZE]);
+        uint32_t first = TextChunks::instance().add(block.get(), count, e);
+        {
+            lock_guard<mutex> lock(runMutex);
+            runs.push_back(Run{first, count, move(block)});
+        }
+        c.epoch = e;
+        c.chunk = first;
+        c.used = 0;
+    }
+
+public:
+    TextArena() : epoch(newEpoch()) {}
+
+    ~TextArena() {
+        release();
+    }
+
+    TextArena(const TextArena&) = delete;
+    TextArena& operator=(const TextArena&) = delete;
+
+    // Arena for text with no store to go to (menu input, temporaries)
+    static TextArena& shared() {
+        static TextArena* arena = new TextArena();
+        return *arena;
+    }
+
+    // Arena internText() appends to on this thread; null means shared()
+    static TextArena*& current() {
+        thread_local TextArena* arena = nullptr;
+        return arena;
+    }
+
+    TextRef append(string_view text) {
+        if (text.empty()) return TextRef{0, 0};
+        uint64_t e = epoch.load(memory_order_relaxed);
+        Cursor& c = cursor(e);
+        if (c.epoch != e || CHUNK_SIZE - c.used < text.size()) startChunk(c, e, text.size());
+        uint64_t offset = ((uint64_t)c.chunk << CHUNK_BITS) + c.used;
+        memcpy((char*)TextChunks::instance().chunk(c.chunk) + c.used, text.data(), text.size());
+
+        // Text longer than a chunk ends inside the last chunk of its run
+        uint64_t end = offset + text.size();
+        c.chunk = (uint32_t)(end >> CHUNK_BITS);
+        c.used = (uint32_t)(end & (CHUNK_SIZE - 1));
+        if (c.used == 0) c.epoch = 0;
+        return TextRef{(uint32_t)offset, (uint32_t)text.size()};
+    }
+
+    // Whether ref's text lives in this arena (empty text lives anywhere)
+    bool owns(TextRef ref) const {
+        return ref.length == 0 ||
+               TextChunks::instance().owner(ref.offset >> CHUNK_BITS) == epoch.load(memory_order_relaxed);
+    }
+
+    // Frees all text; references into the arena become invalid. Must not
+    // run while another thread appends to it.
+    void release() {
+        lock_guard<mutex> lock(runMutex);
+        for (const Run& r : runs) TextChunks::instance().remove(r.first, r.count);
+        runs.clear();
+        epoch.store(newEpoch(), memory_order_relaxed);
+    }
+
+    size_t reservedBytes() {
+        lock_guard<mutex> lock(runMutex);
+        size_t chunks = 0;
+        for (const Run& r : runs) chunks += r.count;
+        return chunks * CHUNK_SIZE;
+    }
+};
+
+// Points internText() at an arena for the lifetime of the scope
+class TextScope {
+private:
+    TextArena* saved;
+
+public:
+    explicit TextScope(TextArena* arena) : saved(TextArena::current()) {
+        TextArena::current() = arena;
+    }
+
+    ~TextScope() {
+        TextArena::current() = saved;
+    }
+
+    TextScope(const TextScope&) = delete;
+    TextScope& operator=(const TextScope&) = delete;
+};
+
+inline TextRef internText(string_view text) {
+    TextArena* arena = TextArena::current();
+    return (arena ? *arena : TextArena::shared()).append(text);
+}
+
+inline string_view textOf(TextRef ref) {
+    if (ref.length == 0) return string_view();
+    const char* chunk = TextChunks::instance().chunk(ref.offset >> TextChunks::CHUNK_BITS);
+    return string_view(chunk + (ref.offset & (TextChunks::CHUNK_SIZE - 1)), ref.length);
+}
+
+// Category name <-> ID. ID 0 is the empty category.
+class CategoryPool {
+private:
+    mutable shared_mutex lock;
+    TextArena text;                              // never released
+    unordered_map<string_view, uint32_t> ids;    // keys point into text
+    vector<TextRef> names;
+
+    CategoryPool() {
+        names.push_back(TextRef{0, 0});
+        ids.emplace(string_view(), 0);
+    }
+
+public:
+    static CategoryPool& instance() {
+        static CategoryPool* pool = new CategoryPool();
+        return *pool;
+    }
+
+    uint32_t intern(string_view name) {
+        {
+            shared_lock<shared_mutex> reading(lock);
+            auto it = ids.find(name);
+            if (it != ids.end()) return it->second;
+        }
+        unique_lock<shared_mutex> writing(lock);
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        TextRef ref = text.append(name);
+        uint32_t id = (uint32_t)names.size();
+        names.push_back(ref);
+        ids.emplace(textOf(ref), id);
+        return id;
+    }
+
+    // ID of a category, or -1 if no product ever had it
+    int find(string_view name) const {
+        shared_lock<shared_mutex> reading(lock);
+        auto it = ids.find(name);
+        return it == ids.end() ? -1 : (int)it->second;
+    }
+
+    string_view name(uint32_t id) const {
+        shared_lock<shared_mutex> reading(lock);
+        return textOf(names[id]);
+    }
+
+    size_t size() const {
+        shared_lock<shared_mutex> reading(lock);
+        return names.size();
+    }
+};
+
+// Interns through a small per-thread cache first: parsers see the same few
+// categories over and over, and a hit needs no lock
+inline uint32_t internCategory(string_view name) {
+    struct Cached {
+        string_view name;
+        uint32_t id;
+    };
+    thread_local Cached cache[64] = {};    // empty entries map "" to 0, which is right
+    Cached& entry = cache[hash<string_view>()(name) & 63];
+    if (entry.name == name) return entry.id;
+    uint32_t id = CategoryPool::instance().intern(name);
+    entry.name = CategoryPool::instance().name(id);
+    entry.id = id;
+    return id;
+}
+
+inline string_view categoryName(uint32_t id) {
+    return CategoryPool::instance().name(id);
+}
+
+// --------- PRODUCT CLASS ---------
+// A 32-byte POD: the name is a reference into the text arena and the
+// category an interned ID (see STRING POOL)
+class Product {
+public:
+    int productID;
+    int reorderLevel;    // total stock below this needs reordering; 0 = not watched
+    double price;
+    TextRef nameRef;
+    uint32_t categoryID;
+
+    Product() : productID(0), reorderLevel(0), price(0.0), nameRef{0, 0}, categoryID(0) {}
+    Product(int id, string_view n, double p, string_view c, int level = 0)
+        : productID(id), reorderLevel(level), price(p), nameRef(internText(n)), categoryID(internCategory(c)) {}
+
+    string_view name() const { return textOf(nameRef); }
+    string_view category() const { return categoryName(categoryID); }
+    void setName(string_view n) { nameRef = internText(n); }
+    void setCategory(string_view c) { categoryID = internCategory(c); }
+
+    void display(OutBuffer& out) const {
+        out << "Product ID: " << productID
+            << ", Name: " << name()
+            << ", Price: $" << price
+            << ", Category: " << category();
+        if (reorderLevel > 0) out << ", Reorder Level: " << reorderLevel;
+        out << '\n';
+    }
+
+    void display() const {
+        display(console());
+        console().flush();
+    }
+
+    // The reorder level is written only when set, so files without
+    // thresholds keep the original four-field layout. The price is written
+    // in full so that it reads back unchanged.
+    void appendTo(string& out) const {
+        appendNumber(out, productID);
+        out += ',';
+        out += name();
+        out += ',';
+        appendNumber(out, price);
+        out += ',';
+        out += category();
+        if (reorderLevel > 0) {
+            out += ',';
+            appendNumber(out, reorderLevel);
+        }
+    }
+
+    string toString() const {
+        string s;
+        appendTo(s);
+        return s;
+    }
+
+    // Parses "id,name,price,category[,reorderLevel]" in place. On failure
+    // returns false and points error at a short description.
+    static bool parse(const char* begin, const char* end, Product& out, const char*& error) {
+        const char* idEnd = fieldEnd(begin, end);
+        if (idEnd == end) { error = "missing name and price"; return false; }
+        const char* nameBegin = idEnd + 1;
+        const char* nameEnd = fieldEnd(nameBegin, end);
+        if (nameEnd == end) { error = "missing price"; return false; }
+        const char* priceBegin = nameEnd + 1;
+        const char* priceEnd = fieldEnd(priceBegin, end);
+        const char* categoryBegin = priceEnd == end ? end : priceEnd + 1;
+        const char* categoryEnd = fieldEnd(categoryBegin, end);
+        const char* levelBegin = categoryEnd == end ? end : categoryEnd + 1;
+        const char* levelEnd = fieldEnd(levelBegin, end);
+
+        if (!parseIntField(begin, idEnd, out.productID)) { error = "invalid product ID"; return false; }
+        if (!parseDoubleField(priceBegin, priceEnd, out.price)) { error = "invalid price"; return false; }
+        out.reorderLevel = 0;
+        if (levelBegin != levelEnd && !parseIntField(levelBegin, levelEnd, out.reorderLevel)) {
+            error = "invalid reorder level";
+            return false;
+        }
+        out.setName(string_view(nameBegin, (size_t)(nameEnd - nameBegin)));
+        out.setCategory(string_view(categoryBegin, (size_t)(categoryEnd - categoryBegin)));
+        return true;
+    }
+
+    static Product fromString(const string& line) {
+        Product p;
+        const char* error = nullptr;
+        if (!parse(line.data(), line.data() + line.size(), p, error))
+            throw ParseException("Malformed product record (" + string(error) + "): " + line);
+        return p;
+    }
+};
+
+static_assert(is_trivially_copyable<Product>::value, "Product must stay a POD record");
+
+// --------- PRODUCT B+TREE NODES ---------
+// Wide nodes keep keys in contiguous arrays so a lookup touches only a few
+// cache lines per level. Arrays are one slot larger than BTREE_MAX_KEYS so
+// a node may overflow briefly before it is split. Leaves hold the Product
+// records themselves, so a product costs no node or pointer of its own;
+// the price is that a Product* from the tree is only valid until the next
+// insert or remove.
+const int BTREE_MAX_KEYS = 64;
+const int BTREE_MIN_KEYS = BTREE_MAX_KEYS / 2;
+const int BTREE_MAX_DEPTH = 32;
+
+class BTreeNode {
+public:
+    bool isLeaf;
+    int count;
+    int keys[BTREE_MAX_KEYS + 1];
+
+    BTreeNode(bool leaf) : isLeaf(leaf), count(0) {}
+};
+
+class BTreeLeaf : public BTreeNode {
+public:
+    Product values[BTREE_MAX_KEYS + 1];
+    BTreeLeaf* next;
+
+    BTreeLeaf() : BTreeNode(true), next(nullptr) {}
+};
+
+class BTreeInner : public BTreeNode {
+public:
+    BTreeNode* children[BTREE_MAX_KEYS + 2];
+
+    BTreeInner() : BTreeNode(false) {}
+};
+
+// First index in keys[0..n) whose key is >= key
+inline int lowerBoundKey(const int keys[], int n, int key) {
+    int low = 0, high = n;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (keys[mid] < key) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// First index in keys[0..n) whose key is > key
+inline int upperBoundKey(const int keys[], int n, int key) {
+    int low = 0, high = n;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (keys[mid] <= key) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// --------- CATEGORY INDEX ---------
+// Secondary index from category to products. Each interned category ID
+// (see CategoryPool) owns a sorted posting list of productIDs, so a
+// category query costs one hash lookup plus the size of its result rather
+// than a walk over the catalog.
+class CategoryIndex {
+private:
+    vector<vector<int>> postings;    // category ID -> sorted productIDs
+
+public:
+    void add(uint32_t categoryID, int productID) {
+        if (categoryID >= postings.size()) postings.resize(categoryID + 1);
+        vector<int>& list = postings[categoryID];
+        if (list.empty() || list.back() < productID)
+            list.push_back(productID);    // IDs usually arrive in order
+        else
+            list.insert(lower_bound(list.begin(), list.end(), productID), productID);
+    }
+
+    void remove(uint32_t categoryID, int productID) {
+        if (categoryID >= postings.size()) return;
+        vector<int>& list = postings[categoryID];
+        auto pos = lower_bound(list.begin(), list.end(), productID);
+        if (pos != list.end() && *pos == productID) list.erase(pos);
+    }
+
+    void clear() {
+        postings.clear();
+    }
+
+    // Category IDs run from 0 to size() - 1; some may have no products
+    size_t size() const { return postings.size(); }
+
+    string_view name(uint32_t id) const { return categoryName(id); }
+
+    // Sorted productIDs of category ID id
+    const vector<int>& posting(uint32_t id) const { return postings[id]; }
+
+    // ID of a category, or -1 if no product here ever had it
+    int idOf(string_view category) const {
+        int id = CategoryPool::instance().find(category);
+        return id >= 0 && (size_t)id < postings.size() ? id : -1;
+    }
+
+    // Sorted productIDs in the category, or nullptr if it was never seen
+    const vector<int>* find(string_view category) const {
+        int id = idOf(category);
+        return id < 0 ? nullptr : &postings[id];
+    }
+
+    size_t count(string_view category) const {
+        const vector<int>* list = find(category);
+        return list ? list->size() : 0;
+    }
+
+    // Non-empty categories with their product counts, by name
+    vector<pair<string, size_t>> summary() const {
+        vector<pair<string, size_t>> result;
+        for (size_t id = 0; id < postings.size(); ++id)
+            if (!postings[id].empty()) result.emplace_back(string(name((uint32_t)id)), postings[id].size());
+        sort(result.begin(), result.end());
+        return result;
+    }
+};
+
+// IDs present in both sorted lists. Each ID of the shorter list is looked
+// up in the longer one with a galloping search that resumes where the last
+// one stopped, so a small list against a large one stays cheap.
+vector<int> intersectSorted(const vector<int>& a, const vector<int>& b) {
+    const vector<int>& small = a.size() <= b.size() ? a : b;
+    const vector<int>& large = a.size() <= b.size() ? b : a;
+    vector<int> result;
+    size_t low = 0;
+    for (int id : small) {
+        size_t step = 1, high = low;
+        while (high < large.size() && large[high] < id) {
+            low = high + 1;
+            high += step;
+            step *= 2;
+        }
+        low = lower_bound(large.begin() + low, large.begin() + min(high + 1, large.size()), id) - large.begin();
+        if (low == large.size()) break;
+        if (large[low] == id) result.push_back(id);
+    }
+    return result;
+}
+
+// --------- NAME INDEX ---------
+// Secondary index from product names to productIDs, for finding "Samsung
+// A15" by typing "sams" or "a15". Names are matched without regard to
+// ASCII case.
+//
+// Prefix queries walk a radix tree (a trie with runs of single-child nodes
+// merged into one edge); the matches below the query's node come out in
+// name order, and the walk stops after the requested number. Substring
+// queries use trigram posting lists: a name containing the query contains
+// each of its 3-byte windows, so candidates are the IDs in every one of
+// those lists. The rarest list is walked and the others probed with a
+// galloping search; candidates are then checked against the real name,
+// again stopping at the requested number.
+//
+// Removing a product leaves its ID in the trigram lists: the lists of
+// common trigrams hold most of the catalog, and erasing from them would
+// make each removal O(n). Since every candidate's name is checked anyway,
+// stale IDs only cost a little query time, and the lists are rebuilt from
+// the trie once stale entries make up half of them.
+//
+// Edge labels are lowercased text in the arena (see STRING POOL), so a
+// split edge only narrows its view. The index is built on the first name
+// search and kept up to date by insert and remove from then on, so loads
+// and sessions that never search by name do not pay for it.
+const size_t NAME_SEARCH_DEFAULT_LIMIT = 10;
+const size_t NAME_SEARCH_MAX_LIMIT = 1000;
+const size_t NAME_INDEX_MIN_PURGE = 65536;    // stale trigram entries tolerated regardless of size
+
+inline char foldCase(char c) {
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+inline string foldName(string_view text) {
+    string folded(text);
+    for (char& c : folded) c = foldCase(c);
+    return folded;
+}
+
+// Whether text contains needle (already folded), ignoring case
+inline bool containsFolded(string_view text, string_view needle) {
+    if (needle.size() > text.size()) return false;
+    for (size_t start = 0; start + needle.size() <= text.size(); ++start) {
+        size_t i = 0;
+        while (i < needle.size() && foldCase(text[start + i]) == needle[i]) i++;
+        if (i == needle.size()) return true;
+    }
+    return false;
+}
+
+class NameIndex {
+private:
+    static const uint32_t NONE = UINT32_MAX;
+
+    struct TrieNode {
+        const char* label;    // edge from the parent; empty only at the root
+        uint32_t length;
+        uint32_t child;       // first child; siblings are sorted by first byte
+        uint32_t sibling;
+        uint32_t extra;       // extraIDs slot when several products share the name
+        int productID;
+        bool terminal;        // a name ends here
+    };
+
+    vector<TrieNode> nodes;    // node 0 is the root
+    vector<uint32_t> freeNodes;
+    vector<vector<int>> extraIDs;
+    vector<uint32_t> freeExtras;
+    unordered_map<uint32_t, vector<int>> trigrams;    // 3 folded bytes -> sorted productIDs
+    size_t postingEntries;    // IDs in all trigram lists, stale ones included
+    size_t staleEntries;      // left behind by removals
+    bool built;
+    TextArena labels;         // trie labels; freed by clear()
+
+    static uint32_t trigramAt(string_view folded, size_t i) {
+        return (uint32_t)(unsigned char)folded[i] << 16 | (uint32_t)(unsigned char)folded[i + 1] << 8 |
+               (uint32_t)(unsigned char)folded[i + 2];
+    }
+
+    // Distinct trigrams of a folded name
+    static vector<uint32_t> trigramsOf(string_view folded) {
+        vector<uint32_t> keys;
+        for (size_t i = 0; i + 3 <= folded.size(); ++i) keys.push_back(trigramAt(folded, i));
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+        return keys;
+    }
+
+    uint32_t newNode(string_view label) {
+        TrieNode node = {label.data(), (uint32_t)label.size(), NONE, NONE, NONE, 0, false};
+        if (!freeNodes.empty()) {
+            uint32_t index = freeNodes.back();
+            freeNodes.pop_back();
+            nodes[index] = node;
+            return index;
+        }
+        nodes.push_back(node);
+        return (uint32_t)nodes.size() - 1;
+    }
+
+    // Copy of text in the index's own arena, which outlives any removal
+    string_view keep(string_view text) {
+        return textOf(labels.append(text));
+    }
+
+    // Child of parent whose label starts with c, or NONE; prev is the
+    // sibling before it (or before where it would go), NONE if first
+    uint32_t findChild(uint32_t parent, char c, uint32_t& prev) const {
+        prev = NONE;
+        for (uint32_t n = nodes[parent].child; n != NONE; prev = n, n = nodes[n].sibling) {
+            unsigned char first = (unsigned char)nodes[n].label[0];
+            if (first == (unsigned char)c) return n;
+            if (first > (unsigned char)c) return NONE;
+        }
+        return NONE;
+    }
+
+    // Puts node (or the node replacing one) after prev in parent's children
+    void link(uint32_t parent, uint32_t prev, uint32_t node) {
+        if (prev == NONE) nodes[parent].child = node;
+        else nodes[prev].sibling = node;
+    }
+
+    void addID(uint32_t node, int productID) {
+        TrieNode& n = nodes[node];
+        if (!n.terminal) {
+            n.terminal = true;
+            n.productID = productID;
+            return;
+        }
+        if (n.extra == NONE) {
+            if (!freeExtras.empty()) {
+                n.extra = freeExtras.back();
+                freeExtras.pop_back();
+            } else {
+                n.extra = (uint32_t)extraIDs.size();
+                extraIDs.emplace_back();
+            }
+        }
+        extraIDs[n.extra].push_back(productID);
+    }
+
+    // False if productID was not stored at node
+    bool removeID(uint32_t node, int productID) {
+        TrieNode& n = nodes[node];
+        if (!n.terminal) return false;
+        if (n.productID != productID) {
+            if (n.extra == NONE) return false;
+            vector<int>& more = extraIDs[n.extra];
+            auto pos = find(more.begin(), more.end(), productID);
+            if (pos == more.end()) return false;
+            more.erase(pos);
+        } else if (n.extra != NONE) {
+            n.productID = extraIDs[n.extra].back();
+            extraIDs[n.extra].pop_back();
+        } else {
+            n.terminal = false;
+        }
+        if (n.extra != NONE && extraIDs[n.extra].empty()) {
+            freeExtras.push_back(n.extra);
+            n.extra = NONE;
+        }
+        return true;
+    }
+
+    // Folds the only child of node into it, keeping the tree compressed
+    void mergeWithChild(uint32_t node) {
+        uint32_t child = nodes[node].child;
+        string joined(nodes[node].label, nodes[node].length);
+        joined.append(nodes[child].label, nodes[child].length);
+        string_view label = keep(joined);
+        TrieNode& n = nodes[node];
+        const TrieNode& c = nodes[child];
+        n.label = label.data();
+        n.length = (uint32_t)label.size();
+        n.child = c.child;
+        n.extra = c.extra;
+        n.productID = c.productID;
+        n.terminal = c.terminal;
+        freeNodes.push_back(child);
+    }
+
+    void addTrigrams(int productID, string_view folded) {
+        for (uint32_t key3 : trigramsOf(folded)) {
+            vector<int>& list = trigrams[key3];
+            if (list.empty() || list.back() < productID) {
+                list.push_back(productID);    // IDs usually arrive in order
+            } else {
+                auto at = lower_bound(list.begin(), list.end(), productID);
+                if (at != list.end() && *at == productID) continue;    // a stale entry, live again
+                list.insert(at, productID);
+            }
+            postingEntries++;
+        }
+    }
+
+    // Refills the trigram lists from the names in the trie, dropping
+    // stale entries
+    void rebuildTrigrams() {
+        trigrams.clear();
+        postingEntries = 0;
+        staleEntries = 0;
+        string name;
+        vector<pair<uint32_t, size_t>> pending;    // (node, length of its parent's name)
+        for (uint32_t c = nodes[0].child; c != NONE; c = nodes[c].sibling) pending.emplace_back(c, 0);
+        while (!pending.empty()) {
+            uint32_t node = pending.back().first;
+            name.resize(pending.back().second);
+            pending.pop_back();
+            const TrieNode& n = nodes[node];
+            name.append(n.label, n.length);
+            if (n.terminal) {
+                for (uint32_t key3 : trigramsOf(name)) {
+                    vector<int>& list = trigrams[key3];
+                    list.push_back(n.productID);
+                    if (n.extra != NONE) list.insert(list.end(), extraIDs[n.extra].begin(), extraIDs[n.extra].end());
+                }
+            }
+            for (uint32_t c = n.child; c != NONE; c = nodes[c].sibling) pending.emplace_back(c, name.size());
+        }
+        for (auto& entry : trigrams) {
+            sort(entry.second.begin(), entry.second.end());
+            postingEntries += entry.second.size();
+        }
+    }
+
+    // Ends of names (in name order) below node, until limit are found
+    void collect(uint32_t start, size_t limit, vector<int>& out) const {
+        vector<uint32_t> pending(1, start);
+        while (!pending.empty() && out.size() < limit) {
+            uint32_t node = pending.back();
+            pending.pop_back();
+            const TrieNode& n = nodes[node];
+            if (n.terminal) {
+                out.push_back(n.productID);
+                if (n.extra != NONE)
+                    for (int id : extraIDs[n.extra]) {
+                        if (out.size() >= limit) return;
+                        out.push_back(id);
+                    }
+            }
+            if (node != start && n.sibling != NONE) pending.push_back(n.sibling);
+            if (n.child != NONE) pending.push_back(n.child);
+        }
+        if (out.size() > limit) out.resize(limit);
+    }
+
+public:
+    NameIndex() : postingEntries(0), staleEntries(0), built(false) {
+        clear();
+    }
+
+    bool ready() const { return built; }
+    void markBuilt() { built = true; }
+
+    // Empties the index; it is rebuilt on the next name search
+    void clear() {
+        nodes.assign(1, TrieNode{"", 0, NONE, NONE, NONE, 0, false});
+        freeNodes.clear();
+        extraIDs.clear();
+        freeExtras.clear();
+        trigrams.clear();
+        postingEntries = 0;
+        staleEntries = 0;
+        built = false;
+        labels.release();
+    }
+
+    void add(int productID, string_view name) {
+        string folded = foldName(name);
+        string_view key(folded);
+        uint32_t node = 0;
+        size_t pos = 0;
+        while (pos < key.size()) {
+            uint32_t prev;
+            uint32_t child = findChild(node, key[pos], prev);
+            if (child == NONE) {
+                uint32_t leaf = newNode(keep(key.substr(pos)));
+                nodes[leaf].sibling = prev == NONE ? nodes[node].child : nodes[prev].sibling;
+                link(node, prev, leaf);
+                node = leaf;
+                break;
+            }
+            size_t common = 1;
+            while (common < nodes[child].length && pos + common < key.size() &&
+                   nodes[child].label[common] == key[pos + common])
+                common++;
+            if (common < nodes[child].length) {
+                // The key leaves this edge part way along: split it
+                uint32_t middle = newNode(string_view(nodes[child].label, common));
+                nodes[middle].child = child;
+                nodes[middle].sibling = nodes[child].sibling;
+                nodes[child].sibling = NONE;
+                nodes[child].label += common;
+                nodes[child].length -= (uint32_t)common;
+                link(node, prev, middle);
+                child = middle;
+            }
+            node = child;
+            pos += common;
+        }
+        addID(node, productID);
+        addTrigrams(productID, folded);
+    }
+
+    void remove(int productID, string_view name) {
+        string folded = foldName(name);
+        string_view key(folded);
+
+        // Path of (node, sibling before it) from the root's child down
+        vector<pair<uint32_t, uint32_t>> path;
+        uint32_t node = 0;
+        size_t pos = 0;
+        while (pos < key.size()) {
+            uint32_t prev;
+            uint32_t child = findChild(node, key[pos], prev);
+            if (child == NONE || nodes[child].length > key.size() - pos ||
+                key.compare(pos, nodes[child].length, nodes[child].label, nodes[child].length) != 0)
+                return;
+            path.emplace_back(child, prev);
+            node = child;
+            pos += nodes[child].length;
+        }
+        if (!removeID(node, productID)) return;
+
+        if (!nodes[node].terminal && node != 0) {
+            uint32_t parent = path.size() >= 2 ? path[path.size() - 2].first : 0;
+            if (nodes[node].child == NONE) {
+                // Unlink the emptied leaf; its parent may be left with one child
+                link(parent, path.back().second, nodes[node].sibling);
+                freeNodes.push_back(node);
+                const TrieNode& p = nodes[parent];
+                if (parent != 0 && !p.terminal && p.child != NONE && nodes[p.child].sibling == NONE)
+                    mergeWithChild(parent);
+            } else if (nodes[nodes[node].child].sibling == NONE) {
+                mergeWithChild(node);
+            }
+        }
+
+        staleEntries += trigramsOf(folded).size();
+        if (staleEntries > NAME_INDEX_MIN_PURGE && staleEntries * 2 > postingEntries) rebuildTrigrams();
+    }
+
+    // IDs of up to limit names starting with folded, in name order
+    vector<int> prefix(string_view folded, size_t limit) const {
+        vector<int> result;
+        uint32_t node = 0;
+        size_t pos = 0;
+        while (pos < folded.size()) {
+            uint32_t prev;
+            uint32_t child = findChild(node, folded[pos], prev);
+            if (child == NONE) return result;
+            size_t length = min((size_t)nodes[child].length, folded.size() - pos);
+            if (folded.compare(pos, length, nodes[child].label, length) != 0) return result;
+            node = child;
+            pos += length;
+        }
+        collect(node, limit, result);
+        return result;
+    }
+
+    // Appends, in ID order, up to limit IDs whose trigrams cover folded
+    // (at least 3 bytes) and for which accept(id) holds. The lists may hold
+    // stale IDs, so accept must check the product's current name; it may
+    // also skip IDs already found.
+    template <typename Accept>
+    void substring(string_view folded, size_t limit, vector<int>& out, Accept accept) const {
+        if (folded.size() < 3 || limit == 0) return;
+        vector<const vector<int>*> lists;
+        for (uint32_t key3 : trigramsOf(folded)) {
+            auto it = trigrams.find(key3);
+            if (it == trigrams.end()) return;
+            lists.push_back(&it->second);
+        }
+        sort(lists.begin(), lists.end(),
+             [](const vector<int>* a, const vector<int>* b) { return a->size() < b->size(); });
+
+        vector<size_t> cursor(lists.size(), 0);
+        size_t found = 0;
+        for (int id : *lists[0]) {
+            bool everywhere = true;
+            for (size_t l = 1; l < lists.size() && everywhere; ++l) {
+                const vector<int>& list = *lists[l];
+                size_t low = cursor[l], step = 1, high = low;
+                while (high < list.size() && list[high] < id) {
+                    low = high + 1;
+                    high += step;
+                    step *= 2;
+                }
+                low = lower_bound(list.begin() + low, list.begin() + min(high + 1, list.size()), id) - list.begin();
+                cursor[l] = low;
+                if (low == list.size()) return;
+                everywhere = list[low] == id;
+            }
+            if (everywhere && accept(id)) {
+                out.push_back(id);
+                if (++found == limit) return;
+            }
+        }
+    }
+
+    // Trie nodes in use and distinct trigrams
+    size_t nodeCount() const { return nodes.size() - freeNodes.size(); }
+    size_t trigramCount() const { return trigrams.size(); }
+
+    // Approximate heap bytes held by the index
+    size_t bytes() const {
+        size_t total = nodes.capacity() * sizeof(TrieNode) + freeNodes.capacity() * sizeof(uint32_t);
+        for (const vector<int>& more : extraIDs) total += more.capacity() * sizeof(int);
+        for (const auto& entry : trigrams)
+            total += entry.second.capacity() * sizeof(int) + sizeof(entry) + sizeof(void*);
+        return total;
+    }
+};
+
+// --------- CHANGE TRACKING ---------
+// The text files are saved in segments of about SEGMENT_RECORDS records,
+// each covering a range of keys (productID, or supplierID for suppliers;
+// see saveSegments). Each store marks the key of every record it adds,
+// changes or removes in a bitmap of 4096-key buckets, so a save only
+// rewrites the segments whose key range holds a marked bucket.
+const int CHANGE_BUCKET_BITS = 12;
+const uint32_t CHANGE_BUCKETS = 1u << (32 - CHANGE_BUCKET_BITS);
+
+// Bucket numbers follow key order, negative keys included
+inline uint32_t changeBucketOf(int key) {
+    return ((uint32_t)key ^ 0x80000000u) >> CHANGE_BUCKET_BITS;
+}
+
+// One bit per bucket. Marking skips the atomic OR when the bit is already
+// set, so the stock updates that run in parallel in server mode mark
+// changes without further locking and almost always without a write.
+class ChangedKeys {
+private:
+    unique_ptr<atomic<uint64_t>[]> bits;
+    bool everything;    // the files may hold anything: rewrite them all
+
+public:
+    // A new store has never been saved, so its first save is a full one
+    ChangedKeys() : bits(new atomic<uint64_t>[CHANGE_BUCKETS / 64]()), everything(true) {}
+
+    void mark(int key) {
+        uint32_t bucket = changeBucketOf(key);
+        atomic<uint64_t>& word = bits[bucket >> 6];
+        uint64_t bit = 1ull << (bucket & 63);
+        if (!(word.load(memory_order_relaxed) & bit))
+            word.fetch_or(bit, memory_order_relaxed);
+    }
+
+    void markAll() { everything = true; }
+
+    bool all() const { return everything; }
+
+    // Whether a key in [low, high] may have changed
+    bool any(int low, int high) const {
+        uint32_t first = changeBucketOf(low);
+        uint32_t last = changeBucketOf(high);
+        for (uint32_t w = first >> 6; w <= last >> 6; ++w) {
+            uint64_t word = bits[w].load(memory_order_relaxed);
+            if (w == first >> 6) word &= ~0ull << (first & 63);
+            if (w == last >> 6) word &= ~0ull >> (63 - (last & 63));
+            if (word) return true;
+        }
+        return false;
+    }
+
+    // The files match the store again (after a save or a load)
+    void reset() {
+        for (uint32_t w = 0; w < CHANGE_BUCKETS / 64; ++w)
+            bits[w].store(0, memory_order_relaxed);
+        everything = false;
+    }
+};
+
+// Smallest and largest key a store has held since it was last cleared.
+// Removals do not narrow it, so it may be wider than the keys present but
+// never narrower; saveSegments uses it to bound the first and last
+// segments, whose key ranges are open-ended.
+class KeyBounds {
+public:
+    int low;
+    int high;
+
+    KeyBounds() { reset(); }
+
+    void widen(int key) {
+        if (key < low) low = key;
+        if (key > high) high = key;
+    }
+
+    void reset() {
+        low = INT_MAX;
+        high = INT_MIN;
+    }
+};
+
+// --------- PRODUCT INDEX (B+TREE) ---------
+// Keeps the original ProductBST interface, but is a B+tree: every leaf sits
+// at the same depth, so sorted loads no longer degrade into a linked list,
+// and all traversals are iterative so large catalogs cannot overflow the
+// stack. Child i of an inner node holds keys in [keys[i-1], keys[i]).
+class ProductBST {
+private:
+    BTreeNode* root;
+    BTreeLeaf* firstLeaf;
+    int size;
+    NodePool<BTreeLeaf> leafPool;
+    NodePool<BTreeInner> innerPool;
+    CategoryIndex categories;
+    NameIndex names;
+    ChangedKeys changed;
+    KeyBounds keys;
+    bool publishing;    // see publishMetrics()
+    TextArena text;    // product names; freed by clear()
+
+    // p with its name copied into this tree's arena if it lives elsewhere
+    Product adopt(const Product& p) {
+        if (text.owns(p.nameRef)) return p;
+        Product copy = p;
+        copy.nameRef = text.append(p.name());
+        return copy;
+    }
+
+    // Descends to the leaf that would hold productID, recording the inner
+    // nodes and child slots taken on the way down.
+    BTreeLeaf* findLeaf(int productID, BTreeInner* path[], int slots[], int& depth) const {
+        depth = 0;
+        BTreeNode* node = root;
+        while (!node->isLeaf) {
+            BTreeInner* inner = static_cast<BTreeInner*>(node);
+            int slot = upperBoundKey(inner->keys, inner->count, productID);
+            path[depth] = inner;
+            slots[depth] = slot;
+            depth++;
+            node = inner->children[slot];
+        }
+        return static_cast<BTreeLeaf*>(node);
+    }
+
+    // Pushes a separator and new right sibling up the recorded path,
+    // splitting inner nodes as needed and growing a new root at the top.
+    void insertIntoParents(BTreeInner* path[], int slots[], int depth, int sepKey, BTreeNode* right) {
+        for (int d = depth - 1; d >= 0; --d) {
+            BTreeInner* inner = path[d];
+            int slot = slots[d];
+
+            for (int i = inner->count; i > slot; --i)
+                inner->keys[i] = inner->keys[i - 1];
+            for (int i = inner->count + 1; i > slot + 1; --i)
+                inner->children[i] = inner->children[i - 1];
+            inner->keys[slot] = sepKey;
+            inner->children[slot + 1] = right;
+            inner->count++;
+
+            if (inner->count <= BTREE_MAX_KEYS)
+                return;
+
+            // Split: the middle key moves up, it is not kept in either half
+            int mid = inner->count / 2;
+            BTreeInner* sibling = innerPool.create();
+            sibling->count = inner->count - mid - 1;
+            for (int i = 0; i < sibling->count; ++i)
+                sibling->keys[i] = inner->keys[mid + 1 + i];
+            for (int i = 0; i <= sibling->count; ++i)
+                sibling->children[i] = inner->children[mid + 1 + i];
+            sepKey = inner->keys[mid];
+            inner->count = mid;
+            right = sibling;
+        }
+
+        BTreeInner* newRoot = innerPool.create();
+        newRoot->count = 1;
+        newRoot->keys[0] = sepKey;
+        newRoot->children[0] = root;
+        newRoot->children[1] = right;
+        root = newRoot;
+        STORE_GAUGE(GAUGE_PRODUCT_TREE_DEPTH, levels());
+    }
+
+    // Restores the minimum fill of an underflowing node by borrowing from a
+    // sibling or merging with it, walking upwards while parents underflow.
+    void rebalance(BTreeNode* node, BTreeInner* path[], int slots[], int depth) {
+        for (int d = depth - 1; d >= 0 && node->count < BTREE_MIN_KEYS; --d) {
+            BTreeInner* parent = path[d];
+            int slot = slots[d];
+            BTreeNode* left = slot > 0 ? parent->children[slot - 1] : nullptr;
+            BTreeNode* right = slot < parent->count ? parent->children[slot + 1] : nullptr;
+
+            if (left && left->count > BTREE_MIN_KEYS) {
+                borrowFromLeft(parent, slot, left, node);
+                return;
+            }
+            if (right && right->count > BTREE_MIN_KEYS) {
+                borrowFromRight(parent, slot, node, right);
+                return;
+            }
+            if (left)
+                mergeNodes(parent, slot, left, node);
+            else
+                mergeNodes(parent, slot + 1, node, right);
+            node = parent;
+        }
+
+        if (!root->isLeaf && root->count == 0) {
+            BTreeInner* oldRoot = static_cast<BTreeInner*>(root);
+            root = oldRoot->children[0];
+            innerPool.release(oldRoot);
+            STORE_GAUGE(GAUGE_PRODUCT_TREE_DEPTH, levels());
+        }
+    }
+
+    void borrowFromLeft(BTreeInner* parent, int slot, BTreeNode* left, BTreeNode* node) {
+        for (int i = node->count; i > 0; --i)
+            node->keys[i] = node->keys[i - 1];
+
+        if (node->isLeaf) {
+            BTreeLeaf* leaf = static_cast<BTreeLeaf*>(node);
+            BTreeLeaf* from = static_cast<BTreeLeaf*>(left);
+            for (int i = leaf->count; i > 0; --i)
+                leaf->values[i] = leaf->values[i - 1];
+            leaf->keys[0] = from->keys[from->count - 1];
+            leaf->values[0] = from->values[from->count - 1];
+            parent->keys[slot - 1] = leaf->keys[0];
+        } else {
+            BTreeInner* inner = static_cast<BTreeInner*>(node);
+            BTreeInner* from = static_cast<BTreeInner*>(left);
+            for (int i = inner->count + 1; i > 0; --i)
+                inner->children[i] = inner->children[i - 1];
+            inner->keys[0] = parent->keys[slot - 1];
+            inner->children[0] = from->children[from->count];
+            parent->keys[slot - 1] = from->keys[from->count - 1];
+        }
+        left->count--;
+        node->count++;
+    }
+
+    void borrowFromRight(BTreeInner* parent, int slot, BTreeNode* node, BTreeNode* right) {
+        if (node->isLeaf) {
+            BTreeLeaf* leaf = static_cast<BTreeLeaf*>(node);
+            BTreeLeaf* from = static_cast<BTreeLeaf*>(right);
+            leaf->keys[leaf->count] = from->keys[0];
+            leaf->values[leaf->count] = from->values[0];
+            for (int i = 0; i < from->count - 1; ++i) {
+                from->keys[i] = from->keys[i + 1];
+                from->values[i] = from->values[i + 1];
+            }
+            parent->keys[slot] = from->keys[0];
+        } else {
+            BTreeInner* inner = static_cast<BTreeInner*>(node);
+            BTreeInner* from = static_cast<BTreeInner*>(right);
+            inner->keys[inner->count] = parent->keys[slot];
+            inner->children[inner->count + 1] = from->children[0];
+            parent->keys[slot] = from->keys[0];
+            for (int i = 0; i < from->count - 1; ++i)
+                from->keys[i] = from->keys[i + 1];
+            for (int i = 0; i < from->count; ++i)
+                from->children[i] = from->children[i + 1];
+        }
+        right->count--;
+        node->count++;
+    }
+
+    // Folds right (child rightSlot of parent) into left and drops the
+    // separator between them from the parent.
+    void mergeNodes(BTreeInner* parent, int rightSlot, BTreeNode* left, BTreeNode* right) {
+        if (left->isLeaf) {
+            BTreeLeaf* to = static_cast<BTreeLeaf*>(left);
+            BTreeLeaf* from = static_cast<BTreeLeaf*>(right);
+            for (int i = 0; i < from->count; ++i) {
+                to->keys[to->count + i] = from->keys[i];
+                to->values[to->count + i] = from->values[i];
+            }
+            to->count += from->count;
+            to->next = from->next;
+            leafPool.release(from);
+        } else {
+            BTreeInner* to = static_cast<BTreeInner*>(left);
+            BTreeInner* from = static_cast<BTreeInner*>(right);
+            to->keys[to->count] = parent->keys[rightSlot - 1];
+            for (int i = 0; i < from->count; ++i)
+                to->keys[to->count + 1 + i] = from->keys[i];
+            for (int i = 0; i <= from->count; ++i)
+                to->children[to->count + 1 + i] = from->children[i];
+            to->count += from->count + 1;
+            innerPool.release(from);
+        }
+
+        for (int i = rightSlot - 1; i < parent->count - 1; ++i)
+            parent->keys[i] = parent->keys[i + 1];
+        for (int i = rightSlot; i < parent->count; ++i)
+            parent->children[i] = parent->children[i + 1];
+        parent->count--;
+    }
+
+    // Releases every node and record in bulk, without walking the tree
+    void clearNodes() {
+        leafPool.clear();
+        innerPool.clear();
+    }
+
+    void resetToEmpty() {
+        firstLeaf = leafPool.create();
+        root = firstLeaf;
+        size = 0;
+    }
+
+    // Levels from the root down to the leaves, leaves included
+    int levels() const {
+        int count = 1;
+        for (BTreeNode* node = root; !node->isLeaf; node = static_cast<BTreeInner*>(node)->children[0])
+            count++;
+        return count;
+    }
+
+public:
+    ProductBST() : publishing(false) {
+        resetToEmpty();
+    }
+
+    ~ProductBST() {
+        clearNodes();
+    }
+
+    ProductBST(const ProductBST&) = delete;
+    ProductBST& operator=(const ProductBST&) = delete;
+
+    // Makes this the tree behind the product gauges. Only main's inventory
+    // does this; compaction, snapshot loads and benchmarks build scratch
+    // trees that must not overwrite them.
+    void publishMetrics() {
+        publishing = true;
+        STORE_GAUGE(GAUGE_PRODUCT_TREE_DEPTH, levels());
+        STORE_GAUGE(GAUGE_PRODUCTS, size);
+    }
+
+    void clear() {
+        clearNodes();
+        resetToEmpty();
+        categories.clear();
+        names.clear();
+        text.release();
+        changed.markAll();
+        keys.reset();
+        STORE_GAUGE(GAUGE_PRODUCT_TREE_DEPTH, 1);
+        STORE_GAUGE(GAUGE_PRODUCTS, 0);
+    }
+
+    // Arena for text of records about to be added (see TextScope)
+    TextArena& textArena() {
+        return text;
+    }
+
+    // Keys changed since the last save or load
+    ChangedKeys& changes() {
+        return changed;
+    }
+
+    const KeyBounds& keyBounds() const {
+        return keys;
+    }
+
+    // Records a change made through a pointer from search()
+    void markChanged(int productID) {
+        changed.mark(productID);
+    }
+
+    // Secondary index: category -> sorted productIDs
+    const CategoryIndex& categoryIndex() const {
+        return categories;
+    }
+
+    // Secondary index: names -> productIDs; see ensureNameIndex()
+    const NameIndex& nameIndex() const {
+        return names;
+    }
+
+    // Builds the name index on the first name search. Walking the leaves
+    // feeds the trigram lists in ID order, so every add is an append.
+    void ensureNameIndex() {
+        if (names.ready()) return;
+        for (BTreeLeaf* leaf = firstLeaf; leaf; leaf = leaf->next)
+            for (int i = 0; i < leaf->count; ++i)
+                names.add(leaf->keys[i], leaf->values[i].name());
+        names.markBuilt();
+    }
+
+    // Up to limit products whose names start with text, in name order,
+    // then products whose names contain it (3 characters or more), in ID
+    // order. Case is ignored. The index must be built (ensureNameIndex).
+    vector<Product*> searchByName(string_view text, size_t limit) {
+        METRIC_TIMER(OP_PRODUCT_NAME_SEARCH);
+        string folded = foldName(text);
+        vector<Product*> result;
+        if (folded.empty() || limit == 0) return result;
+        vector<int> ids = names.prefix(folded, limit);
+        vector<int> seen = ids;
+        sort(seen.begin(), seen.end());
+        names.substring(folded, limit - ids.size(), ids, [&](int id) {
+            if (binary_search(seen.begin(), seen.end(), id)) return false;
+            Product* p = search(id);
+            return p && containsFolded(p->name(), folded);
+        });
+        for (int id : ids) result.push_back(search(id));
+        return result;
+    }
+
+    // Leaves (which hold the records) and inner nodes together
+    PoolStats treeMemory() const {
+        PoolStats leaves = leafPool.stats(), inners = innerPool.stats();
+        leaves.live += inners.live;
+        leaves.capacity += inners.capacity;
+        leaves.bytes += inners.bytes;
+        return leaves;
+    }
+
+    void insert(const Product& p) {
+        METRIC_TIMER(OP_PRODUCT_INSERT);
+        BTreeInner* path[BTREE_MAX_DEPTH];
+        int slots[BTREE_MAX_DEPTH];
+        int depth;
+        BTreeLeaf* leaf = findLeaf(p.productID, path, slots, depth);
+
+        int pos = lowerBoundKey(leaf->keys, leaf->count, p.productID);
+        if (pos < leaf->count && leaf->keys[pos] == p.productID)
+            throw DuplicateIDException("Duplicate Product ID: " + to_string(p.productID));
+
+        for (int i = leaf->count; i > pos; --i) {
+            leaf->keys[i] = leaf->keys[i - 1];
+            leaf->values[i] = leaf->values[i - 1];
+        }
+        leaf->keys[pos] = p.productID;
+        leaf->values[pos] = adopt(p);
+        leaf->count++;
+        size++;
+        STORE_GAUGE(GAUGE_PRODUCTS, size);
+        categories.add(p.categoryID, p.productID);
+        if (names.ready()) names.add(p.productID, p.name());
+        changed.mark(p.productID);
+        keys.widen(p.productID);
+
+        if (leaf->count <= BTREE_MAX_KEYS)
+            return;
+
+        int mid = leaf->count / 2;
+        BTreeLeaf* sibling = leafPool.create();
+        sibling->count = leaf->count - mid;
+        for (int i = 0; i < sibling->count; ++i) {
+            sibling->keys[i] = leaf->keys[mid + i];
+            sibling->values[i] = leaf->values[mid + i];
+        }
+        leaf->count = mid;
+        sibling->next = leaf->next;
+        leaf->next = sibling;
+
+        insertIntoParents(path, slots, depth, sibling->keys[0], sibling);
+    }
+
+    void remove(int productID) {
+        METRIC_TIMER(OP_PRODUCT_REMOVE);
+        BTreeInner* path[BTREE_MAX_DEPTH];
+        int slots[BTREE_MAX_DEPTH];
+        int depth;
+        BTreeLeaf* leaf = findLeaf(productID, path, slots, depth);
+
+        int pos = lowerBoundKey(leaf->keys, leaf->count, productID);
+        if (pos >= leaf->count || leaf->keys[pos] != productID)
+            throw NotFoundException("Product ID not found: " + to_string(productID));
+
+        categories.remove(leaf->values[pos].categoryID, productID);
+        if (names.ready()) names.remove(productID, leaf->values[pos].name());
+        changed.mark(productID);
+        for (int i = pos; i < leaf->count - 1; ++i) {
+            leaf->keys[i] = leaf->keys[i + 1];
+            leaf->values[i] = leaf->values[i + 1];
+        }
+        leaf->count--;
+        size--;
+        STORE_GAUGE(GAUGE_PRODUCTS, size);
+
+        rebalance(leaf, path, slots, depth);
+    }
+
+    Product* search(int productID) {
+        METRIC_TIMER(OP_PRODUCT_SEARCH);
+        BTreeNode* node = root;
+        while (!node->isLeaf) {
+            BTreeInner* inner = static_cast<BTreeInner*>(node);
+            node = inner->children[upperBoundKey(inner->keys, inner->count, productID)];
+        }
+        BTreeLeaf* leaf = static_cast<BTreeLeaf*>(node);
+        int pos = lowerBoundKey(leaf->keys, leaf->count, productID);
+        if (pos < leaf->count && leaf->keys[pos] == productID)
+            return &leaf->values[pos];
+        return nullptr;
+    }
+
+    // Builds the tree in O(n) from products sorted by strictly increasing
+    // ID. Leaves are filled bottom-up, then each inner level is built over
+    // the one below. Falls back to ordinary inserts if the tree is not empty
+    // or the input is not strictly increasing.
+    void bulkLoad(const vector<Product>& sorted) {
+        bool ordered = true;
+        for (size_t i = 1; i < sorted.size() && ordered; ++i)
+            ordered = sorted[i - 1].productID < sorted[i].productID;
+
+        if (size != 0 || !ordered) {
+            for (const Product& p : sorted)
+                insert(p);
+            return;
+        }
+        if (sorted.empty())
+            return;
+
+        clearNodes();
+        names.clear();
+
+        // Spread records evenly so that every node meets the minimum fill
+        size_t n = sorted.size();
+        size_t leafCount = (n + BTREE_MAX_KEYS - 1) / BTREE_MAX_KEYS;
+        vector<BTreeNode*> level;
+        vector<int> lowKeys;
+        level.reserve(leafCount);
+        lowKeys.reserve(leafCount);
+
+        size_t idx = 0;
+        BTreeLeaf* prev = nullptr;
+        for (size_t l = 0; l < leafCount; ++l) {
+            size_t take = n / leafCount + (l < n % leafCount ? 1 : 0);
+            BTreeLeaf* leaf = leafPool.create();
+            for (size_t i = 0; i < take; ++i, ++idx) {
+                leaf->keys[i] = sorted[idx].productID;
+                leaf->values[i] = adopt(sorted[idx]);
+                categories.add(sorted[idx].categoryID, sorted[idx].productID);
+            }
+            leaf->count = (int)take;
+            if (prev) prev->next = leaf;
+            else firstLeaf = leaf;
+            prev = leaf;
+            level.push_back(leaf);
+            lowKeys.push_back(leaf->keys[0]);
+        }
+
+        while (level.size() > 1) {
+            size_t childCount = level.size();
+            size_t fanout = BTREE_MAX_KEYS + 1;
+            size_t innerCount = (childCount + fanout - 1) / fanout;
+            vector<BTreeNode*> upper;
+            vector<int> upperLow;
+            upper.reserve(innerCount);
+            upperLow.reserve(innerCount);
+
+            size_t c = 0;
+            for (size_t g = 0; g < innerCount; ++g) {
+                size_t take = childCount / innerCount + (g < childCount % innerCount ? 1 : 0);
+                BTreeInner* inner = innerPool.create();
+                for (size_t i = 0; i < take; ++i, ++c) {
+                    inner->children[i] = level[c];
+                    if (i > 0) inner->keys[i - 1] = lowKeys[c];
+                }
+                inner->count = (int)take - 1;
+                upper.push_back(inner);
+                upperLow.push_back(lowKeys[c - take]);
+            }
+            level.swap(upper);
+            lowKeys.swap(upperLow);
+        }
+
+        root = level[0];
+        size = (int)n;
+        changed.markAll();
+        keys.widen(sorted.front().productID);
+        keys.widen(sorted.back().productID);
+        STORE_GAUGE(GAUGE_PRODUCT_TREE_DEPTH, levels());
+        STORE_GAUGE(GAUGE_PRODUCTS, size);
+    }
+
+    void displayAll() {
+        if (size == 0) {
+            cout << "No products to display." << endl;
+            return;
+        }
+        StreamOut& out = console();
+        out << "--- Products List ---\n";
+        for (BTreeLeaf* leaf = firstLeaf; leaf; leaf = leaf->next)
+            for (int i = 0; i < leaf->count; ++i)
+                leaf->values[i].display(out);
+        out << "------------------------------\n";
+        out.flush();
+    }
+
+    int getCount() {
+        return size;
+    }
+
+    // Get all products into an array in ascending ID order (for sorting/searching)
+    int getAllProducts(Product* arr[], int capacity) {
+        int idx = 0;
+        for (BTreeLeaf* leaf = firstLeaf; leaf && idx < capacity; leaf = leaf->next)
+            for (int i = 0; i < leaf->count && idx < capacity; ++i)
+                arr[idx++] = &leaf->values[i];
+        return idx;
+    }
+
+    // Appends the products with low <= ID <= high, in ID order
+    void getProductsInRange(int low, int high, vector<Product*>& out) {
+        BTreeNode* node = root;
+        while (!node->isLeaf) {
+            BTreeInner* inner = static_cast<BTreeInner*>(node);
+            node = inner->children[upperBoundKey(inner->keys, inner->count, low)];
+        }
+        BTreeLeaf* leaf = static_cast<BTreeLeaf*>(node);
+        for (int i = lowerBoundKey(leaf->keys, leaf->count, low); leaf; leaf = leaf->next, i = 0)
+            for (; i < leaf->count; ++i) {
+                if (leaf->keys[i] > high) return;
+                out.push_back(&leaf->values[i]);
+            }
+    }
+};
+
+// --------- SUPPLIER CLASS ---------
+// A 20-byte POD; name and contact live in the text arena
+class Supplier {
+public:
+    int supplierID;
+    TextRef nameRef;
+    TextRef contactRef;
+
+    Supplier() : supplierID(0), nameRef{0, 0}, contactRef{0, 0} {}
+    Supplier(int id, string_view n, string_view c)
+        : supplierID(id), nameRef(internText(n)), contactRef(internText(c)) {}
+
+    string_view name() const { return textOf(nameRef); }
+    string_view contactInfo() const { return textOf(contactRef); }
+    void setName(string_view n) { nameRef = internText(n); }
+    void setContactInfo(string_view c) { contactRef = internText(c); }
+
+    void display(OutBuffer& out) const {
+        out << "Supplier ID: " << supplierID
+            << ", Name: " << name()
+            << ", Contact: " << contactInfo() << '\n';
+    }
+
+    void display() const {
+        display(console());
+        console().flush();
+    }
+
+    void appendTo(string& out) const {
+        appendNumber(out, supplierID);
+        out += ',';
+        out += name();
+        out += ',';
+        out += contactInfo();
+    }
+
+    string toString() const {
+        string s;
+        appendTo(s);
+        return s;
+    }
+
+    // Parses "id,name,contact" in place
+    static bool parse(const char* begin, const char* end, Supplier& out, const char*& error) {
+        const char* idEnd = fieldEnd(begin, end);
+        if (idEnd == end) { error = "missing name"; return false; }
+        const char* nameBegin = idEnd + 1;
+        const char* nameEnd = fieldEnd(nameBegin, end);
+        const char* contactBegin = nameEnd == end ? end : nameEnd + 1;
+        const char* contactEnd = fieldEnd(contactBegin, end);
+
+        if (!parseIntField(begin, idEnd, out.supplierID)) { error = "invalid supplier ID"; return false; }
+        out.setName(string_view(nameBegin, (size_t)(nameEnd - nameBegin)));
+        out.setContactInfo(string_view(contactBegin, (size_t)(contactEnd - contactBegin)));
+        return true;
+    }
+
+    static Supplier fromString(const string& line) {
+        Supplier s;
+        const char* error = nullptr;
+        if (!parse(line.data(), line.data() + line.size(), s, error))
+            throw ParseException("Malformed supplier record (" + string(error) + "): " + line);
+        return s;
+    }
+};
+
+static_assert(is_trivially_copyable<Supplier>::value, "Supplier must stay a POD record");
+
+// --------- SUPPLIER NODE & LINKED LIST ---------
+class SupplierNode {
+public:
+    Supplier data;
+    SupplierNode* next;
+
+    SupplierNode() : next(nullptr) {}
+    SupplierNode(const Supplier& s) : data(s), next(nullptr) {}
+};
+
+class SupplierList {
+private:
+    SupplierNode* head;
+    SupplierNode* tail;
+    int size;
+    NodePool<SupplierNode> nodePool;
+    HashIndex<SupplierNode*> index;    // supplierID -> node
+    ChangedKeys changed;
+    KeyBounds keys;
+    bool publishing;    // see publishMetrics()
+    TextArena text;    // names and contacts; freed by clear()
+
+    // Releases every node in bulk, without walking the list
+    void clearNodes() {
+        nodePool.clear();
+        head = tail = nullptr;
+        size = 0;
+    }
+
+    void append(const Supplier& s) {
+        SupplierNode* newNode = nodePool.create(s);
+        Supplier& stored = newNode->data;
+        if (!text.owns(stored.nameRef)) stored.nameRef = text.append(s.name());
+        if (!text.owns(stored.contactRef)) stored.contactRef = text.append(s.contactInfo());
+        if (tail) tail->next = newNode;
+        else head = newNode;
+        tail = newNode;
+        index.insert((uint32_t)s.supplierID, newNode);
+        size++;
+        changed.mark(s.supplierID);
+        keys.widen(s.supplierID);
+        STORE_GAUGE(GAUGE_SUPPLIERS, size);
+    }
+
+public:
+    SupplierList() : head(nullptr), tail(nullptr), size(0), publishing(false) {}
+
+    ~SupplierList() {
+        clearNodes();
+    }
+
+    SupplierList(const SupplierList&) = delete;
+    SupplierList& operator=(const SupplierList&) = delete;
+
+    // Makes this the list behind the supplier gauge (see ProductBST)
+    void publishMetrics() {
+        publishing = true;
+        STORE_GAUGE(GAUGE_SUPPLIERS, size);
+    }
+
+    void clear() {
+        clearNodes();
+        index.clear();
+        text.release();
+        changed.markAll();
+        keys.reset();
+        STORE_GAUGE(GAUGE_SUPPLIERS, 0);
+    }
+
+    // Arena for text of records about to be added (see TextScope)
+    TextArena& textArena() {
+        return text;
+    }
+
+    // Keys changed since the last save or load
+    ChangedKeys& changes() {
+        return changed;
+    }
+
+    const KeyBounds& keyBounds() const {
+        return keys;
+    }
+
+    PoolStats nodeMemory() const {
+        return nodePool.stats();
+    }
+
+    void addSupplier(const Supplier& s) {
+        METRIC_TIMER(OP_SUPPLIER_ADD);
+        if (index.find((uint32_t)s.supplierID)) {
+            throw DuplicateIDException("Duplicate Supplier ID: " + to_string(s.supplierID));
+        }
+        append(s);
+    }
+
+    // Adds a batch in one pass, sizing the registry once up front. Entries
+    // whose ID already exists (or repeats within the batch) are skipped and
+    // their positions in batch reported in duplicates. Returns the number of
+    // suppliers added.
+    int addSuppliers(const vector<Supplier>& batch, vector<size_t>& duplicates) {
+        index.reserve(size + batch.size());
+        int added = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (index.find((uint32_t)batch[i].supplierID)) {
+                duplicates.push_back(i);
+                continue;
+            }
+            append(batch[i]);
+            added++;
+        }
+        return added;
+    }
+
+    Supplier* findSupplier(int supplierID) {
+        METRIC_TIMER(OP_SUPPLIER_FIND);
+        SupplierNode** node = index.find((uint32_t)supplierID);
+        return node ? &((*node)->data) : nullptr;
+    }
+
+    void displayAll() {
+        if (!head) {
+            cout << "No suppliers to display." << endl;
+            return;
+        }
+        StreamOut& out = console();
+        out << "--- Suppliers List ---\n";
+        SupplierNode* current = head;
+        while (current) {
+            current->data.display(out);
+            current = current->next;
+        }
+        out << "----------------------\n";
+        out.flush();
+    }
+
+    // Count suppliers
+    int count() {
+        return size;
+    }
+
+    // Get all suppliers in array for sorting/searching
+    int getAllSuppliers(Supplier* arr[], int capacity) {
+        int idx = 0;
+        SupplierNode* current = head;
+        while (current && idx < capacity) {
+            arr[idx++] = &(current->data);
+            current = current->next;
+        }
+        return idx;
+    }
+
+    // Appends the suppliers with low <= ID <= high, in ID order, probing
+    // the index once per ID in the range
+    void getSuppliersInRange(int low, int high, vector<Supplier*>& out) {
+        for (long long id = low; id <= high; ++id) {
+            SupplierNode** node = index.find((uint32_t)id);
+            if (node) out.push_back(&((*node)->data));
+        }
+    }
+};
+
+// --------- STOCK CLASS ---------
+class Stock {
+public:
+    int productID;
+    int supplierID;
+    int quantity;
+
+    Stock() : productID(0), supplierID(0), quantity(0) {}
+    Stock(int pID, int sID, int qty) : productID(pID), supplierID(sID), quantity(qty) {}
+
+    void display(OutBuffer& out) const {
+        out << "Product ID: " << productID
+            << ", Supplier ID: " << supplierID
+            << ", Quantity: " << quantity << '\n';
+    }
+
+    void display() const {
+        display(console());
+        console().flush();
+    }
+
+    void appendTo(string& out) const {
+        appendNumber(out, productID);
+        out += ',';
+        appendNumber(out, supplierID);
+        out += ',';
+        appendNumber(out, quantity);
+    }
+
+    string toString() const {
+        string s;
+        appendTo(s);
+        return s;
+    }
+
+    // Parses "productID,supplierID,quantity" in place
+    static bool parse(const char* begin, const char* end, Stock& out, const char*& error) {
+        const char* pEnd = fieldEnd(begin, end);
+        if (pEnd == end) { error = "missing supplier ID and quantity"; return false; }
+        const char* sBegin = pEnd + 1;
+        const char* sEnd = fieldEnd(sBegin, end);
+        if (sEnd == end) { error = "missing quantity"; return false; }
+        const char* qBegin = sEnd + 1;
+        const char* qEnd = fieldEnd(qBegin, end);
+
+        if (!parseIntField(begin, pEnd, out.productID)) { error = "invalid product ID"; return false; }
+        if (!parseIntField(sBegin, sEnd, out.supplierID)) { error = "invalid supplier ID"; return false; }
+        if (!parseIntField(qBegin, qEnd, out.quantity)) { error = "invalid quantity"; return false; }
+        return true;
+    }
+
+    static Stock fromString(const string& line) {
+        Stock s;
+        const char* error = nullptr;
+        if (!parse(line.data(), line.data() + line.size(), s, error))
+            throw ParseException("Malformed stock record (" + string(error) + "): " + line);
+        return s;
+    }
+};
+
+// --------- LOW-STOCK WATCHLIST ---------
+// Raised when a product's total stock crosses its reorder level
+struct LowStockEvent {
+    int productID;
+    long long total;
+    int reorderLevel;
+    bool belowLevel;    // true: dropped below the level; false: recovered
+};
+
+// Products with a reorder level, kept in an indexed min-heap keyed by
+// slack = total stock - reorder level. A product needs reordering when its
+// slack is negative, and those entries form a connected region at the top
+// of the heap, so listing them costs O(k) for k low items. The position
+// index lets a quantity change re-sift just that product in O(log n).
+class LowStockWatch {
+private:
+    struct Entry {
+        int productID;
+        long long slack;
+    };
+
+    vector<Entry> heap;
+    HashIndex<size_t> positions;    // productID -> heap slot
+    HashIndex<int> levels;          // productID -> reorder level
+    function<void(const LowStockEvent&)> listener;
+
+    void place(size_t i, const Entry& e) {
+        heap[i] = e;
+        *positions.find((uint32_t)e.productID) = i;
+    }
+
+    void siftUp(size_t i) {
+        Entry e = heap[i];
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (heap[parent].slack <= e.slack) break;
+            place(i, heap[parent]);
+            i = parent;
+        }
+        place(i, e);
+    }
+
+    void siftDown(size_t i) {
+        Entry e = heap[i];
+        while (true) {
+            size_t child = 2 * i + 1;
+            if (child >= heap.size()) break;
+            if (child + 1 < heap.size() && heap[child + 1].slack < heap[child].slack) child++;
+            if (e.slack <= heap[child].slack) break;
+            place(i, heap[child]);
+            i = child;
+        }
+        place(i, e);
+    }
+
+    void notify(int productID, long long oldTotal, long long newTotal, int level) {
+        bool wasLow = oldTotal < level;
+        bool isLow = newTotal < level;
+        if (listener && wasLow != isLow)
+            listener(LowStockEvent{productID, newTotal, level, isLow});
+    }
+
+public:
+    void setListener(const function<void(const LowStockEvent&)>& fn) {
+        listener = fn;
+    }
+
+    void clear() {
+        heap.clear();
+        positions.clear();
+        levels.clear();
+    }
+
+    int level(int productID) {
+        int* found = levels.find((uint32_t)productID);
+        return found ? *found : 0;
+    }
+
+    size_t watchedCount() const {
+        return heap.size();
+    }
+
+    // Starts, changes or (with level <= 0) stops watching a product whose
+    // total stock is currently total. With notifyListener set, an event is
+    // raised if the new level changes whether the product counts as low.
+    void setLevel(int productID, int level, long long total, bool notifyListener = true) {
+        int old = this->level(productID);
+        if (old == level || (old <= 0 && level <= 0)) return;
+
+        size_t* slot = positions.find((uint32_t)productID);
+        if (level <= 0) {
+            size_t i = *slot;
+            positions.erase((uint32_t)productID);
+            levels.erase((uint32_t)productID);
+            Entry last = heap.back();
+            heap.pop_back();
+            if (i < heap.size()) {
+                place(i, last);
+                siftUp(i);
+                siftDown(*positions.find((uint32_t)last.productID));
+            }
+            return;
+        }
+
+        bool wasLow = slot && total < old;
+        if (slot) {
+            *levels.find((uint32_t)productID) = level;
+            heap[*slot].slack = total - level;
+            siftUp(*slot);
+            siftDown(*positions.find((uint32_t)productID));
+        } else {
+            levels.insert((uint32_t)productID, level);
+            positions.insert((uint32_t)productID, heap.size());
+            heap.push_back(Entry{productID, total - level});
+            siftUp(heap.size() - 1);
+        }
+        bool isLow = total < level;
+        if (notifyListener && listener && wasLow != isLow)
+            listener(LowStockEvent{productID, total, level, isLow});
+    }
+
+    bool watches(int productID) {
+        return positions.find((uint32_t)productID) != nullptr;
+    }
+
+    // Called on every change to a product's total stock
+    void update(int productID, long long oldTotal, long long newTotal) {
+        size_t* slot = positions.find((uint32_t)productID);
+        if (!slot) return;
+        int lvl = *levels.find((uint32_t)productID);
+        heap[*slot].slack = newTotal - lvl;
+        if (newTotal < oldTotal) siftUp(*slot);
+        else siftDown(*slot);
+        notify(productID, oldTotal, newTotal, lvl);
+    }
+
+    // Product IDs whose total is below their reorder level, most urgent
+    // first. Only the low region at the top of the heap is visited.
+    vector<int> belowLevel() const {
+        vector<pair<long long, int>> found;
+        vector<size_t> pending;
+        if (!heap.empty() && heap[0].slack < 0) pending.push_back(0);
+        while (!pending.empty()) {
+            size_t i = pending.back();
+            pending.pop_back();
+            found.emplace_back(heap[i].slack, heap[i].productID);
+            for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap.size(); ++child)
+                if (heap[child].slack < 0) pending.push_back(child);
+        }
+        sort(found.begin(), found.end());
+        vector<int> ids;
+        ids.reserve(found.size());
+        for (const pair<long long, int>& f : found) ids.push_back(f.second);
+        return ids;
+    }
+};
+
+// --------- COLUMNAR STOCK STORE ---------
+// Structure-of-arrays copy of the stock table kept in step with StockList.
+// Records are appended as rows in list order; removing one moves the last
+// row into its place. Scans read only the columns they need, front to
+// back, so aggregates run at memory
+// bandwidth instead of one StockNode* hop per row. The kernels use SSE2
+// (baseline on x86-64) four rows at a time and fall back to plain loops.
+// An optional ID argument left empty means no filter on that column.
+
+inline long long sumColumn(const int32_t* values, size_t n) {
+    size_t i = 0;
+    long long total = 0;
+#ifdef STOCK_SIMD_SSE2
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        __m128i sign = _mm_srai_epi32(v, 31);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    total = lanes[0] + lanes[1];
+#endif
+    for (; i < n; ++i) total += values[i];
+    return total;
+}
+
+// Sum of values[i] where keys[i] == key
+inline long long sumColumnWhere(const int32_t* values, const int32_t* keys, size_t n, int32_t key) {
+    size_t i = 0;
+    long long total = 0;
+#ifdef STOCK_SIMD_SSE2
+    __m128i acc = _mm_setzero_si128();
+    __m128i wanted = _mm_set1_epi32(key);
+    for (; i + 4 <= n; i += 4) {
+        __m128i match = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(keys + i)), wanted);
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(values + i)), match);
+        __m128i sign = _mm_srai_epi32(v, 31);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    total = lanes[0] + lanes[1];
+#endif
+    for (; i < n; ++i) total += keys[i] == key ? values[i] : 0;
+    return total;
+}
+
+// Rows with values[i] < limit and, if key is set, keys[i] == key
+inline size_t countBelowWhere(const int32_t* values, const int32_t* keys, size_t n, int32_t limit,
+                              optional<int32_t> key) {
+    size_t i = 0;
+    size_t count = 0;
+#ifdef STOCK_SIMD_SSE2
+    __m128i below = _mm_set1_epi32(limit);
+    __m128i wanted = _mm_set1_epi32(key.value_or(0));
+    __m128i all = _mm_set1_epi32(-1);
+    while (i + 4 <= n) {
+        // Lane counters are 32-bit, so fold them into count every block
+        size_t blockEnd = min(n & ~(size_t)3, i + ((size_t)1 << 30));
+        __m128i acc = _mm_setzero_si128();
+        for (; i < blockEnd; i += 4) {
+            __m128i hit = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)(values + i)), below);
+            __m128i match = !key ? all
+                          : _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(keys + i)), wanted);
+            acc = _mm_sub_epi32(acc, _mm_and_si128(hit, match));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        count += (size_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+    for (; i < n; ++i) count += values[i] < limit && (!key || keys[i] == *key);
+    return count;
+}
+
+class StockColumns {
+public:
+    vector<int32_t> productIDs;
+    vector<int32_t> supplierIDs;
+    vector<int32_t> quantities;
+
+    size_t size() const { return quantities.size(); }
+
+    void reserve(size_t n) {
+        productIDs.reserve(n);
+        supplierIDs.reserve(n);
+        quantities.reserve(n);
+    }
+
+    void clear() {
+        productIDs.clear();
+        supplierIDs.clear();
+        quantities.clear();
+    }
+
+    // Returns the new row number
+    size_t append(const Stock& s) {
+        productIDs.push_back(s.productID);
+        supplierIDs.push_back(s.supplierID);
+        quantities.push_back(s.quantity);
+        return quantities.size() - 1;
+    }
+
+    // Fills the gap with the last row; its old number is size() afterwards
+    void removeRow(size_t row) {
+        productIDs[row] = productIDs.back();
+        supplierIDs[row] = supplierIDs.back();
+        quantities[row] = quantities.back();
+        productIDs.pop_back();
+        supplierIDs.pop_back();
+        quantities.pop_back();
+    }
+
+    long long totalUnits() const {
+        return sumColumn(quantities.data(), size());
+    }
+
+    // Records with quantity < threshold, optionally only from one supplier
+    size_t countBelow(int threshold, optional<int> supplierID = nullopt) const {
+        return countBelowWhere(quantities.data(), supplierIDs.data(), size(), threshold, supplierID);
+    }
+
+    long long supplierUnits(int supplierID) const {
+        return sumColumnWhere(quantities.data(), supplierIDs.data(), size(), supplierID);
+    }
+
+    long long productUnits(int productID) const {
+        return sumColumnWhere(quantities.data(), productIDs.data(), size(), productID);
+    }
+
+    // Rows with quantity < threshold (and supplier = supplierID if set),
+    // in row order. The compare runs four rows at a time and only
+    // matching rows are written out.
+    vector<uint32_t> selectBelow(int threshold, optional<int> supplierID = nullopt) const {
+        vector<uint32_t> rows;
+        const int32_t* q = quantities.data();
+        const int32_t* sup = supplierIDs.data();
+        size_t n = size(), i = 0;
+#ifdef STOCK_SIMD_SSE2
+        __m128i below = _mm_set1_epi32(threshold);
+        __m128i wanted = _mm_set1_epi32(supplierID.value_or(0));
+        for (; i + 4 <= n; i += 4) {
+            __m128i hit = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)(q + i)), below);
+            if (supplierID)
+                hit = _mm_and_si128(hit, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(sup + i)), wanted));
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(hit));
+            for (int lane = 0; mask; ++lane, mask >>= 1)
+                if (mask & 1) rows.push_back((uint32_t)(i + lane));
+        }
+#endif
+        for (; i < n; ++i)
+            if (q[i] < threshold && (!supplierID || sup[i] == *supplierID))
+                rows.push_back((uint32_t)i);
+        return rows;
+    }
+
+    // Units grouped by the key column (productIDs or supplierIDs), by key
+    vector<pair<int, long long>> unitsBy(const vector<int32_t>& keys) const {
+        HashIndex<long long> sums;
+        vector<int> order;
+        for (size_t i = 0; i < size(); ++i) {
+            long long* sum = sums.find((uint32_t)keys[i]);
+            if (!sum) {
+                sums.insert((uint32_t)keys[i], quantities[i]);
+                order.push_back(keys[i]);
+            } else {
+                *sum += quantities[i];
+            }
+        }
+        sort(order.begin(), order.end());
+        vector<pair<int, long long>> result;
+        result.reserve(order.size());
+        for (int key : order)
+            result.emplace_back(key, *sums.find((uint32_t)key));
+        return result;
+    }
+};
+
+// --------- STOCK NODE & LINKED LIST ---------
+class StockNode {
+public:
+    Stock data;
+    StockNode* next;
+    StockNode* prev;
+    StockNode* nextOfProduct;     // the product's other stock records
+    StockNode* prevOfProduct;
+    StockNode* nextOfSupplier;    // the supplier's other stock records
+    StockNode* prevOfSupplier;
+    uint32_t row;    // this record's row in the StockColumns copy
+
+    StockNode() : StockNode(Stock()) {}
+    StockNode(const Stock& s)
+        : data(s), next(nullptr), prev(nullptr), nextOfProduct(nullptr), prevOfProduct(nullptr),
+          nextOfSupplier(nullptr), prevOfSupplier(nullptr), row(0) {}
+};
+
+// One product's or supplier's stock records, linked through the nodes in
+// insertion order
+struct StockChain {
+    StockNode* first;
+    StockNode* last;
+    int degree;
+};
+
+// Appends node to the chain of key, linking it through the given fields
+inline void linkChain(HashIndex<StockChain>& chains, int key, StockNode* node,
+                      StockNode* StockNode::*nextField, StockNode* StockNode::*prevField) {
+    StockChain* chain = chains.find((uint32_t)key);
+    if (!chain) {
+        chains.insert((uint32_t)key, StockChain{node, node, 1});
+        return;
+    }
+    chain->last->*nextField = node;
+    node->*prevField = chain->last;
+    chain->last = node;
+    chain->degree++;
+}
+
+inline void unlinkChain(HashIndex<StockChain>& chains, int key, StockNode* node,
+                        StockNode* StockNode::*nextField, StockNode* StockNode::*prevField) {
+    StockChain* chain = chains.find((uint32_t)key);
+    if (node->*prevField) (node->*prevField)->*nextField = node->*nextField;
+    else chain->first = node->*nextField;
+    if (node->*nextField) (node->*nextField)->*prevField = node->*prevField;
+    else chain->last = node->*prevField;
+    if (--chain->degree == 0) chains.erase((uint32_t)key);
+}
+
+class StockList {
+private:
+    StockNode* head;
+    StockNode* tail;
+    int size;
+    NodePool<StockNode> nodePool;
+    HashIndex<StockNode*> index;    // (productID, supplierID) -> node
+    HashIndex<long long> totals;    // productID -> units across all suppliers
+    LowStockWatch watch;
+    StockColumns table;             // the same records, column by column, for scans
+    HashIndex<StockChain> byProduct;    // productID -> its stock records
+    HashIndex<StockChain> bySupplier;   // supplierID -> its stock records
+    mutex watchMutex;
+    ChangedKeys changed;                // by productID
+    KeyBounds keys;                     // of productIDs
+    bool publishing;                    // see publishMetrics()
+
+    // Keeps the per-product total and the low-stock watchlist current. The
+    // watchlist heap is shared by all products, so updates to it are
+    // serialized; products that are not watched never take the lock.
+    void adjustTotal(int productID, int delta) {
+        long long* total = totals.find((uint32_t)productID);
+        if (!total) {
+            totals.insert((uint32_t)productID, 0);
+            total = totals.find((uint32_t)productID);
+        }
+        long long old = *total;
+        *total += delta;
+        if (watch.watches(productID)) {
+            lock_guard<mutex> lock(watchMutex);
+            watch.update(productID, old, *total);
+        }
+    }
+
+    // Releases every node in bulk, without walking the list
+    void clearNodes() {
+        nodePool.clear();
+        head = tail = nullptr;
+        size = 0;
+    }
+
+    // Unlinks one record from the list, the indexes and the columns
+    void removeNode(StockNode* node) {
+        const Stock& s = node->data;
+        adjustTotal(s.productID, -s.quantity);
+        changed.mark(s.productID);
+
+        if (node->prev) node->prev->next = node->next;
+        else head = node->next;
+        if (node->next) node->next->prev = node->prev;
+        else tail = node->prev;
+        unlinkChain(byProduct, s.productID, node, &StockNode::nextOfProduct, &StockNode::prevOfProduct);
+        unlinkChain(bySupplier, s.supplierID, node, &StockNode::nextOfSupplier, &StockNode::prevOfSupplier);
+        index.erase(stockKey(s.productID, s.supplierID));
+
+        size_t last = table.size() - 1;
+        table.removeRow(node->row);
+        if (node->row != last)
+            (*index.find(stockKey(table.productIDs[node->row], table.supplierIDs[node->row])))->row = node->row;
+
+        nodePool.release(node);
+        size--;
+        STORE_GAUGE(GAUGE_STOCK_RECORDS, size);
+    }
+
+    vector<Stock*> chainRecords(HashIndex<StockChain>& chains, int key, StockNode* StockNode::*nextField) {
+        vector<Stock*> result;
+        StockChain* chain = chains.find((uint32_t)key);
+        if (!chain) return result;
+        result.reserve(chain->degree);
+        for (StockNode* node = chain->first; node; node = node->*nextField)
+            result.push_back(&node->data);
+        return result;
+    }
+
+public:
+    StockList() : head(nullptr), tail(nullptr), size(0), publishing(false) {}
+
+    ~StockList() {
+        clearNodes();
+    }
+
+    StockList(const StockList&) = delete;
+    StockList& operator=(const StockList&) = delete;
+
+    // Makes this the list behind the stock gauge (see ProductBST)
+    void publishMetrics() {
+        publishing = true;
+        STORE_GAUGE(GAUGE_STOCK_RECORDS, size);
+    }
+
+    void clear() {
+        clearNodes();
+        index.clear();
+        totals.clear();
+        watch.clear();
+        table.clear();
+        byProduct.clear();
+        bySupplier.clear();
+        changed.markAll();
+        keys.reset();
+        STORE_GAUGE(GAUGE_STOCK_RECORDS, 0);
+    }
+
+    // Keys changed since the last save or load
+    ChangedKeys& changes() {
+        return changed;
+    }
+
+    const KeyBounds& keyBounds() const {
+        return keys;
+    }
+
+    PoolStats nodeMemory() const {
+        return nodePool.stats();
+    }
+
+    // Pre-sizes the index before a bulk load of about n records
+    void reserve(int n) {
+        index.reserve(n);
+        table.reserve(n);
+    }
+
+    // Adds to an existing product-supplier record and returns its new
+    // quantity in quantity; false if there is no such record. Only that
+    // record, its row and its product's total are written, so calls for
+    // different products may run in parallel as long as nothing adds or
+    // removes records meanwhile (see SharedInventory).
+    bool addToExisting(const Stock& s, int& quantity) {
+        StockNode** existing = index.find(stockKey(s.productID, s.supplierID));
+        if (!existing) return false;
+        quantity = (*existing)->data.quantity += s.quantity;
+        table.quantities[(*existing)->row] += s.quantity;
+        adjustTotal(s.productID, s.quantity);
+        changed.mark(s.productID);
+        return true;
+    }
+
+    void addStock(const Stock& s) {
+        METRIC_TIMER(OP_STOCK_ADD);
+        // If product-supplier pair exists, update quantity instead of adding new
+        int quantity;
+        if (addToExisting(s, quantity))
+            return;
+        // Append so that iteration keeps insertion order (the saved files
+        // keep it per product)
+        StockNode* newNode = nodePool.create(s);
+        newNode->row = (uint32_t)table.append(s);
+        newNode->prev = tail;
+        if (tail) tail->next = newNode;
+        else head = newNode;
+        tail = newNode;
+        index.insert(stockKey(s.productID, s.supplierID), newNode);
+        linkChain(byProduct, s.productID, newNode, &StockNode::nextOfProduct, &StockNode::prevOfProduct);
+        linkChain(bySupplier, s.supplierID, newNode, &StockNode::nextOfSupplier, &StockNode::prevOfSupplier);
+        size++;
+        STORE_GAUGE(GAUGE_STOCK_RECORDS, size);
+        adjustTotal(s.productID, s.quantity);
+        changed.mark(s.productID);
+        keys.widen(s.productID);
+    }
+
+    // Number of stock records for a product / from a supplier
+    int productDegree(int productID) {
+        StockChain* chain = byProduct.find((uint32_t)productID);
+        return chain ? chain->degree : 0;
+    }
+
+    int supplierDegree(int supplierID) {
+        StockChain* chain = bySupplier.find((uint32_t)supplierID);
+        return chain ? chain->degree : 0;
+    }
+
+    // A product's stock records (one per supplier), in insertion order
+    vector<Stock*> stocksForProduct(int productID) {
+        return chainRecords(byProduct, productID, &StockNode::nextOfProduct);
+    }
+
+    // Everything a supplier supplies, in insertion order
+    vector<Stock*> stocksForSupplier(int supplierID) {
+        return chainRecords(bySupplier, supplierID, &StockNode::nextOfSupplier);
+    }
+
+    // Appends the records of products with low <= ID <= high, by productID
+    // and then in insertion order, probing the index once per ID in the range
+    void getStocksInRange(int low, int high, vector<Stock*>& out) {
+        for (long long id = low; id <= high; ++id) {
+            StockChain* chain = byProduct.find((uint32_t)id);
+            if (!chain) continue;
+            for (StockNode* node = chain->first; node; node = node->nextOfProduct)
+                out.push_back(&node->data);
+        }
+    }
+
+    // Removes every stock record of a product in O(records removed) and
+    // returns how many there were
+    int removeProductStocks(int productID) {
+        int removed = 0;
+        while (StockChain* chain = byProduct.find((uint32_t)productID)) {
+            removeNode(chain->first);
+            removed++;
+        }
+        return removed;
+    }
+
+    // Units of a product across all suppliers
+    long long productTotal(int productID) {
+        long long* total = totals.find((uint32_t)productID);
+        return total ? *total : 0;
+    }
+
+    // Sets (or with level <= 0 clears) the reorder level watched for a product
+    void setReorderLevel(int productID, int level, bool notifyListener = true) {
+        watch.setLevel(productID, level, productTotal(productID), notifyListener);
+    }
+
+    int reorderLevel(int productID) {
+        return watch.level(productID);
+    }
+
+    // Products currently below their reorder level, most urgent first
+    vector<int> lowStockProducts() const {
+        return watch.belowLevel();
+    }
+
+    // Called whenever a watched product crosses its reorder level
+    void setLowStockListener(const function<void(const LowStockEvent&)>& fn) {
+        watch.setListener(fn);
+    }
+
+    // Display all stocks
+    void displayAll() {
+        if (!head) {
+            cout << "No stock records to display." << endl;
+            return;
+        }
+        StreamOut& out = console();
+        out << "--- Stock List ---\n";
+        StockNode* current = head;
+        while (current) {
+            current->data.display(out);
+            current = current->next;
+        }
+        out << "------------------\n";
+        out.flush();
+    }
+
+    // Columnar view for aggregate scans; row i is the i-th record in list order
+    const StockColumns& columns() const {
+        return table;
+    }
+
+    // Find stock by product and supplier
+    Stock* findStock(int productID, int supplierID) {
+        StockNode** node = index.find(stockKey(productID, supplierID));
+        return node ? &((*node)->data) : nullptr;
+    }
+
+    // Count stocks
+    int count() {
+        return size;
+    }
+
+    // Get all stocks in array for sorting/searching
+    int getAllStocks(Stock* arr[], int capacity) {
+        int idx = 0;
+        StockNode* current = head;
+        while (current && idx < capacity) {
+            arr[idx++] = &(current->data);
+            current = current->next;
+        }
+        return idx;
+    }
+
+    // Records ranked by quantity (highest first, or lowest first), ties in
+    // list order. Returns ranks [offset, offset + count) using a bounded heap
+    // of offset + count entries: O(n log k) time, O(k) memory, no full sort.
+    vector<Stock*> rankByQuantity(size_t offset, size_t count, bool highest = true) {
+        size_t keep = offset + count;
+        vector<Stock*> result;
+        if (count == 0 || keep < offset) return result;
+
+        // Entries carry their list position so ties rank deterministically
+        typedef pair<Stock*, size_t> Entry;
+        auto better = [highest](const Entry& a, const Entry& b) {
+            if (a.first->quantity != b.first->quantity)
+                return highest ? a.first->quantity > b.first->quantity : a.first->quantity < b.first->quantity;
+            return a.second < b.second;
+        };
+
+        // Heap ordered so that the worst kept entry sits on top
+        vector<Entry> heap;
+        heap.reserve(min(keep, (size_t)size));
+        size_t position = 0;
+        for (StockNode* current = head; current; current = current->next, ++position) {
+            Entry entry(&(current->data), position);
+            if (heap.size() < keep) {
+                heap.push_back(entry);
+                push_heap(heap.begin(), heap.end(), better);
+            } else if (better(entry, heap.front())) {
+                pop_heap(heap.begin(), heap.end(), better);
+                heap.back() = entry;
+                push_heap(heap.begin(), heap.end(), better);
+            }
+        }
+
+        sort_heap(heap.begin(), heap.end(), better);
+        for (size_t i = offset; i < heap.size(); ++i)
+            result.push_back(heap[i].first);
+        return result;
+    }
+
+    // The k records with the most (or least) stock, best first
+    vector<Stock*> topByQuantity(size_t k, bool highest = true) {
+        return rankByQuantity(0, k, highest);
+    }
+};
+
+// Registers every product's reorder level with the stock watchlist after a
+// load, without raising events for products that are already low
+void syncReorderLevels(ProductBST& bst, StockList& stocks) {
+    vector<Product*> all(bst.getCount());
+    all.resize(bst.getAllProducts(all.data(), (int)all.size()));
+    for (Product* p : all)
+        if (p->reorderLevel > 0) stocks.setReorderLevel(p->productID, p->reorderLevel, false);
+}
+
+// --------- CONCURRENT STOCK COUNTERS ---------
+// Net quantity deltas per (productID, supplierID) that many threads can
+// apply at once. Counters are allocated in slabs that never move, so a
+// counter once found stays valid and adding to it is one fetch_add. Keys
+// are looked up without locking in an open-addressing table whose slots
+// are published with release stores. Only a key seen for the first time
+// takes the insert mutex; when the table fills, a table twice the size is
+// built and published, and the old ones are kept until clear() so threads
+// still probing them stay safe (a miss there is retried under the mutex).
+const size_t COUNTER_SLAB_SIZE = 4096;
+const size_t COUNTER_BATCH_SLOTS = 256;
+
+class StockCounters {
+public:
+    struct Counter {
+        int productID;
+        int supplierID;
+        atomic<long long> delta;
+        atomic<long long> magnitude;    // sum of |delta|, bounds every partial sum
+        atomic<long long> firstLine;    // earliest command that touched the key
+    };
+
+private:
+    struct Slot {
+        atomic<uint64_t> key;
+        atomic<Counter*> counter;    // null while the slot is empty
+    };
+
+    struct Table {
+        unique_ptr<Slot[]> slots;
+        size_t mask;
+        size_t used;
+
+        explicit Table(size_t capacity) : slots(new Slot[capacity]), mask(capacity - 1), used(0) {
+            for (size_t i = 0; i < capacity; ++i) {
+                slots[i].key.store(0, memory_order_relaxed);
+                slots[i].counter.store(nullptr, memory_order_relaxed);
+            }
+        }
+
+        Counter* find(uint64_t key) const {
+            for (size_t i = mixHash(key) & mask;; i = (i + 1) & mask) {
+                Counter* c = slots[i].counter.load(memory_order_acquire);
+                if (!c) return nullptr;
+                if (slots[i].key.load(memory_order_relaxed) == key) return c;
+            }
+        }
+
+        // Caller holds the insert mutex and has checked that key is absent
+        void insert(uint64_t key, Counter* c) {
+            size_t i = mixHash(key) & mask;
+            while (slots[i].counter.load(memory_order_relaxed))
+                i = (i + 1) & mask;
+            slots[i].key.store(key, memory_order_relaxed);
+            slots[i].counter.store(c, memory_order_release);
+            used++;
+        }
+    };
+
+    atomic<Table*> current;
+    vector<unique_ptr<Table>> tables;       // every table published so far
+    vector<unique_ptr<Counter[]>> slabs;
+    size_t slabUsed;
+    size_t counterCount;
+    mutex insertMutex;
+
+    Counter* create(int productID, int supplierID) {
+        uint64_t key = stockKey(productID, supplierID);
+        lock_guard<mutex> lock(insertMutex);
+        Table* table = current.load(memory_order_relaxed);
+        if (Counter* c = table->find(key)) return c;
+
+        if (slabs.empty() || slabUsed == COUNTER_SLAB_SIZE) {
+            slabs.emplace_back(new Counter[COUNTER_SLAB_SIZE]);
+            slabUsed = 0;
+        }
+        Counter* c = &slabs.back()[slabUsed++];
+        c->productID = productID;
+        c->supplierID = supplierID;
+        c->delta.store(0, memory_order_relaxed);
+        c->magnitude.store(0, memory_order_relaxed);
+        c->firstLine.store(LLONG_MAX, memory_order_relaxed);
+        counterCount++;
+
+        if ((table->used + 1) * 10 > (table->mask + 1) * 7) {
+            Table* grown = new Table((table->mask + 1) * 2);
+            tables.emplace_back(grown);
+            for (size_t i = 0; i <= table->mask; ++i)
+                if (Counter* old = table->slots[i].counter.load(memory_order_relaxed))
+                    grown->insert(table->slots[i].key.load(memory_order_relaxed), old);
+            current.store(grown, memory_order_release);
+            table = grown;
+        }
+        table->insert(key, c);
+        return c;
+    }
+
+public:
+    StockCounters() : slabUsed(0), counterCount(0) {
+        tables.emplace_back(new Table(1024));
+        current.store(tables.back().get(), memory_order_release);
+    }
+
+    StockCounters(const StockCounters&) = delete;
+    StockCounters& operator=(const StockCounters&) = delete;
+
+    // Not safe while other threads are adding
+    void clear() {
+        tables.clear();
+        slabs.clear();
+        slabUsed = 0;
+        counterCount = 0;
+        tables.emplace_back(new Table(1024));
+        current.store(tables.back().get(), memory_order_release);
+    }
+
+    // The counter of a key, created on first use
+    Counter* counter(int productID, int supplierID) {
+        Counter* c = current.load(memory_order_acquire)->find(stockKey(productID, supplierID));
+        return c ? c : create(productID, supplierID);
+    }
+
+    // Adds delta to the key's counter; line orders keys by first use.
+    // magnitude is the sum of |delta| over the deltas added.
+    void add(int productID, int supplierID, long long delta, long long magnitude, long long line) {
+        Counter* c = counter(productID, supplierID);
+        c->delta.fetch_add(delta, memory_order_relaxed);
+        c->magnitude.fetch_add(magnitude, memory_order_relaxed);
+        long long first = c->firstLine.load(memory_order_relaxed);
+        while (line < first && !c->firstLine.compare_exchange_weak(first, line, memory_order_relaxed)) {}
+    }
+
+
+    // Every counter, ordered by first use. Call once the adding threads are done.
+    vector<Counter*> byFirstUse() {
+        vector<Counter*> result;
+        result.reserve(counterCount);
+        for (size_t s = 0; s < slabs.size(); ++s) {
+            size_t n = s + 1 == slabs.size() ? slabUsed : COUNTER_SLAB_SIZE;
+            for (size_t i = 0; i < n; ++i) result.push_back(&slabs[s][i]);
+        }
+        sort(result.begin(), result.end(), [](const Counter* a, const Counter* b) {
+            return a->firstLine.load(memory_order_relaxed) < b->firstLine.load(memory_order_relaxed);
+        });
+        return result;
+    }
+
+    size_t size() {
+        lock_guard<mutex> lock(insertMutex);
+        return counterCount;
+    }
+
+    // One thread's pending deltas for a StockCounters. A direct-mapped cache
+    // of COUNTER_BATCH_SLOTS keys absorbs repeated deltas to hot keys, so a
+    // SKU that every thread hammers costs one shared fetch_add per eviction
+    // instead of one per delta. A key is flushed when another key needs its
+    // slot, and everything is flushed by flush() or the destructor.
+    class Batch {
+    private:
+        struct Pending {
+            uint64_t key;
+            int productID;
+            int supplierID;
+            long long delta;
+            long long magnitude;
+            long long firstLine;
+            bool used;
+        };
+
+        StockCounters& counters;
+        Pending pending[COUNTER_BATCH_SLOTS];
+
+        void apply(Pending& p) {
+            counters.add(p.productID, p.supplierID, p.delta, p.magnitude, p.firstLine);
+            p.used = false;
+        }
+
+    public:
+        explicit Batch(StockCounters& c) : counters(c) {
+            for (Pending& p : pending) p.used = false;
+        }
+
+        ~Batch() {
+            flush();
+        }
+
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+        void add(int productID, int supplierID, long long delta, long long line) {
+            uint64_t key = stockKey(productID, supplierID);
+            Pending& p = pending[mixHash(key) % COUNTER_BATCH_SLOTS];
+            if (p.used && p.key == key) {
+                p.delta += delta;
+                p.magnitude += delta < 0 ? -delta : delta;
+                p.firstLine = min(p.firstLine, line);
+                return;
+            }
+            if (p.used) apply(p);
+            p = Pending{key, productID, supplierID, delta, delta < 0 ? -delta : delta, line, true};
+        }
+
+        void flush() {
+            for (Pending& p : pending)
+                if (p.used) apply(p);
+        }
+    };
+};
+
+// --------- Thread Pool ---------
+// Fixed set of worker threads shared by the parallel loaders, sorts and
+// scans. run() hands out task indices from a shared counter and the calling
+// thread works through them too, so nested run() calls cannot deadlock.
+class ThreadPool {
+private:
+    vector<thread> workers;
+    deque<function<void()>> jobs;
+    mutex jobMutex;
+    condition_variable jobReady;
+    bool stopping;
+
+    void workerLoop() {
+        while (true) {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock(jobMutex);
+                jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty()) return;
+                job = move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+    explicit ThreadPool(unsigned workerCount) : stopping(false) {
+        for (unsigned i = 0; i < workerCount; ++i)
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (thread& t : workers) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Threads that take part in run(), including the caller
+    size_t size() const { return workers.size() + 1; }
+
+    // Runs task(0) .. task(taskCount - 1) and waits for all of them. The
+    // first exception thrown by a task is rethrown here. Tasks intern text
+    // into the caller's current arena.
+    void run(size_t taskCount, const function<void(size_t)>& task) {
+        if (taskCount == 0) return;
+
+        struct Batch {
+            atomic<size_t> next{0};
+            atomic<size_t> finished{0};
+            mutex doneMutex;
+            condition_variable done;
+            exception_ptr error;
+        };
+        shared_ptr<Batch> batch = make_shared<Batch>();
+
+        // Helpers that start after the batch is drained see next >= taskCount
+        // and leave without touching task
+        TextArena* text = TextArena::current();
+        auto drain = [batch, &task, taskCount, text]() {
+            TextScope scope(text);
+            while (true) {
+                size_t i = batch->next.fetch_add(1);
+                if (i >= taskCount) return;
+                try {
+                    task(i);
+                } catch (...) {
+                    lock_guard<mutex> lock(batch->doneMutex);
+                    if (!batch->error) batch->error = current_exception();
+                }
+                if (batch->finished.fetch_add(1) + 1 == taskCount) {
+                    lock_guard<mutex> lock(batch->doneMutex);
+                    batch->done.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = min(workers.size(), taskCount - 1);
+        if (helpers > 0) {
+            {
+                lock_guard<mutex> lock(jobMutex);
+                for (size_t i = 0; i < helpers; ++i) jobs.push_back(drain);
+            }
+            jobReady.notify_all();
+        }
+        drain();
+
+        unique_lock<mutex> lock(batch->doneMutex);
+        batch->done.wait(lock, [&] { return batch->finished.load() == taskCount; });
+        if (batch->error) rethrow_exception(batch->error);
+    }
+};
+
+// Process-wide pool sized to the machine
+ThreadPool& sharedThreadPool() {
+    static ThreadPool pool(max(1u, thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+// --------- Sort Engine ---------
+// Reusable sorts over arrays of records (usually record pointers). All
+// scratch space comes from a heap vector the caller can reuse, never from
+// the stack, so arrays of any size can be sorted.
+const size_t SORT_RUN_LENGTH = 32;
+const size_t PARALLEL_SORT_MIN = 1 << 16;
+
+template <typename T, typename Less>
+void insertionSort(T* arr, size_t n, Less less) {
+    for (size_t i = 1; i < n; ++i) {
+        T value = move(arr[i]);
+        size_t j = i;
+        for (; j > 0 && less(value, arr[j - 1]); --j)
+            arr[j] = move(arr[j - 1]);
+        arr[j] = move(value);
+    }
+}
+
+// Stable merge of [a, aEnd) and [b, bEnd) into out; ties take from a
+template <typename T, typename Less>
+void mergeRuns(T* a, T* aEnd, T* b, T* bEnd, T* out, Less less) {
+    while (a < aEnd && b < bEnd) {
+        if (less(*b, *a)) *out++ = move(*b++);
+        else *out++ = move(*a++);
+    }
+    while (a < aEnd) *out++ = move(*a++);
+    while (b < bEnd) *out++ = move(*b++);
+}
+
+// Stable O(n log n) sort: insertion-sorted runs merged bottom-up, ping-ponging
+// between arr and scratch
+template <typename T, typename Less>
+void stableSort(T* arr, size_t n, Less less, vector<T>& scratch) {
+    for (size_t lo = 0; lo < n; lo += SORT_RUN_LENGTH)
+        insertionSort(arr + lo, min(SORT_RUN_LENGTH, n - lo), less);
+    if (n <= SORT_RUN_LENGTH) return;
+
+    scratch.resize(n);
+    T* src = arr;
+    T* dst = scratch.data();
+    for (size_t width = SORT_RUN_LENGTH; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = min(lo + width, n);
+            size_t hi = min(lo + 2 * width, n);
+            mergeRuns(src + lo, src + mid, src + mid, src + hi, dst + lo, less);
+        }
+        swap(src, dst);
+    }
+    if (src != arr) move(src, src + n, arr);
+}
+
+template <typename T, typename Less>
+void stableSort(T* arr, size_t n, Less less) {
+    vector<T> scratch;
+    stableSort(arr, n, less, scratch);
+}
+
+// Stable sort on a derived key, e.g. [](Product* p) { return p->price; }
+template <typename T, typename KeyFn>
+void stableSortByKey(T* arr, size_t n, KeyFn key) {
+    stableSort(arr, n, [&key](const T& x, const T& y) { return key(x) < key(y); });
+}
+
+// Number of elements of a that come before position k of the stable merge
+// of a and b (ties favour a)
+template <typename T, typename Less>
+size_t mergeCoRank(size_t k, const T* a, size_t na, const T* b, size_t nb, Less less) {
+    size_t lo = k > nb ? k - nb : 0;
+    size_t hi = min(k, na);
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        if (!less(b[k - i - 1], a[i])) lo = i + 1;
+        else hi = i;
+    }
+    return lo;
+}
+
+// Parallel stable merge sort: ranges are sorted on the pool, then merged
+// pairwise in rounds. Each merge is cut into independent pieces at co-ranks
+// so the last rounds still keep every thread busy.
+template <typename T, typename Less>
+void parallelStableSort(T* arr, size_t n, Less less, ThreadPool& pool) {
+    size_t parts = 1;
+    while (parts * 2 <= pool.size() * 2) parts *= 2;
+    if (n < PARALLEL_SORT_MIN || pool.size() < 2) {
+        stableSort(arr, n, less);
+        return;
+    }
+
+    vector<size_t> bounds(parts + 1);
+    for (size_t i = 0; i <= parts; ++i) bounds[i] = n * i / parts;
+    pool.run(parts, [&](size_t part) {
+        vector<T> scratch;
+        stableSort(arr + bounds[part], bounds[part + 1] - bounds[part], less, scratch);
+    });
+
+    vector<T> buffer(n);
+    T* src = arr;
+    T* dst = buffer.data();
+    for (size_t width = 1; width < parts; width *= 2) {
+        size_t pairs = parts / (2 * width);
+        size_t pieces = max<size_t>(1, parts / pairs);
+        pool.run(pairs * pieces, [&](size_t task) {
+            size_t pair = task / pieces, piece = task % pieces;
+            size_t lo = bounds[2 * width * pair];
+            size_t mid = bounds[2 * width * pair + width];
+            size_t hi = bounds[2 * width * (pair + 1)];
+            const T* a = src + lo;
+            const T* b = src + mid;
+            size_t na = mid - lo, nb = hi - mid;
+            size_t k0 = (na + nb) * piece / pieces;
+            size_t k1 = (na + nb) * (piece + 1) / pieces;
+            size_t i0 = mergeCoRank(k0, a, na, b, nb, less);
+            size_t i1 = mergeCoRank(k1, a, na, b, nb, less);
+            mergeRuns(src + lo + i0, src + lo + i1, src + mid + (k0 - i0), src + mid + (k1 - i1),
+                      dst + lo + k0, less);
+        });
+        swap(src, dst);
+    }
+    if (src != arr) move(src, src + n, arr);
+}
+
+// Stable LSD radix sort on a 32-bit integer key, one byte per pass. Bytes
+// on which every key agrees are skipped, so small ID ranges take fewer
+// passes.
+template <typename T, typename KeyFn>
+void radixSortByKey(T* arr, size_t n, KeyFn key, vector<T>& scratch, bool descending = false) {
+    if (n < 2) return;
+    auto ordered = [&key, descending](const T& x) {
+        uint32_t k = (uint32_t)(int32_t)key(x) ^ 0x80000000u;    // signed order as unsigned
+        return descending ? ~k : k;
+    };
+
+    vector<size_t> counts(4 * 256, 0);
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t k = ordered(arr[i]);
+        for (int b = 0; b < 4; ++b) counts[b * 256 + ((k >> (8 * b)) & 0xff)]++;
+    }
+
+    scratch.resize(n);
+    T* src = arr;
+    T* dst = scratch.data();
+    for (int b = 0; b < 4; ++b) {
+        size_t* count = &counts[b * 256];
+        bool trivial = false;
+        for (int d = 0; d < 256 && !trivial; ++d) trivial = count[d] == n;
+        if (trivial) continue;
+
+        size_t offset = 0;
+        for (int d = 0; d < 256; ++d) {
+            size_t c = count[d];
+            count[d] = offset;
+            offset += c;
+        }
+        for (size_t i = 0; i < n; ++i)
+            dst[count[(ordered(src[i]) >> (8 * b)) & 0xff]++] = move(src[i]);
+        swap(src, dst);
+    }
+    if (src != arr) move(src, src + n, arr);
+}
+
+template <typename T, typename KeyFn>
+void radixSortByKey(T* arr, size_t n, KeyFn key, bool descending = false) {
+    vector<T> scratch;
+    radixSortByKey(arr, n, key, scratch, descending);
+}
+
+// Record sorts used by the menu
+void sortProductsByID(Product* arr[], size_t n) {
+    radixSortByKey(arr, n, [](const Product* p) { return p->productID; });
+}
+
+void sortSuppliersByID(Supplier* arr[], size_t n) {
+    radixSortByKey(arr, n, [](const Supplier* s) { return s->supplierID; });
+}
+
+void sortStocksByQuantity(Stock* arr[], size_t n, bool descending = true) {
+    radixSortByKey(arr, n, [](const Stock* s) { return s->quantity; }, descending);
+}
+
+// --------- Sorting Functions ---------
+
+// Bubble Sort for Products by productID
+void bubbleSortProducts(Product* arr[], int n) {
+    bool swapped;
+    for (int i = 0; i < n -1; ++i) {
+        swapped = false;
+        for (int j = 0; j < n - i -1; ++j) {
+            if (arr[j]->productID > arr[j+1]->productID) {
+                swap(arr[j], arr[j+1]);
+                swapped = true;
+            }
+        }
+        if (!swapped) break;
+    }
+}
+
+// Bubble Sort for Suppliers by supplierID
+void bubbleSortSuppliers(Supplier* arr[], int n) {
+    bool swapped;
+    for (int i = 0; i < n -1; ++i) {
         swapped = false;
         for (int j = 0; j < n - i -1; ++j) {
             if (arr[j]->supplierID > arr[j+1]->supplierID) {
@@ -473,183 +4046,3925 @@ void bubbleSortSuppliers(Supplier* arr[], int n) {
                 swapped = true;
             }
         }
-        if (!swapped) break;
+        if (!swapped) break;
+    }
+}
+
+// Merge Sort for Stocks by quantity (descending, stable) over arr[l..r];
+// large ranges are merge-sorted in parallel
+void mergeSortStocks(Stock* arr[], int l, int r) {
+    if (l >= r) return;
+    auto byQuantityDesc = [](const Stock* a, const Stock* b) { return a->quantity > b->quantity; };
+    size_t n = (size_t)(r - l + 1);
+    if (n >= PARALLEL_SORT_MIN) parallelStableSort(arr + l, n, byQuantityDesc, sharedThreadPool());
+    else stableSort(arr + l, n, byQuantityDesc);
+}
+
+// --------- Searching Functions ---------
+
+// Linear Search for Product by productID in array
+int linearSearchProduct(Product* arr[], int n, int productID) {
+    for (int i=0; i<n; i++) {
+        if (arr[i]->productID == productID) return i;
+    }
+    return -1;
+}
+
+// Binary Search for Product by productID in sorted array
+int binarySearchProduct(Product* arr[], int n, int productID) {
+    int low = 0, high = n -1;
+    while (low <= high) {
+        int mid = low + (high - low)/2;
+        if (arr[mid]->productID == productID)
+            return mid;
+        else if (arr[mid]->productID < productID)
+            low = mid + 1;
+        else
+            high = mid -1;
+    }
+    return -1;
+}
+
+// Linear Search for Supplier by supplierID in array
+int linearSearchSupplier(Supplier* arr[], int n, int supplierID) {
+    for (int i=0; i<n; i++) {
+        if (arr[i]->supplierID == supplierID) return i;
+    }
+    return -1;
+}
+
+// Binary Search for Supplier by supplierID in sorted array
+int binarySearchSupplier(Supplier* arr[], int n, int supplierID) {
+    int low = 0, high = n -1;
+    while (low <= high) {
+        int mid = low + (high - low)/2;
+        if (arr[mid]->supplierID == supplierID)
+            return mid;
+        else if (arr[mid]->supplierID < supplierID)
+            low = mid + 1;
+        else
+            high = mid -1;
+    }
+    return -1;
+}
+
+// --------- Valuation ---------
+// Stock value is quantity x price, joined on productID. Prices and category
+// IDs are read once into a join table keyed by productID: a plain array
+// when the IDs are dense enough, a HashIndex otherwise. The columnar stock
+// rows are then split across the thread pool, each part probes the table
+// and keeps its own partial sums, and the partials are merged at the end.
+// No stock row goes through the B+tree. Stock whose product no longer
+// exists is counted but not valued.
+const size_t VALUATION_CHUNK_ROWS = 1 << 16;
+
+struct ValuationGroup {
+    int id;             // productID, supplierID or category ID
+    string name;        // category name, empty for the others
+    long long units;
+    double value;
+};
+
+struct ValuationReport {
+    long long rows = 0;
+    long long units = 0;
+    double value = 0;
+    long long orphanRows = 0;
+    vector<ValuationGroup> byCategory;    // each list highest value first
+    vector<ValuationGroup> bySupplier;
+    vector<ValuationGroup> byProduct;
+};
+
+// Units and value per key, added to by the join and merged across parts
+class ValuationGroups {
+private:
+    HashIndex<size_t> slots;    // key -> position in groups
+
+public:
+    vector<ValuationGroup> groups;
+
+    void add(int key, long long units, double value) {
+        size_t* slot = slots.find((uint32_t)key);
+        if (!slot) {
+            slots.insert((uint32_t)key, groups.size());
+            groups.push_back(ValuationGroup{key, string(), units, value});
+            return;
+        }
+        groups[*slot].units += units;
+        groups[*slot].value += value;
+    }
+};
+
+inline void sortByValue(vector<ValuationGroup>& groups, ThreadPool& pool) {
+    auto byValue = [](const ValuationGroup& a, const ValuationGroup& b) {
+        return a.value != b.value ? a.value > b.value : a.id < b.id;
+    };
+    if (groups.size() >= PARALLEL_SORT_MIN) parallelStableSort(groups.data(), groups.size(), byValue, pool);
+    else sort(groups.begin(), groups.end(), byValue);
+}
+
+// Join table from productID to price and category ID
+class PriceTable {
+private:
+    struct Entry {
+        double price;
+        uint32_t category;    // NO_PRODUCT where no product has the ID
+    };
+    static const uint32_t NO_PRODUCT = UINT32_MAX;
+
+    vector<Entry> dense;        // indexed by productID - base
+    int base;
+    HashIndex<Entry> sparse;    // used when the ID range is too wide
+    bool useDense;
+
+    Entry* slot(int productID) {
+        if (!useDense) return sparse.find((uint32_t)productID);
+        uint64_t offset = (uint64_t)((int64_t)productID - base);
+        return offset < dense.size() ? &dense[offset] : nullptr;
+    }
+
+public:
+    // products in ascending ID order
+    PriceTable(const vector<Product*>& products, const CategoryIndex& categories) : base(0), useDense(false) {
+        if (!products.empty()) {
+            base = products.front()->productID;
+            uint64_t range = (uint64_t)((int64_t)products.back()->productID - base) + 1;
+            useDense = range <= 4 * (uint64_t)products.size() + 1024;
+        }
+        if (useDense) dense.assign(products.empty() ? 0 : (size_t)((int64_t)products.back()->productID - base) + 1,
+                                   Entry{0.0, NO_PRODUCT});
+        else sparse.reserve(products.size());
+        for (Product* p : products) {
+            if (useDense) dense[(size_t)((int64_t)p->productID - base)] = Entry{p->price, 0};
+            else sparse.insert((uint32_t)p->productID, Entry{p->price, 0});
+        }
+        // Category IDs come from the posting lists, not by hashing names
+        for (uint32_t c = 0; c < categories.size(); ++c)
+            for (int id : categories.posting(c))
+                slot(id)->category = c;
+    }
+
+    // Price and category of a product; false if there is no such product
+    bool find(int productID, double& price, uint32_t& category) {
+        Entry* e = slot(productID);
+        if (!e || e->category == NO_PRODUCT) return false;
+        price = e->price;
+        category = e->category;
+        return true;
+    }
+};
+
+ValuationReport valueInventory(ProductBST& products, StockList& stocks, ThreadPool& pool) {
+    struct Partial {
+        long long units = 0;
+        double value = 0;
+        long long orphanRows = 0;
+        vector<long long> categoryUnits;
+        vector<double> categoryValue;
+        ValuationGroups suppliers;
+    };
+
+    ValuationReport report;
+    const CategoryIndex& categories = products.categoryIndex();
+    size_t categoryCount = categories.size();
+
+    // Build side: one entry per product
+    vector<Product*> all(products.getCount());
+    all.resize(products.getAllProducts(all.data(), (int)all.size()));
+    PriceTable prices(all, categories);
+
+    // Probe side: the stock columns, in independent parts
+    const StockColumns& table = stocks.columns();
+    size_t n = table.size();
+    size_t parts = max<size_t>(1, min(pool.size() * 4, (n + VALUATION_CHUNK_ROWS - 1) / VALUATION_CHUNK_ROWS));
+    vector<Partial> partials(parts);
+    pool.run(parts, [&](size_t part) {
+        Partial& local = partials[part];
+        local.categoryUnits.assign(categoryCount, 0);
+        local.categoryValue.assign(categoryCount, 0.0);
+        size_t end = n * (part + 1) / parts;
+        for (size_t i = n * part / parts; i < end; ++i) {
+            double price;
+            uint32_t category;
+            if (!prices.find(table.productIDs[i], price, category)) {
+                local.orphanRows++;
+                continue;
+            }
+            int quantity = table.quantities[i];
+            double value = quantity * price;
+            local.units += quantity;
+            local.value += value;
+            local.categoryUnits[category] += quantity;
+            local.categoryValue[category] += value;
+            local.suppliers.add(table.supplierIDs[i], quantity, value);
+        }
+    });
+
+    // Merge the partial aggregates
+    vector<long long> categoryUnits(categoryCount, 0);
+    vector<double> categoryValue(categoryCount, 0.0);
+    ValuationGroups suppliers;
+    for (const Partial& local : partials) {
+        report.units += local.units;
+        report.value += local.value;
+        report.orphanRows += local.orphanRows;
+        for (size_t c = 0; c < categoryCount; ++c) {
+            categoryUnits[c] += local.categoryUnits[c];
+            categoryValue[c] += local.categoryValue[c];
+        }
+        for (const ValuationGroup& g : local.suppliers.groups)
+            suppliers.add(g.id, g.units, g.value);
+    }
+    report.rows = (long long)n;
+
+    for (size_t c = 0; c < categoryCount; ++c)
+        if (categoryUnits[c] != 0 || categoryValue[c] != 0)
+            report.byCategory.push_back(ValuationGroup{(int)c, string(categories.name((uint32_t)c)), categoryUnits[c], categoryValue[c]});
+    report.bySupplier.swap(suppliers.groups);
+
+    // Per product the join reduces to the running total StockList keeps
+    for (Product* p : all) {
+        long long units = stocks.productTotal(p->productID);
+        if (units != 0)
+            report.byProduct.push_back(ValuationGroup{p->productID, string(), units, units * p->price});
+    }
+
+    sortByValue(report.byCategory, pool);
+    sortByValue(report.bySupplier, pool);
+    sortByValue(report.byProduct, pool);
+    return report;
+}
+
+// --------- Compressed Segments ---------
+// Optional binary form of a table segment (see saveSegments), selected
+// with --storage compressed. Records are stored column by column in
+// blocks of up to COMPRESSED_BLOCK_RECORDS:
+//   sorted IDs      differences to the previous ID, as zigzag varints or,
+//                   when that is smaller, bit-packed
+//   small integers  bit-packed: the column minimum and a bit width, then
+//                   each value minus the minimum in that many bits
+//   names/contacts  front coded: the length shared with the previous
+//                   string, then the remaining bytes
+//   categories      a dictionary per block plus bit-packed indexes
+//   prices          bit-packed cents when every price is a whole number
+//                   of cents, raw IEEE doubles otherwise
+// A file is a header (magic, version, table) and a run of blocks framed as
+// [payload bytes][records][checksum][payload], the three frame fields and
+// raw doubles little-endian on every machine. Each block decodes on its
+// own, so readers stream blocks straight into records, several at once,
+// and a damaged block only loses its own records.
+const char SEGMENT_MAGIC[4] = {'I', 'S', 'E', 'G'};
+const uint8_t SEGMENT_FORMAT_VERSION = 1;
+const size_t SEGMENT_HEADER_BYTES = 6;
+const size_t SEGMENT_BLOCK_HEADER_BYTES = 12;
+const size_t COMPRESSED_BLOCK_RECORDS = 4096;
+
+enum SegmentTable : uint8_t {
+    SEGMENT_PRODUCTS = 1,
+    SEGMENT_SUPPLIERS = 2,
+    SEGMENT_STOCKS = 3
+};
+
+enum TableFormat {
+    TABLE_TEXT,
+    TABLE_COMPRESSED,
+    TABLE_KEEP      // whatever the table's files already use
+};
+
+// Format that saves write segments in; set once from --storage
+TableFormat storageFormat = TABLE_KEEP;
+
+// FNV-1a; frames journal records and compressed blocks
+inline uint32_t checksum32(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Bits needed to hold value; 0 for 0
+inline int bitWidth(uint64_t value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long top;
+    return _BitScanReverse64(&top, value) ? (int)top + 1 : 0;
+#elif defined(__GNUC__)
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+#else
+    int width = 0;
+    for (; value; value >>= 1) width++;
+    return width;
+#endif
+}
+
+// Fixed-width fields of the format are little-endian whatever the machine
+inline void putFixed32(string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out += (char)(value >> (8 * i));
+}
+
+inline void putFixed64(string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) out += (char)(value >> (8 * i));
+}
+
+inline uint32_t getFixed32(const char* p) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) value |= (uint32_t)(unsigned char)p[i] << (8 * i);
+    return value;
+}
+
+inline uint64_t getFixed64(const char* p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) value |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    return value;
+}
+
+inline uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+inline void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+// Values are at most 2^56 apart, so a value and the bits still pending
+// always fit the 64-bit accumulator
+void putPacked(string& out, const vector<int64_t>& values) {
+    int64_t low = values.empty() ? 0 : *min_element(values.begin(), values.end());
+    int64_t high = values.empty() ? 0 : *max_element(values.begin(), values.end());
+    uint64_t range = (uint64_t)high - (uint64_t)low;
+    int width = bitWidth(range);
+    putVarint(out, zigzag(low));
+    out += (char)width;
+    uint64_t pending = 0;
+    int bits = 0;
+    for (int64_t v : values) {
+        pending |= ((uint64_t)v - (uint64_t)low) << bits;
+        bits += width;
+        for (; bits >= 8; bits -= 8, pending >>= 8)
+            out += (char)pending;
+    }
+    if (bits > 0) out += (char)pending;
+}
+
+// Differences between neighbouring values, led by a mode byte: 0 for
+// zigzag varints, 1 for bit-packed. Varints win when a few gaps are large,
+// packing when all are small.
+void putDeltas(string& out, const vector<int64_t>& values) {
+    vector<int64_t> gaps(values.size());
+    string varints;
+    int64_t previous = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        gaps[i] = values[i] - previous;
+        putVarint(varints, zigzag(gaps[i]));
+        previous = values[i];
+    }
+    // Packed, the first value travels as a varint so it does not widen the rest
+    string packed;
+    putVarint(packed, zigzag(values.empty() ? 0 : values[0]));
+    if (!values.empty()) gaps[0] = 0;
+    putPacked(packed, gaps);
+    if (packed.size() < varints.size()) {
+        out += (char)1;
+        out += packed;
+    } else {
+        out += (char)0;
+        out += varints;
+    }
+}
+
+void putFrontCoded(string& out, const vector<string_view>& strings) {
+    string_view previous;
+    for (string_view s : strings) {
+        size_t shared = 0, limit = min(s.size(), previous.size());
+        while (shared < limit && s[shared] == previous[shared]) shared++;
+        putVarint(out, shared);
+        putVarint(out, s.size() - shared);
+        out.append(s.data() + shared, s.size() - shared);
+        previous = s;
+    }
+}
+
+// Distinct strings in order of first use, then each row's index
+void putDictionary(string& out, const vector<string_view>& strings) {
+    unordered_map<string_view, int64_t> codes;
+    vector<string_view> dictionary;
+    vector<int64_t> indexes;
+    indexes.reserve(strings.size());
+    for (string_view s : strings) {
+        auto inserted = codes.emplace(s, (int64_t)dictionary.size());
+        if (inserted.second) dictionary.push_back(s);
+        indexes.push_back(inserted.first->second);
+    }
+    putVarint(out, dictionary.size());
+    for (string_view s : dictionary) {
+        putVarint(out, s.size());
+        out.append(s.data(), s.size());
+    }
+    putPacked(out, indexes);
+}
+
+// Bounds-checked reader over one block; any overrun clears ok and makes
+// every later read return zeros
+class ColumnReader {
+private:
+    const char* p;
+    const char* end;
+
+public:
+    bool ok;
+
+    ColumnReader(const char* begin, const char* stop) : p(begin), end(stop), ok(true) {}
+
+    bool atEnd() const { return p == end; }
+
+    uint8_t byte() {
+        if (p >= end) { ok = false; return 0; }
+        return (uint8_t)*p++;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            value |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return value;
+        }
+        ok = false;
+        return 0;
+    }
+
+    string_view bytes(uint64_t n) {
+        if (!ok || (uint64_t)(end - p) < n) { ok = false; return string_view(); }
+        string_view s(p, (size_t)n);
+        p += n;
+        return s;
+    }
+
+    // Reads what putDeltas wrote
+    void deltas(size_t n, vector<int64_t>& out) {
+        out.assign(n, 0);
+        uint8_t mode = byte();
+        if (mode > 1) { ok = false; return; }
+        if (mode == 1) {
+            int64_t first = unzigzag(varint());
+            packed(n, out);
+            if (n > 0) out[0] = first;
+            for (size_t i = 1; i < n && ok; ++i)
+                out[i] = (int64_t)((uint64_t)out[i - 1] + (uint64_t)out[i]);
+            return;
+        }
+        int64_t previous = 0;
+        for (size_t i = 0; i < n && ok; ++i)
+            out[i] = previous = (int64_t)((uint64_t)previous + (uint64_t)unzigzag(varint()));
+    }
+
+    // Always leaves n values in out, so callers may index it before checking ok
+    void packed(size_t n, vector<int64_t>& out) {
+        out.assign(n, 0);
+        int64_t low = unzigzag(varint());
+        int width = byte();
+        if (width > 56) { ok = false; return; }
+        string_view data = bytes(((uint64_t)n * width + 7) / 8);
+        out.assign(n, low);
+        if (!ok || width == 0) return;
+        uint64_t mask = (1ull << width) - 1, pending = 0;
+        int bits = 0;
+        size_t next = 0;
+        for (size_t i = 0; i < n; ++i) {
+            while (bits < width) {
+                pending |= (uint64_t)(unsigned char)data[next++] << bits;
+                bits += 8;
+            }
+            out[i] = (int64_t)((uint64_t)low + (pending & mask));
+            pending >>= width;
+            bits -= width;
+        }
+    }
+
+    // Calls take(i, text) for each string; text is only valid during the call
+    template <typename Take>
+    void frontCoded(size_t n, Take take) {
+        string current;
+        for (size_t i = 0; i < n && ok; ++i) {
+            uint64_t shared = varint();
+            string_view rest = bytes(varint());
+            if (!ok || shared > current.size()) { ok = false; return; }
+            current.resize((size_t)shared);
+            current.append(rest.data(), rest.size());
+            take(i, string_view(current));
+        }
+    }
+
+    void dictionary(size_t n, vector<string_view>& words, vector<int64_t>& indexes) {
+        uint64_t count = varint();
+        if (count > n) { ok = false; return; }
+        words.clear();
+        for (uint64_t i = 0; i < count && ok; ++i)
+            words.push_back(bytes(varint()));
+        packed(n, indexes);
+        for (int64_t index : indexes)
+            if (index < 0 || (uint64_t)index >= count) { ok = false; return; }
+    }
+};
+
+inline SegmentTable segmentTableOf(const Product*) { return SEGMENT_PRODUCTS; }
+inline SegmentTable segmentTableOf(const Supplier*) { return SEGMENT_SUPPLIERS; }
+inline SegmentTable segmentTableOf(const Stock*) { return SEGMENT_STOCKS; }
+
+void encodeBlock(Product* const* rows, size_t n, string& out) {
+    vector<int64_t> column(n);
+    for (size_t i = 0; i < n; ++i) column[i] = rows[i]->productID;
+    putDeltas(out, column);
+
+    bool cents = true;
+    for (size_t i = 0; i < n && cents; ++i) {
+        double scaled = nearbyint(rows[i]->price * 100);
+        cents = fabs(scaled) < 1e15 && scaled / 100 == rows[i]->price && !(scaled == 0 && signbit(rows[i]->price));
+        column[i] = (int64_t)scaled;
+    }
+    out += (char)cents;
+    if (cents) {
+        putPacked(out, column);
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t bits;
+            memcpy(&bits, &rows[i]->price, sizeof(bits));
+            putFixed64(out, bits);
+        }
+    }
+
+    vector<string_view> text(n);
+    for (size_t i = 0; i < n; ++i) text[i] = rows[i]->name();
+    putFrontCoded(out, text);
+    for (size_t i = 0; i < n; ++i) text[i] = rows[i]->category();
+    putDictionary(out, text);
+    for (size_t i = 0; i < n; ++i) column[i] = rows[i]->reorderLevel;
+    putPacked(out, column);
+}
+
+bool decodeBlock(ColumnReader& in, size_t n, vector<Product>& out) {
+    size_t base = out.size();
+    out.resize(base + n);
+    Product* rows = out.data() + base;
+    vector<int64_t> column;
+    in.deltas(n, column);
+    for (size_t i = 0; i < n; ++i) rows[i].productID = (int)column[i];
+
+    if (in.byte()) {
+        in.packed(n, column);
+        for (size_t i = 0; i < n; ++i) rows[i].price = (double)column[i] / 100;
+    } else {
+        string_view raw = in.bytes((uint64_t)n * sizeof(double));
+        for (size_t i = 0; i < n && in.ok; ++i) {
+            uint64_t bits = getFixed64(raw.data() + i * sizeof(double));
+            memcpy(&rows[i].price, &bits, sizeof(bits));
+        }
+    }
+
+    in.frontCoded(n, [&](size_t i, string_view name) { rows[i].setName(name); });
+    vector<string_view> words;
+    in.dictionary(n, words, column);
+    if (in.ok) {
+        vector<uint32_t> ids(words.size());
+        for (size_t w = 0; w < words.size(); ++w) ids[w] = internCategory(words[w]);
+        for (size_t i = 0; i < n; ++i) rows[i].categoryID = ids[column[i]];
+    }
+    in.packed(n, column);
+    for (size_t i = 0; i < n && in.ok; ++i) rows[i].reorderLevel = (int)column[i];
+    return in.ok && in.atEnd();
+}
+
+void encodeBlock(Supplier* const* rows, size_t n, string& out) {
+    vector<int64_t> ids(n);
+    for (size_t i = 0; i < n; ++i) ids[i] = rows[i]->supplierID;
+    putDeltas(out, ids);
+    vector<string_view> text(n);
+    for (size_t i = 0; i < n; ++i) text[i] = rows[i]->name();
+    putFrontCoded(out, text);
+    for (size_t i = 0; i < n; ++i) text[i] = rows[i]->contactInfo();
+    putFrontCoded(out, text);
+}
+
+bool decodeBlock(ColumnReader& in, size_t n, vector<Supplier>& out) {
+    size_t base = out.size();
+    out.resize(base + n);
+    Supplier* rows = out.data() + base;
+    vector<int64_t> ids;
+    in.deltas(n, ids);
+    for (size_t i = 0; i < n; ++i) rows[i].supplierID = (int)ids[i];
+    in.frontCoded(n, [&](size_t i, string_view name) { rows[i].setName(name); });
+    in.frontCoded(n, [&](size_t i, string_view contact) { rows[i].setContactInfo(contact); });
+    return in.ok && in.atEnd();
+}
+
+void encodeBlock(Stock* const* rows, size_t n, string& out) {
+    vector<int64_t> column(n);
+    for (size_t i = 0; i < n; ++i) column[i] = rows[i]->productID;
+    putDeltas(out, column);
+    for (size_t i = 0; i < n; ++i) column[i] = rows[i]->supplierID;
+    putPacked(out, column);
+    for (size_t i = 0; i < n; ++i) column[i] = rows[i]->quantity;
+    putPacked(out, column);
+}
+
+bool decodeBlock(ColumnReader& in, size_t n, vector<Stock>& out) {
+    size_t base = out.size();
+    out.resize(base + n);
+    Stock* rows = out.data() + base;
+    vector<int64_t> column;
+    in.deltas(n, column);
+    for (size_t i = 0; i < n; ++i) rows[i].productID = (int)column[i];
+    in.packed(n, column);
+    for (size_t i = 0; i < n && in.ok; ++i) rows[i].supplierID = (int)column[i];
+    in.packed(n, column);
+    for (size_t i = 0; i < n && in.ok; ++i) rows[i].quantity = (int)column[i];
+    return in.ok && in.atEnd();
+}
+
+// Header plus framed blocks; blocks are encoded in parallel on the pool
+template <typename Record>
+vector<string> encodeSegment(const vector<Record*>& rows, ThreadPool* pool) {
+    size_t blocks = (rows.size() + COMPRESSED_BLOCK_RECORDS - 1) / COMPRESSED_BLOCK_RECORDS;
+    vector<string> pieces(blocks + 1);
+    pieces[0].assign(SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    pieces[0] += (char)SEGMENT_FORMAT_VERSION;
+    pieces[0] += (char)segmentTableOf((Record*)nullptr);
+
+    auto encode = [&](size_t b) {
+        size_t begin = b * COMPRESSED_BLOCK_RECORDS;
+        size_t count = min(COMPRESSED_BLOCK_RECORDS, rows.size() - begin);
+        string payload;
+        encodeBlock(rows.data() + begin, count, payload);
+        string& piece = pieces[b + 1];
+        piece.reserve(SEGMENT_BLOCK_HEADER_BYTES + payload.size());
+        putFixed32(piece, (uint32_t)payload.size());
+        putFixed32(piece, (uint32_t)count);
+        putFixed32(piece, checksum32(payload.data(), payload.size()));
+        piece += payload;
+    };
+    if (pool && blocks > 1) pool->run(blocks, encode);
+    else for (size_t b = 0; b < blocks; ++b) encode(b);
+    return pieces;
+}
+
+// Streams the blocks of a compressed segment held in memory (normally a
+// MappedFile), checking the header and each block's frame as it goes
+class SegmentReader {
+private:
+    const char* p;
+    const char* end;
+    string filename;
+
+public:
+    struct Block {
+        const char* payload;
+        uint32_t length;
+        uint32_t records;
+        uint32_t checksum;
+    };
+
+    SegmentReader(const char* begin, const char* stop, SegmentTable table, const string& name)
+        : p(begin), end(stop), filename(name) {
+        if (end - p < (ptrdiff_t)SEGMENT_HEADER_BYTES || memcmp(p, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0)
+            throw FileException(filename + " is not a compressed segment.");
+        if ((uint8_t)p[4] != SEGMENT_FORMAT_VERSION)
+            throw FileException(filename + " has unsupported segment version " + to_string((uint8_t)p[4]) + ".");
+        if ((uint8_t)p[5] != table)
+            throw FileException(filename + " holds a different table.");
+        p += SEGMENT_HEADER_BYTES;
+    }
+
+    // False at the end of the file
+    bool next(Block& block) {
+        if (p == end) return false;
+        if (end - p < (ptrdiff_t)SEGMENT_BLOCK_HEADER_BYTES)
+            throw FileException(filename + " is truncated.");
+        uint32_t length = getFixed32(p);
+        block = Block{p + SEGMENT_BLOCK_HEADER_BYTES, length, getFixed32(p + 4), getFixed32(p + 8)};
+        p += SEGMENT_BLOCK_HEADER_BYTES;
+        if ((uint64_t)(end - p) < length)
+            throw FileException(filename + " is truncated.");
+        p += length;
+        return true;
+    }
+
+    // Decodes one block into out; false (with out unchanged) if the block
+    // is damaged
+    template <typename Record>
+    static bool decode(const Block& block, vector<Record>& out) {
+        if (block.records > COMPRESSED_BLOCK_RECORDS) return false;
+        if (checksum32(block.payload, block.length) != block.checksum) return false;
+        ColumnReader in(block.payload, block.payload + block.length);
+        size_t before = out.size();
+        if (decodeBlock(in, block.records, out)) return true;
+        out.resize(before);
+        return false;
+    }
+};
+
+// --------- Format Self-Check ---------
+// Round trips the compressed segment format through its edge cases
+// (--check-format): empty blocks, zero bit widths, negative values,
+// prices that are not whole cents, long shared name prefixes, and damaged
+// or truncated files.
+
+bool sameRecord(const Product& a, const Product& b) {
+    return a.productID == b.productID && memcmp(&a.price, &b.price, sizeof(double)) == 0 && a.name() == b.name() &&
+           a.category() == b.category() && a.reorderLevel == b.reorderLevel;
+}
+
+bool sameRecord(const Supplier& a, const Supplier& b) {
+    return a.supplierID == b.supplierID && a.name() == b.name() && a.contactInfo() == b.contactInfo();
+}
+
+bool sameRecord(const Stock& a, const Stock& b) {
+    return a.productID == b.productID && a.supplierID == b.supplierID && a.quantity == b.quantity;
+}
+
+template <typename Record>
+string encodeForCheck(vector<Record>& rows) {
+    vector<Record*> pointers;
+    for (Record& r : rows) pointers.push_back(&r);
+    string bytes;
+    for (const string& piece : encodeSegment(pointers, nullptr)) bytes += piece;
+    return bytes;
+}
+
+// Decodes every intact block of bytes; returns the number of damaged ones
+template <typename Record>
+size_t decodeForCheck(const string& bytes, vector<Record>& out) {
+    SegmentReader reader(bytes.data(), bytes.data() + bytes.size(), segmentTableOf((Record*)nullptr), "check");
+    size_t damaged = 0;
+    SegmentReader::Block block;
+    while (reader.next(block))
+        if (!SegmentReader::decode(block, out)) damaged++;
+    return damaged;
+}
+
+template <typename Record>
+bool roundTrips(vector<Record>& rows) {
+    vector<Record> decoded;
+    if (decodeForCheck(encodeForCheck(rows), decoded) != 0 || decoded.size() != rows.size()) return false;
+    for (size_t i = 0; i < rows.size(); ++i)
+        if (!sameRecord(rows[i], decoded[i])) return false;
+    return true;
+}
+
+// A block of no records decodes to nothing and uses up its payload
+template <typename Record>
+bool emptyBlockRoundTrips() {
+    string payload;
+    encodeBlock((Record* const*)nullptr, 0, payload);
+    SegmentReader::Block block{payload.data(), (uint32_t)payload.size(), 0,
+                               checksum32(payload.data(), payload.size())};
+    vector<Record> decoded;
+    return SegmentReader::decode(block, decoded) && decoded.empty();
+}
+
+int runFormatCheck() {
+    int failures = 0;
+    auto check = [&](const char* name, bool passed) {
+        cout << (passed ? "ok      " : "FAILED  ") << name << "\n";
+        if (!passed) failures++;
+    };
+
+    vector<Product> noProducts;
+    check("empty table", roundTrips(noProducts) && encodeForCheck(noProducts).size() == SEGMENT_HEADER_BYTES);
+    check("empty block", emptyBlockRoundTrips<Product>() && emptyBlockRoundTrips<Supplier>() &&
+                             emptyBlockRoundTrips<Stock>());
+
+    // Equal values pack to a zero bit width: the minimum, a width byte, no data
+    string packed;
+    putPacked(packed, vector<int64_t>(1000, -7));
+    ColumnReader column(packed.data(), packed.data() + packed.size());
+    vector<int64_t> values;
+    column.packed(1000, values);
+    vector<Stock> sameStocks;
+    for (int i = 0; i < 5000; ++i) sameStocks.push_back(Stock(42, 9, 100));
+    check("width 0", packed.size() == 2 && packed[1] == 0 && column.ok && column.atEnd() &&
+                         values == vector<int64_t>(1000, -7) && roundTrips(sameStocks));
+
+    vector<Stock> signedStocks;
+    const int extremes[] = {INT_MIN, INT_MIN + 1, -1000000, -1, 0, 1, INT_MAX - 1, INT_MAX};
+    for (int i = 0; i < 6000; ++i)
+        signedStocks.push_back(Stock(i - 3000, extremes[(i * 5) % 8], i % 2 ? extremes[i % 8] : -(i % 977)));
+    check("negative quantities and IDs", roundTrips(signedStocks));
+
+    vector<Product> prices;
+    const double odd[] = {0.001, 1.0 / 3, -2.5e-7, 1e300, -0.0, numeric_limits<double>::infinity(),
+                          numeric_limits<double>::quiet_NaN(), 12345678901234.56};
+    for (int i = 0; i < 300; ++i) prices.push_back(Product(i, "p", odd[i % 8], "c"));
+    vector<Product> cents;
+    for (int i = 0; i < 300; ++i) cents.push_back(Product(i, "p", (i - 150) * 0.25, "c", i % 3));
+    check("non-cent prices", roundTrips(prices) && roundTrips(cents));
+
+    // Names sharing thousands of bytes, growing and shrinking, and empty text
+    vector<Product> named;
+    vector<Supplier> suppliers;
+    string stem(5000, 'x');
+    for (int i = 0; i < 4200; ++i) {
+        string name = i % 7 == 0 ? string() : stem.substr(0, 4000 + i % 1000) + to_string(i);
+        named.push_back(Product(i * 3, name, 1.5, i % 11 == 0 ? "" : "Category" + to_string(i % 5)));
+        suppliers.push_back(Supplier(-i, name, stem + to_string(i % 3)));
+    }
+    check("long shared prefixes", roundTrips(named) && roundTrips(suppliers));
+
+    // Damage the middle block: only its records are lost
+    vector<Stock> three;
+    for (int i = 0; i < (int)COMPRESSED_BLOCK_RECORDS * 3; ++i) three.push_back(Stock(i, i % 17, i * 3 - 5000));
+    string bytes = encodeForCheck(three);
+    size_t second = SEGMENT_HEADER_BYTES + SEGMENT_BLOCK_HEADER_BYTES + getFixed32(bytes.data() + SEGMENT_HEADER_BYTES);
+    bytes[second + SEGMENT_BLOCK_HEADER_BYTES + getFixed32(bytes.data() + second) / 2] ^= 0x55;
+    vector<Stock> survivors;
+    size_t damaged = decodeForCheck(bytes, survivors);
+    bool kept = damaged == 1 && survivors.size() == 2 * COMPRESSED_BLOCK_RECORDS;
+    for (size_t i = 0; kept && i < survivors.size(); ++i)
+        kept = sameRecord(survivors[i], three[i < COMPRESSED_BLOCK_RECORDS ? i : i + COMPRESSED_BLOCK_RECORDS]);
+    bool truncated = false;
+    try {
+        vector<Stock> partial;
+        decodeForCheck(bytes.substr(0, bytes.size() - 10), partial);
+    } catch (const FileException&) {
+        truncated = true;
+    }
+    check("damaged block", kept && truncated);
+
+    cout << (failures ? to_string(failures) + " checks failed.\n" : "All format checks passed.\n");
+    return failures ? 1 : 0;
+}
+
+// --------- File Handling ---------
+
+// Read-only view of a whole file. On POSIX systems the file is mapped into
+// memory so records can be scanned in place; elsewhere it is read into a
+// single buffer.
+class MappedFile {
+private:
+    const char* data;
+    size_t length;
+#ifdef _WIN32
+    vector<char> buffer;
+#endif
+
+public:
+    MappedFile(const string& filename) : data(nullptr), length(0) {
+#ifdef _WIN32
+        ifstream ifs(filename, ios::binary);
+        if (!ifs) throw FileException("Cannot open " + filename + " for reading.");
+        buffer.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+        data = buffer.data();
+        length = buffer.size();
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw FileException("Cannot open " + filename + " for reading.");
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw FileException("Cannot read " + filename + ".");
+        }
+        length = (size_t)st.st_size;
+        if (length > 0) {
+            void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                throw FileException("Cannot map " + filename + ".");
+            }
+            madvise(mapped, length, MADV_SEQUENTIAL);
+            data = (const char*)mapped;
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data) munmap((void*)data, length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* begin() const { return data; }
+    const char* end() const { return data + length; }
+    size_t size() const { return length; }
+
+    // Number of lines, used to size indexes before a load
+    size_t countLines() const {
+        size_t lines = 0;
+        const char* p = data;
+        const char* stop = data + length;
+        while (p < stop) {
+            const char* newline = (const char*)memchr(p, '\n', stop - p);
+            lines++;
+            if (!newline) break;
+            p = newline + 1;
+        }
+        return lines;
+    }
+};
+
+// Outcome of loading one file. Bad lines are skipped and the first few
+// problems are kept with their line numbers for the caller to report.
+const size_t MAX_LOAD_MESSAGES = 20;
+
+struct LoadReport {
+    long long lines = 0;
+    long long records = 0;
+    long long malformed = 0;
+    long long duplicates = 0;
+    vector<string> messages;
+
+    void note(long long line, const string& msg) {
+        if (messages.size() < MAX_LOAD_MESSAGES)
+            messages.push_back("line " + to_string(line) + ": " + msg);
+    }
+};
+
+void printLoadReport(const string& filename, const LoadReport& report) {
+    for (const string& msg : report.messages)
+        cout << "Warning: " << filename << " " << msg << "\n";
+    long long problems = report.malformed + report.duplicates;
+    if (problems > (long long)report.messages.size())
+        cout << "Warning: " << filename << " ... and "
+             << problems - (long long)report.messages.size() << " more problem lines\n";
+}
+
+// Replaces target with a fully written temporary file in one step, so a
+// crash leaves either the old or the new contents
+void replaceFile(const string& temp, const string& target) {
+    error_code ec;
+    filesystem::rename(temp, target, ec);
+    if (ec)
+        throw FileException("Cannot replace " + target + ": " + ec.message());
+}
+
+// Records parsed from one byte range of a file. Line numbers are local to
+// the chunk until stitchChunk() turns them into file line numbers.
+template <typename Record>
+struct ParsedChunk {
+    vector<Record> records;
+    vector<long long> lineNumbers;
+    long long lines = 0;
+    long long malformed = 0;
+    vector<pair<long long, string>> problems;
+};
+
+const size_t MIN_PARSE_CHUNK_BYTES = 1 << 20;
+
+// Splits the file into about `parts` byte ranges, each ending on a newline
+vector<pair<const char*, const char*>> splitAtLines(const MappedFile& file, size_t parts) {
+    vector<pair<const char*, const char*>> ranges;
+    const char* start = file.begin();
+    const char* end = file.end();
+    for (size_t i = 1; i <= parts && start < end; ++i) {
+        const char* cut = i == parts ? end : file.begin() + file.size() * i / parts;
+        if (cut < start) cut = start;
+        const char* newline = cut < end ? (const char*)memchr(cut, '\n', end - cut) : nullptr;
+        cut = newline ? newline + 1 : end;
+        ranges.emplace_back(start, cut);
+        start = cut;
+    }
+    if (ranges.empty()) ranges.emplace_back(start, start);
+    return ranges;
+}
+
+// Parses every line of the file with Record::parse. Files of a few MB or
+// more are split at line boundaries and the pieces parsed on the pool.
+template <typename Record>
+vector<ParsedChunk<Record>> parseFileChunks(const MappedFile& file, ThreadPool* pool) {
+    size_t parts = 1;
+    if (pool)
+        parts = min(pool->size() * 4, max<size_t>(1, file.size() / MIN_PARSE_CHUNK_BYTES));
+    vector<pair<const char*, const char*>> ranges = splitAtLines(file, parts);
+    vector<ParsedChunk<Record>> chunks(ranges.size());
+
+    auto parseOne = [&](size_t c) {
+        ParsedChunk<Record>& chunk = chunks[c];
+        chunk.records.reserve((ranges[c].second - ranges[c].first) / 24);
+        const char* p = ranges[c].first;
+        const char *lineBegin, *lineEnd;
+        while (nextLine(p, ranges[c].second, lineBegin, lineEnd)) {
+            chunk.lines++;
+            if (lineBegin == lineEnd) continue;
+            chunk.records.emplace_back();
+            const char* error = nullptr;
+            if (!Record::parse(lineBegin, lineEnd, chunk.records.back(), error)) {
+                chunk.records.pop_back();
+                chunk.malformed++;
+                if (chunk.problems.size() < MAX_LOAD_MESSAGES)
+                    chunk.problems.emplace_back(chunk.lines, error);
+                continue;
+            }
+            chunk.lineNumbers.push_back(chunk.lines);
+        }
+    };
+
+    if (pool && chunks.size() > 1) pool->run(chunks.size(), parseOne);
+    else for (size_t c = 0; c < chunks.size(); ++c) parseOne(c);
+    return chunks;
+}
+
+// Converts chunk-local line numbers to file line numbers and folds the
+// chunk's counts and problems into report. Chunks are stitched in file
+// order; report.lines is the number of lines before this one.
+template <typename Record>
+void stitchChunk(ParsedChunk<Record>& chunk, LoadReport& report) {
+    long long offset = report.lines;
+    for (const pair<long long, string>& problem : chunk.problems)
+        report.note(offset + problem.first, problem.second);
+    for (long long& line : chunk.lineNumbers)
+        line += offset;
+    report.malformed += chunk.malformed;
+    report.lines = offset + chunk.lines;
+}
+
+// Writes pieces one after another through a temporary file
+void writePiecesFile(const vector<string>& pieces, const string& filename, const string& what,
+                     ios::openmode mode = ios::out) {
+    string temp = filename + ".tmp";
+    ofstream ofs(temp, mode | ios::out);
+    if (!ofs)
+        throw FileException("Cannot open " + what + " file for writing.");
+    for (const string& piece : pieces)
+        ofs.write(piece.data(), (streamsize)piece.size());
+    ofs.close();
+    if (!ofs)
+        throw FileException("Failed writing " + temp + ".");
+    replaceFile(temp, filename);
+}
+
+// Formats records as text lines and writes them through a temporary file.
+// With a pool, the rows are split into ranges formatted in parallel and
+// then written out in order.
+template <typename Record>
+void writeRecordsFile(const vector<Record*>& rows, const string& filename, const string& what, ThreadPool* pool) {
+    size_t parts = 1;
+    if (pool)
+        parts = min(pool->size() * 4, max<size_t>(1, rows.size() / 65536));
+    vector<string> pieces(parts);
+    auto format = [&](size_t part) {
+        size_t begin = rows.size() * part / parts;
+        size_t end = rows.size() * (part + 1) / parts;
+        for (size_t i = begin; i < end; ++i) {
+            rows[i]->appendTo(pieces[part]);
+            pieces[part] += '\n';
+        }
+    };
+    if (pool && parts > 1) pool->run(parts, format);
+    else format(0);
+    writePiecesFile(pieces, filename, what);
+}
+
+// Segments of a table live next to it: products.txt -> products.segments/
+string segmentDirectory(const string& filename) {
+    return filesystem::path(filename).replace_extension(".segments").string();
+}
+
+// Records per segment file. A save cuts the sorted table into runs of
+// this many records, never between records with the same key, and splits
+// a rewritten segment again once it holds twice as many.
+const size_t SEGMENT_RECORDS = 4096;
+
+// The manifest lists the segments in key order, one "firstKey,records,file"
+// line each. A segment holds the keys from its firstKey up to the next
+// segment's; the first one also holds every key below. File names are
+// never reused: a save writes new files, replaces the manifest and only
+// then removes the files it no longer lists, so a crash at any point
+// leaves a complete table.
+struct SegmentFile {
+    int firstKey;
+    size_t records;
+    string name;    // inside the segment directory: 8 hex digits, .txt or .seg
+
+    TableFormat format() const {
+        return name.compare(name.size() - 4, 4, ".seg") == 0 ? TABLE_COMPRESSED : TABLE_TEXT;
+    }
+};
+
+string manifestPath(const string& filename) {
+    return (filesystem::path(segmentDirectory(filename)) / "manifest.txt").string();
+}
+
+bool validSegmentName(const string& name) {
+    if (name.size() != 12 || (name.compare(8, 4, ".txt") != 0 && name.compare(8, 4, ".seg") != 0)) return false;
+    for (int i = 0; i < 8; ++i)
+        if (!isxdigit((unsigned char)name[i])) return false;
+    return true;
+}
+
+// Segments of a table; false if it has no manifest (it is a single file
+// or was never saved)
+bool readManifest(const string& filename, vector<SegmentFile>& segments) {
+    segments.clear();
+    string path = manifestPath(filename);
+    if (!filesystem::exists(path)) return false;
+    ifstream ifs(path);
+    if (!ifs)
+        throw FileException("Cannot open " + path + ".");
+    string line;
+    while (getline(ifs, line)) {
+        if (line.empty()) continue;
+        const char* p = line.data();
+        const char* end = p + line.size();
+        const char* keyEnd = fieldEnd(p, end);
+        const char* countEnd = keyEnd == end ? end : fieldEnd(keyEnd + 1, end);
+        SegmentFile segment;
+        int records;
+        if (countEnd == end || !parseIntField(p, keyEnd, segment.firstKey) ||
+            !parseIntField(keyEnd + 1, countEnd, records) || records < 0)
+            throw FileException("Damaged segment manifest: " + path);
+        segment.records = (size_t)records;
+        segment.name.assign(countEnd + 1, end);
+        if (!validSegmentName(segment.name) || (!segments.empty() && segments.back().firstKey >= segment.firstKey))
+            throw FileException("Damaged segment manifest: " + path);
+        segments.push_back(move(segment));
+    }
+    return true;
+}
+
+void writeManifest(const string& filename, const vector<SegmentFile>& segments) {
+    string text;
+    for (const SegmentFile& segment : segments) {
+        appendNumber(text, segment.firstKey);
+        text += ',';
+        appendNumber(text, (long long)segment.records);
+        text += ',';
+        text += segment.name;
+        text += '\n';
+    }
+    writePiecesFile({text}, manifestPath(filename), "segment manifest");
+}
+
+// Records of a segmented table as listed in its manifest, or 0 when that
+// is not known up front (a single file)
+size_t savedRecordCount(const string& filename) {
+    vector<SegmentFile> segments;
+    size_t total = 0;
+    if (readManifest(filename, segments))
+        for (const SegmentFile& segment : segments) total += segment.records;
+    return total;
+}
+
+struct TableFile {
+    string path;
+    TableFormat format;
+};
+
+// Files holding a saved table, in key order: the segments of its manifest,
+// or else a single file at filename (as shipped, or written by --generate
+// or for a table smaller than a segment); a table never saved has none.
+// A save converting a single file removes it right after writing the
+// manifest, so when both exist the manifest is the newer.
+vector<TableFile> tableFiles(const string& filename) {
+    vector<SegmentFile> segments;
+    if (!readManifest(filename, segments)) {
+        if (filesystem::exists(filename)) return {TableFile{filename, TABLE_TEXT}};
+        return {};
+    }
+    vector<TableFile> files;
+    for (const SegmentFile& segment : segments)
+        files.push_back(TableFile{(filesystem::path(segmentDirectory(filename)) / segment.name).string(),
+                                  segment.format()});
+    return files;
+}
+
+// Decodes one compressed block as a chunk. A damaged block is skipped and
+// reported like bad lines, counting records as lines.
+template <typename Record>
+ParsedChunk<Record> decodeSegmentBlock(const SegmentReader::Block& block, const string& filename) {
+    ParsedChunk<Record> chunk;
+    chunk.lines = block.records;
+    if (!SegmentReader::decode(block, chunk.records)) {
+        chunk.malformed = block.records;
+        chunk.problems.emplace_back(1, "damaged compressed block of " + to_string(block.records) + " records in " +
+                                           filename);
+        return chunk;
+    }
+    chunk.lineNumbers.resize(chunk.records.size());
+    for (size_t i = 0; i < chunk.lineNumbers.size(); ++i) chunk.lineNumbers[i] = (long long)i + 1;
+    return chunk;
+}
+
+// Parses every file of a table as if they were one file and hands the
+// chunks to take(chunks) in file order, a window at a time. A window is a
+// few tasks per thread, each a text file or a compressed block, so a
+// compressed table streams into the store a few blocks at a time rather
+// than being decoded whole first. A single text file is split into pieces
+// and arrives as one window.
+template <typename Record, typename Take>
+void streamTableChunks(const string& filename, ThreadPool* pool, Take take) {
+    struct Task {
+        const MappedFile* file;
+        const string* path;
+        bool compressed;
+        SegmentReader::Block block;
+    };
+    vector<TableFile> files = tableFiles(filename);
+    size_t window = pool ? pool->size() * 2 : 1;
+    vector<unique_ptr<MappedFile>> mapped;    // files the pending tasks read
+    vector<Task> tasks;
+    auto runWindow = [&]() {
+        vector<vector<ParsedChunk<Record>>> parsed(tasks.size());
+        auto parseOne = [&](size_t t) {
+            const Task& task = tasks[t];
+            if (task.compressed) parsed[t].push_back(decodeSegmentBlock<Record>(task.block, *task.path));
+            else parsed[t] = parseFileChunks<Record>(*task.file, tasks.size() == 1 ? pool : nullptr);
+        };
+        if (pool && tasks.size() > 1) pool->run(tasks.size(), parseOne);
+        else for (size_t t = 0; t < tasks.size(); ++t) parseOne(t);
+        tasks.clear();
+        vector<ParsedChunk<Record>> chunks;
+        for (vector<ParsedChunk<Record>>& part : parsed)
+            move(part.begin(), part.end(), back_inserter(chunks));
+        if (!chunks.empty()) take(chunks);
+        // Only the newest file may still have blocks to come
+        if (mapped.size() > 1) mapped.erase(mapped.begin(), mapped.end() - 1);
+    };
+
+    for (const TableFile& source : files) {
+        mapped.push_back(make_unique<MappedFile>(source.path));
+        const MappedFile& file = *mapped.back();
+        if (source.format == TABLE_TEXT) {
+            tasks.push_back(Task{&file, &source.path, false, SegmentReader::Block()});
+            if (tasks.size() >= window) runWindow();
+            continue;
+        }
+        SegmentReader reader(file.begin(), file.end(), segmentTableOf((Record*)nullptr), source.path);
+        SegmentReader::Block block;
+        while (reader.next(block)) {
+            tasks.push_back(Task{&file, &source.path, true, block});
+            if (tasks.size() >= window) runWindow();
+        }
+    }
+    runWindow();
+}
+
+// Boundaries that cut rows sorted by key into about parts runs of equal
+// size, never between two rows with the same key; starts with 0 and ends
+// with rows.size()
+template <typename Record, typename KeyOf>
+vector<size_t> cutSegments(const vector<Record*>& rows, size_t parts, KeyOf keyOf) {
+    vector<size_t> cuts(1, 0);
+    for (size_t p = 1; p < parts; ++p) {
+        size_t cut = max(cuts.back() + 1, rows.size() * p / parts);
+        while (cut < rows.size() && keyOf(*rows[cut]) == keyOf(*rows[cut - 1])) ++cut;
+        if (cut >= rows.size()) break;
+        cuts.push_back(cut);
+    }
+    cuts.push_back(rows.size());
+    return cuts;
+}
+
+// Saves a table and returns how many files were written or removed; a
+// table with no changes is not touched at all. keyOf gives the key that
+// places a record in a segment, keys bounds those keys, allRows lists
+// every record and rangeRows the records with keys in [low, high] ordered
+// by key. rangeScans says rangeRows walks only the records it returns;
+// otherwise it probes every key in the range.
+//
+// A table smaller than a segment that is not yet segmented is written as
+// a single text file. Otherwise only the segments whose key range holds a
+// changed key are rewritten. A full save (the first one, one after
+// clear(), one that converts a single file or one that switches
+// storageFormat) cuts the whole table anew and also sweeps out files left
+// behind by an interrupted save.
+template <typename Record, typename KeyOf, typename AllRows, typename RangeRows>
+size_t saveSegments(const string& filename, const string& what, ChangedKeys& changed, const KeyBounds& keys,
+                    size_t total, KeyOf keyOf, AllRows allRows, RangeRows rangeRows, bool rangeScans,
+                    ThreadPool* pool) {
+    vector<SegmentFile> old;
+    bool segmented = readManifest(filename, old);
+    bool singleFile = !segmented && filesystem::exists(filename);
+
+    // Existing files decide the format unless --storage chose one; files in
+    // the other format are converted all at once
+    TableFormat format = storageFormat;
+    if (format == TABLE_KEEP) {
+        format = TABLE_TEXT;
+        for (const SegmentFile& segment : old)
+            if (segment.format() == TABLE_COMPRESSED) format = TABLE_COMPRESSED;
+    }
+    bool convert = singleFile && format == TABLE_COMPRESSED;
+    for (const SegmentFile& segment : old)
+        if (segment.format() != format) convert = true;
+
+    // Key range of segment i, and the part of it that can hold records
+    // now (the first and last ranges are open-ended)
+    auto lowOf = [&](size_t i) { return i == 0 ? INT_MIN : old[i].firstKey; };
+    auto highOf = [&](size_t i) { return i + 1 < old.size() ? old[i + 1].firstKey - 1 : INT_MAX; };
+    auto rowLow = [&](size_t i) { return max(lowOf(i), keys.low); };
+    auto rowHigh = [&](size_t i) { return min(highOf(i), keys.high); };
+
+    bool full = changed.all() || convert;
+    vector<size_t> dirty;
+    if (!full) {
+        if (!changed.any(INT_MIN, INT_MAX)) return 0;
+        full = old.empty();
+        for (size_t i = 0; i < old.size(); ++i)
+            if (changed.any(lowOf(i), highOf(i))) dirty.push_back(i);
+    }
+
+    auto byKey = [&](const Record* a, const Record* b) { return keyOf(*a) < keyOf(*b); };
+    auto everyRow = [&]() {
+        vector<Record*> every;
+        allRows(every);
+        if (!is_sorted(every.begin(), every.end(), byKey))
+            stable_sort(every.begin(), every.end(), byKey);
+        return every;
+    };
+
+    if (!segmented && format == TABLE_TEXT && total <= SEGMENT_RECORDS) {
+        writeRecordsFile(everyRow(), filename, what, pool);
+        changed.reset();
+        return 1;
+    }
+
+    // Rows of the segments to write: every row cut anew on a full save, or
+    // each dirty segment's rows. Unless rangeRows scans, a segment's key
+    // range costs one lookup per key, so past the record count it is
+    // cheaper to sort every record once and slice it.
+    vector<vector<Record*>> rows;
+    if (full) {
+        vector<Record*> every = everyRow();
+        vector<size_t> cuts = cutSegments(every, (every.size() + SEGMENT_RECORDS - 1) / SEGMENT_RECORDS, keyOf);
+        for (size_t c = 0; c + 1 < cuts.size(); ++c)
+            if (cuts[c] < cuts[c + 1]) rows.emplace_back(every.begin() + cuts[c], every.begin() + cuts[c + 1]);
+    } else {
+        rows.resize(dirty.size());
+        uint64_t probes = 0;
+        for (size_t i : dirty)
+            if (rowLow(i) <= rowHigh(i)) probes += (uint64_t)((long long)rowHigh(i) - rowLow(i) + 1);
+        if (!rangeScans && probes >= total) {
+            vector<Record*> every = everyRow();
+            for (size_t d = 0; d < dirty.size(); ++d) {
+                int low = rowLow(dirty[d]), high = rowHigh(dirty[d]);
+                auto first = lower_bound(every.begin(), every.end(), low,
+                                         [&](const Record* r, int key) { return keyOf(*r) < key; });
+                auto last = upper_bound(first, every.end(), high,
+                                        [&](int key, const Record* r) { return key < keyOf(*r); });
+                rows[d].assign(first, last);
+            }
+        } else {
+            for (size_t d = 0; d < dirty.size(); ++d)
+                if (rowLow(dirty[d]) <= rowHigh(dirty[d])) rangeRows(rowLow(dirty[d]), rowHigh(dirty[d]), rows[d]);
+        }
+    }
+
+    // New manifest: untouched segments stay, a dirty one is replaced by
+    // its rows split into runs (none if it became empty). A replacement
+    // keeps the old first key, so the key ranges still cover everything.
+    unsigned long nextNumber = 0;
+    for (const SegmentFile& segment : old)
+        nextNumber = max(nextNumber, strtoul(segment.name.substr(0, 8).c_str(), nullptr, 16) + 1);
+    vector<SegmentFile> segments;
+    vector<vector<Record*>> pieces;
+    vector<size_t> pieceSegment;    // segment each piece is written as
+    auto addPieces = [&](const vector<Record*>& segmentRows, int firstKey, bool split) {
+        size_t parts = split && segmentRows.size() >= 2 * SEGMENT_RECORDS ? segmentRows.size() / SEGMENT_RECORDS : 1;
+        vector<size_t> cuts = cutSegments(segmentRows, parts, keyOf);
+        for (size_t c = 0; c + 1 < cuts.size(); ++c) {
+            if (cuts[c] == cuts[c + 1]) continue;
+            char name[16];
+            snprintf(name, sizeof(name), "%08lX.%s", nextNumber++ & 0xFFFFFFFFul,
+                     format == TABLE_COMPRESSED ? "seg" : "txt");
+            int key = c == 0 ? firstKey : keyOf(*segmentRows[cuts[c]]);
+            pieceSegment.push_back(segments.size());
+            segments.push_back(SegmentFile{key, cuts[c + 1] - cuts[c], name});
+            pieces.emplace_back(segmentRows.begin() + cuts[c], segmentRows.begin() + cuts[c + 1]);
+        }
+    };
+    if (full) {
+        for (const vector<Record*>& segmentRows : rows) addPieces(segmentRows, keyOf(*segmentRows[0]), false);
+    } else {
+        size_t d = 0;
+        for (size_t i = 0; i < old.size(); ++i) {
+            if (d < dirty.size() && dirty[d] == i) addPieces(rows[d++], old[i].firstKey, true);
+            else segments.push_back(old[i]);
+        }
+    }
+    rows.clear();
+
+    string directory = segmentDirectory(filename);
+    filesystem::create_directories(directory);
+    auto writeOne = [&](size_t i) {
+        string path = (filesystem::path(directory) / segments[pieceSegment[i]].name).string();
+        ThreadPool* inner = pieces.size() == 1 ? pool : nullptr;
+        if (format == TABLE_COMPRESSED) writePiecesFile(encodeSegment(pieces[i], inner), path, what, ios::binary);
+        else writeRecordsFile(pieces[i], path, what, inner);
+    };
+    if (pool && pieces.size() > 1) pool->run(pieces.size(), writeOne);
+    else for (size_t i = 0; i < pieces.size(); ++i) writeOne(i);
+    writeManifest(filename, segments);
+
+    // Files the manifest no longer lists go only now; a full save also
+    // sweeps out those of interrupted saves
+    size_t touched = pieces.size();
+    error_code ec;
+    if (singleFile && filesystem::remove(filename, ec)) touched++;
+    if (full) {
+        vector<string> listed;
+        for (const SegmentFile& segment : segments) listed.push_back(segment.name);
+        sort(listed.begin(), listed.end());
+        for (filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+            string name = it->path().filename().string();
+            error_code removed;
+            if (validSegmentName(name) && !binary_search(listed.begin(), listed.end(), name) &&
+                filesystem::remove(it->path(), removed))
+                touched++;
+        }
+    } else {
+        for (size_t i : dirty)
+            if (filesystem::remove(filesystem::path(directory) / old[i].name, ec)) touched++;
+    }
+    changed.reset();
+    return touched;
+}
+
+
+size_t saveProductsToFile(ProductBST& bst, const string& filename, ThreadPool* pool = nullptr) {
+    METRIC_TIMER(OP_SAVE_PRODUCTS);
+    return saveSegments<Product>(
+        filename, "products", bst.changes(), bst.keyBounds(), (size_t)bst.getCount(),
+        [](const Product& p) { return p.productID; },
+        [&](vector<Product*>& rows) {
+            rows.resize(bst.getCount());
+            rows.resize(bst.getAllProducts(rows.data(), (int)rows.size()));
+        },
+        [&](int low, int high, vector<Product*>& rows) { bst.getProductsInRange(low, high, rows); }, true, pool);
+}
+
+LoadReport loadProductsFromFile(ProductBST& bst, const string& filename, ThreadPool* pool = nullptr) {
+    METRIC_TIMER(OP_LOAD_PRODUCTS);
+    TextScope scope(&bst.textArena());
+    LoadReport report;
+    // The tree is bulk-built from the whole table at once
+    vector<Product> loaded;
+    vector<long long> lineNumbers;
+    loaded.reserve(savedRecordCount(filename));
+    streamTableChunks<Product>(filename, pool, [&](vector<ParsedChunk<Product>>& chunks) {
+        for (ParsedChunk<Product>& chunk : chunks) {
+            stitchChunk(chunk, report);
+            if (loaded.capacity() < chunk.records.size() && loaded.empty()) {
+                loaded.swap(chunk.records);
+                lineNumbers.swap(chunk.lineNumbers);
+                continue;
+            }
+            loaded.insert(loaded.end(), chunk.records.begin(), chunk.records.end());
+            lineNumbers.insert(lineNumbers.end(), chunk.lineNumbers.begin(), chunk.lineNumbers.end());
+        }
+    });
+
+    // Saved files are in ascending ID order, so they can be bulk-built
+    bool ordered = bst.getCount() == 0;
+    for (size_t i = 1; i < loaded.size() && ordered; ++i)
+        ordered = loaded[i - 1].productID < loaded[i].productID;
+    if (ordered) {
+        bst.bulkLoad(loaded);
+        report.records = (long long)loaded.size();
+        return report;
+    }
+
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        try {
+            bst.insert(loaded[i]);
+            report.records++;
+        } catch (const DuplicateIDException& e) {
+            report.duplicates++;
+            report.note(lineNumbers[i], e.what());
+        }
+    }
+    return report;
+}
+
+size_t saveSuppliersToFile(SupplierList& list, const string& filename, ThreadPool* pool = nullptr) {
+    METRIC_TIMER(OP_SAVE_SUPPLIERS);
+    return saveSegments<Supplier>(
+        filename, "suppliers", list.changes(), list.keyBounds(), (size_t)list.count(),
+        [](const Supplier& s) { return s.supplierID; },
+        [&](vector<Supplier*>& rows) {
+            rows.resize(list.count());
+            rows.resize(list.getAllSuppliers(rows.data(), (int)rows.size()));
+        },
+        [&](int low, int high, vector<Supplier*>& rows) { list.getSuppliersInRange(low, high, rows); }, false,
+        pool);
+}
+
+LoadReport loadSuppliersFromFile(SupplierList& list, const string& filename, ThreadPool* pool = nullptr) {
+    METRIC_TIMER(OP_LOAD_SUPPLIERS);
+    TextScope scope(&list.textArena());
+    LoadReport report;
+    streamTableChunks<Supplier>(filename, pool, [&](vector<ParsedChunk<Supplier>>& chunks) {
+        for (ParsedChunk<Supplier>& chunk : chunks) {
+            stitchChunk(chunk, report);
+            vector<size_t> duplicates;
+            report.records += list.addSuppliers(chunk.records, duplicates);
+            for (size_t i : duplicates) {
+                report.duplicates++;
+                report.note(chunk.lineNumbers[i], "Duplicate Supplier ID: " + to_string(chunk.records[i].supplierID));
+            }
+        }
+    });
+    return report;
+}
+
+// Stock segments are keyed by productID, so a product's records share a file
+size_t saveStocksToFile(StockList& list, const string& filename, ThreadPool* pool = nullptr) {
+    METRIC_TIMER(OP_SAVE_STOCKS);
+    return saveSegments<Stock>(
+        filename, "stocks", list.changes(), list.keyBounds(), (size_t)list.count(),
+        [](const Stock& s) { return s.productID; },
+        [&](vector<Stock*>& rows) {
+            rows.resize(list.count());
+            rows.resize(list.getAllStocks(rows.data(), (int)rows.size()));
+        },
+        [&](int low, int high, vector<Stock*>& rows) { list.getStocksInRange(low, high, rows); }, false, pool);
+}
+
+LoadReport loadStocksFromFile(StockList& list, const string& filename, ThreadPool* pool = nullptr) {
+    METRIC_TIMER(OP_LOAD_STOCKS);
+    LoadReport report;
+    list.reserve(list.count() + (int)savedRecordCount(filename));
+
+    // Merging into the index stays serial and in file order
+    streamTableChunks<Stock>(filename, pool, [&](vector<ParsedChunk<Stock>>& chunks) {
+        size_t total = 0;
+        for (const ParsedChunk<Stock>& chunk : chunks) total += chunk.records.size();
+        list.reserve(list.count() + (int)total);
+        for (ParsedChunk<Stock>& chunk : chunks) {
+            stitchChunk(chunk, report);
+            for (const Stock& s : chunk.records)
+                list.addStock(s);
+            report.records += (long long)chunk.records.size();
+            vector<Stock>().swap(chunk.records);
+        }
+    });
+    return report;
+}
+
+// --------- Parallel Load / Save ---------
+
+// Stock rows whose product or supplier does not exist
+struct IntegrityReport {
+    long long checked = 0;
+    long long missingProducts = 0;
+    long long missingSuppliers = 0;
+    vector<string> examples;
+};
+
+// Confirms every stock row references an existing product and supplier.
+// Lookups are read-only, so ranges of rows are checked on the pool.
+IntegrityReport checkReferentialIntegrity(ProductBST& bst, SupplierList& suppliers, StockList& stocks, ThreadPool& pool) {
+    vector<Stock*> rows(stocks.count());
+    rows.resize(stocks.getAllStocks(rows.data(), (int)rows.size()));
+
+    size_t parts = min(pool.size() * 4, max<size_t>(1, rows.size() / 65536));
+    vector<IntegrityReport> partial(parts);
+    pool.run(parts, [&](size_t part) {
+        IntegrityReport& r = partial[part];
+        size_t end = rows.size() * (part + 1) / parts;
+        for (size_t i = rows.size() * part / parts; i < end; ++i) {
+            const Stock& s = *rows[i];
+            bool product = bst.search(s.productID) != nullptr;
+            bool supplier = suppliers.findSupplier(s.supplierID) != nullptr;
+            if (!product) r.missingProducts++;
+            if (!supplier) r.missingSuppliers++;
+            if ((!product || !supplier) && r.examples.size() < MAX_LOAD_MESSAGES)
+                r.examples.push_back("stock " + to_string(s.productID) + "," + to_string(s.supplierID) +
+                                     (product ? "" : " has no product") +
+                                     (supplier ? "" : " has no supplier"));
+        }
+        r.checked = (long long)(end - rows.size() * part / parts);
+    });
+
+    IntegrityReport report;
+    for (const IntegrityReport& r : partial) {
+        report.checked += r.checked;
+        report.missingProducts += r.missingProducts;
+        report.missingSuppliers += r.missingSuppliers;
+        for (const string& example : r.examples)
+            if (report.examples.size() < MAX_LOAD_MESSAGES) report.examples.push_back(example);
+    }
+    return report;
+}
+
+void printIntegrityReport(const IntegrityReport& report) {
+    if (report.missingProducts == 0 && report.missingSuppliers == 0) return;
+    for (const string& example : report.examples)
+        cout << "Warning: " << example << "\n";
+    cout << "Warning: " << report.missingProducts << " stock records reference missing products, "
+         << report.missingSuppliers << " reference missing suppliers.\n";
+}
+
+// Loads the three tables concurrently, each one also parsed in chunks on
+// the pool. Missing tables count as empty. Reports are filled in products,
+// suppliers, stocks order; callers finish with checkReferentialIntegrity
+// once any journal has been replayed on top. The stores are expected to
+// start empty and afterwards match the files, so nothing is marked changed.
+void loadAllParallel(ProductBST& bst, SupplierList& suppliers, StockList& stocks,
+                                const string& productFile, const string& supplierFile, const string& stockFile,
+                                ThreadPool& pool, LoadReport reports[3]) {
+    pool.run(3, [&](size_t which) {
+        if (which == 0)
+            reports[0] = loadProductsFromFile(bst, productFile, &pool);
+        else if (which == 1)
+            reports[1] = loadSuppliersFromFile(suppliers, supplierFile, &pool);
+        else
+            reports[2] = loadStocksFromFile(stocks, stockFile, &pool);
+    });
+    bst.changes().reset();
+    suppliers.changes().reset();
+    stocks.changes().reset();
+}
+
+// Saves the three tables concurrently, writing their changed segments in
+// parallel. Returns the number of files written or removed.
+size_t saveAllParallel(ProductBST& bst, SupplierList& suppliers, StockList& stocks,
+                       const string& productFile, const string& supplierFile, const string& stockFile,
+                       ThreadPool& pool) {
+    size_t touched[3] = {0, 0, 0};
+    pool.run(3, [&](size_t which) {
+        if (which == 0) touched[0] = saveProductsToFile(bst, productFile, &pool);
+        else if (which == 1) touched[1] = saveSuppliersToFile(suppliers, supplierFile, &pool);
+        else touched[2] = saveStocksToFile(stocks, stockFile, &pool);
+    });
+    return touched[0] + touched[1] + touched[2];
+}
+
+// --------- Binary Snapshot ---------
+// Versioned binary image of all three stores. After a fixed header come
+// fixed-width columns (IDs, prices, quantities, and offset/length pairs into
+// a string heap) followed by the heap itself. Every section starts on an
+// 8-byte boundary and the layout is fully determined by the record counts,
+// so the loader can check the file size up front and read the columns
+// straight out of the mapping. Products are stored in ID order, which lets
+// the loader bulk-build the index.
+const char SNAPSHOT_MAGIC[8] = {'I', 'N', 'V', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t SNAPSHOT_VERSION = 2;    // 2 added the reorder level column
+const uint32_t SNAPSHOT_ENDIAN_TAG = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint64_t productCount;
+    uint64_t supplierCount;
+    uint64_t stockCount;
+    uint64_t heapSize;
+};
+
+// Byte offsets of every column for the given record counts
+struct SnapshotLayout {
+    uint64_t productIDs, prices, productNames, categories, reorderLevels;
+    uint64_t supplierIDs, supplierNames, contacts;
+    uint64_t stockProducts, stockSuppliers, quantities;
+    uint64_t heap, total;
+
+    SnapshotLayout(uint32_t version, uint64_t products, uint64_t suppliers, uint64_t stocks, uint64_t heapSize) {
+        uint64_t at = sizeof(SnapshotHeader);
+        auto section = [&at](uint64_t bytes) {
+            uint64_t start = (at + 7) & ~(uint64_t)7;
+            at = start + bytes;
+            return start;
+        };
+        productIDs = section(products * 4);
+        prices = section(products * 8);
+        productNames = section(products * 8);       // (offset, length) pairs
+        categories = section(products * 8);
+        reorderLevels = section(version >= 2 ? products * 4 : 0);
+        supplierIDs = section(suppliers * 4);
+        supplierNames = section(suppliers * 8);
+        contacts = section(suppliers * 8);
+        stockProducts = section(stocks * 4);
+        stockSuppliers = section(stocks * 4);
+        quantities = section(stocks * 4);
+        heap = section(heapSize);
+        total = at;
+    }
+};
+
+// Collects strings for the heap; categories repeat a lot, so identical
+// strings are stored once when asked to
+class SnapshotHeap {
+public:
+    string bytes;
+    unordered_map<string_view, uint32_t> shared;    // views stay valid: the text arena never moves
+
+    void add(string_view s, vector<uint32_t>& refs, bool dedupe) {
+        uint32_t offset = (uint32_t)bytes.size();
+        if (dedupe) {
+            auto found = shared.find(s);
+            if (found != shared.end()) offset = found->second;
+            else {
+                shared.emplace(s, offset);
+                bytes += s;
+            }
+        } else {
+            bytes += s;
+        }
+        refs.push_back(offset);
+        refs.push_back((uint32_t)s.size());
+    }
+};
+
+template <typename T>
+void writeSection(ofstream& ofs, uint64_t offset, const T* data, size_t count) {
+    static const char zeros[8] = {0};
+    uint64_t at = (uint64_t)ofs.tellp();
+    ofs.write(zeros, (streamsize)(offset - at));
+    ofs.write((const char*)data, (streamsize)(count * sizeof(T)));
+}
+
+template <typename T>
+T readColumn(const char* base, uint64_t offset, size_t index) {
+    T value;
+    memcpy(&value, base + offset + index * sizeof(T), sizeof(T));
+    return value;
+}
+
+void saveSnapshot(ProductBST& bst, SupplierList& suppliers, StockList& stocks, const string& filename) {
+    METRIC_TIMER(OP_SAVE_SNAPSHOT);
+    vector<Product*> products(bst.getCount());
+    products.resize(bst.getAllProducts(products.data(), (int)products.size()));
+    vector<Supplier*> supplierRows(suppliers.count());
+    supplierRows.resize(suppliers.getAllSuppliers(supplierRows.data(), (int)supplierRows.size()));
+    vector<Stock*> stockRows(stocks.count());
+    stockRows.resize(stocks.getAllStocks(stockRows.data(), (int)stockRows.size()));
+
+    SnapshotHeap heap;
+    vector<int32_t> productIDs, reorderLevels, supplierIDs, stockProducts, stockSuppliers, quantities;
+    vector<double> prices;
+    vector<uint32_t> productNames, categories, supplierNames, contacts;
+
+    for (Product* p : products) {
+        productIDs.push_back(p->productID);
+        prices.push_back(p->price);
+        heap.add(p->name(), productNames, false);
+        heap.add(p->category(), categories, true);
+        reorderLevels.push_back(p->reorderLevel);
+    }
+    for (Supplier* s : supplierRows) {
+        supplierIDs.push_back(s->supplierID);
+        heap.add(s->name(), supplierNames, false);
+        heap.add(s->contactInfo(), contacts, false);
+    }
+    for (Stock* s : stockRows) {
+        stockProducts.push_back(s->productID);
+        stockSuppliers.push_back(s->supplierID);
+        quantities.push_back(s->quantity);
+    }
+    if (heap.bytes.size() > UINT32_MAX)
+        throw FileException("Snapshot string heap exceeds 4 GB.");
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.endianTag = SNAPSHOT_ENDIAN_TAG;
+    header.productCount = products.size();
+    header.supplierCount = supplierRows.size();
+    header.stockCount = stockRows.size();
+    header.heapSize = heap.bytes.size();
+    SnapshotLayout layout(header.version, header.productCount, header.supplierCount, header.stockCount,
+                          header.heapSize);
+
+    string temp = filename + ".tmp";
+    ofstream ofs(temp, ios::binary | ios::trunc);
+    if (!ofs)
+        throw FileException("Cannot open snapshot file for writing.");
+    ofs.write((const char*)&header, sizeof(header));
+    writeSection(ofs, layout.productIDs, productIDs.data(), productIDs.size());
+    writeSection(ofs, layout.prices, prices.data(), prices.size());
+    writeSection(ofs, layout.productNames, productNames.data(), productNames.size());
+    writeSection(ofs, layout.categories, categories.data(), categories.size());
+    writeSection(ofs, layout.reorderLevels, reorderLevels.data(), reorderLevels.size());
+    writeSection(ofs, layout.supplierIDs, supplierIDs.data(), supplierIDs.size());
+    writeSection(ofs, layout.supplierNames, supplierNames.data(), supplierNames.size());
+    writeSection(ofs, layout.contacts, contacts.data(), contacts.size());
+    writeSection(ofs, layout.stockProducts, stockProducts.data(), stockProducts.size());
+    writeSection(ofs, layout.stockSuppliers, stockSuppliers.data(), stockSuppliers.size());
+    writeSection(ofs, layout.quantities, quantities.data(), quantities.size());
+    writeSection(ofs, layout.heap, heap.bytes.data(), heap.bytes.size());
+    ofs.close();
+    if (!ofs)
+        throw FileException("Failed writing snapshot file.");
+    replaceFile(temp, filename);
+}
+
+// Loads a snapshot into empty stores. The whole file is validated before
+// anything is inserted, so a bad snapshot leaves the stores untouched.
+void loadSnapshot(ProductBST& bst, SupplierList& suppliers, StockList& stocks, const string& filename) {
+    METRIC_TIMER(OP_LOAD_SNAPSHOT);
+    MappedFile file(filename);
+    const char* base = file.begin();
+
+    SnapshotHeader header;
+    if (file.size() < sizeof(header))
+        throw FileException("Snapshot file is truncated.");
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+        throw FileException("Not a snapshot file: " + filename);
+    if (header.endianTag != SNAPSHOT_ENDIAN_TAG)
+        throw FileException("Snapshot was written on a machine with different byte order.");
+    if (header.version < 1 || header.version > SNAPSHOT_VERSION)
+        throw FileException("Unsupported snapshot version " + to_string(header.version) + ".");
+
+    if (header.productCount > file.size() || header.supplierCount > file.size() ||
+        header.stockCount > file.size() || header.heapSize > file.size())
+        throw FileException("Snapshot file size does not match its header.");
+    SnapshotLayout layout(header.version, header.productCount, header.supplierCount, header.stockCount,
+                          header.heapSize);
+    if (layout.total != file.size())
+        throw FileException("Snapshot file size does not match its header.");
+
+    const char* heap = base + layout.heap;
+    auto heapString = [&](uint64_t column, size_t i) {
+        uint32_t offset = readColumn<uint32_t>(base, column, 2 * i);
+        uint32_t length = readColumn<uint32_t>(base, column, 2 * i + 1);
+        if ((uint64_t)offset + length > header.heapSize)
+            throw FileException("Snapshot string reference out of range.");
+        return string_view(heap + offset, length);
+    };
+
+    TextScope productText(&bst.textArena());
+    vector<Product> productRows(header.productCount);
+    for (size_t i = 0; i < productRows.size(); ++i) {
+        Product& p = productRows[i];
+        p.productID = readColumn<int32_t>(base, layout.productIDs, i);
+        p.price = readColumn<double>(base, layout.prices, i);
+        p.setName(heapString(layout.productNames, i));
+        p.setCategory(heapString(layout.categories, i));
+        if (header.version >= 2) p.reorderLevel = readColumn<int32_t>(base, layout.reorderLevels, i);
+        if (i > 0 && productRows[i - 1].productID >= p.productID)
+            throw FileException("Snapshot products are not in ID order.");
+    }
+
+    TextScope supplierText(&suppliers.textArena());
+    vector<Supplier> supplierRows(header.supplierCount);
+    for (size_t i = 0; i < supplierRows.size(); ++i) {
+        Supplier& s = supplierRows[i];
+        s.supplierID = readColumn<int32_t>(base, layout.supplierIDs, i);
+        s.setName(heapString(layout.supplierNames, i));
+        s.setContactInfo(heapString(layout.contacts, i));
+    }
+
+    bst.bulkLoad(productRows);
+    vector<size_t> duplicates;
+    suppliers.addSuppliers(supplierRows, duplicates);
+
+    stocks.reserve(stocks.count() + (int)header.stockCount);
+    for (size_t i = 0; i < header.stockCount; ++i) {
+        stocks.addStock(Stock(readColumn<int32_t>(base, layout.stockProducts, i),
+                              readColumn<int32_t>(base, layout.stockSuppliers, i),
+                              readColumn<int32_t>(base, layout.quantities, i)));
+    }
+    syncReorderLevels(bst, stocks);
+}
+
+// Replaces the contents of the stores with those of loaded, which are left
+// as they are. Used to swap in a snapshot only once it has loaded in full.
+void replaceStores(ProductBST& bst, SupplierList& suppliers, StockList& stocks,
+                   ProductBST& loadedBst, SupplierList& loadedSuppliers, StockList& loadedStocks) {
+    vector<Product*> productRows(loadedBst.getCount());
+    productRows.resize(loadedBst.getAllProducts(productRows.data(), (int)productRows.size()));
+    vector<Product> sorted;
+    sorted.reserve(productRows.size());
+    for (Product* p : productRows) sorted.push_back(*p);
+
+    vector<Supplier*> supplierRows(loadedSuppliers.count());
+    supplierRows.resize(loadedSuppliers.getAllSuppliers(supplierRows.data(), (int)supplierRows.size()));
+    vector<Supplier> supplierCopies;
+    supplierCopies.reserve(supplierRows.size());
+    for (Supplier* s : supplierRows) supplierCopies.push_back(*s);
+
+    vector<Stock*> stockRows(loadedStocks.count());
+    stockRows.resize(loadedStocks.getAllStocks(stockRows.data(), (int)stockRows.size()));
+
+    bst.clear();
+    suppliers.clear();
+    stocks.clear();
+    bst.bulkLoad(sorted);
+    vector<size_t> duplicates;
+    suppliers.addSuppliers(supplierCopies, duplicates);
+    stocks.reserve((int)stockRows.size());
+    for (Stock* s : stockRows) stocks.addStock(*s);
+    syncReorderLevels(bst, stocks);
+}
+
+// --------- Operation Journal ---------
+// Append-only log of the changes made since the base text files were last
+// written. Each record is framed as [length][type][payload][checksum] so a
+// torn write at the tail is detected and dropped on replay. Appends only
+// fill an in-memory buffer; a background flusher writes and fsyncs it at
+// most every JOURNAL_FLUSH_INTERVAL_MS (or once JOURNAL_GROUP_BYTES are
+// pending), so a burst of changes shares a single fsync.
+//
+// Replay is idempotent: stock records carry the resulting quantity as well
+// as the delta, product inserts overwrite, and removes of missing products
+// are ignored. That lets compaction fold a sealed journal into the base
+// files one file at a time; if it stops halfway, replaying the same sealed
+// journal again still gives the right state.
+enum JournalRecordType : uint8_t {
+    JOURNAL_PRODUCT_INSERT = 1,
+    JOURNAL_PRODUCT_REMOVE = 2,
+    JOURNAL_SUPPLIER_ADD = 3,
+    JOURNAL_STOCK_DELTA = 4
+};
+
+const size_t JOURNAL_GROUP_BYTES = 64 * 1024;
+const int JOURNAL_FLUSH_INTERVAL_MS = 20;
+
+class RecordWriter {
+public:
+    string bytes;
+
+    void putInt(int32_t value) { bytes.append((const char*)&value, sizeof(value)); }
+    void putDouble(double value) { bytes.append((const char*)&value, sizeof(value)); }
+    void putString(string_view value) {
+        putInt((int32_t)value.size());
+        bytes += value;
+    }
+};
+
+class RecordReader {
+private:
+    const char* p;
+    const char* end;
+
+public:
+    bool ok;
+
+    RecordReader(const char* begin, const char* stop) : p(begin), end(stop), ok(true) {}
+
+    int32_t getInt() {
+        int32_t value = 0;
+        if (end - p < (ptrdiff_t)sizeof(value)) { ok = false; return 0; }
+        memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return value;
+    }
+
+    double getDouble() {
+        double value = 0;
+        if (end - p < (ptrdiff_t)sizeof(value)) { ok = false; return 0; }
+        memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return value;
+    }
+
+    bool atEnd() const { return p >= end; }
+
+    // A view into the record; copy it before the record buffer goes away
+    string_view getString() {
+        int32_t length = getInt();
+        if (!ok || length < 0 || end - p < length) { ok = false; return string_view(); }
+        string_view value(p, (size_t)length);
+        p += length;
+        return value;
+    }
+};
+
+// Applies one decoded record to the stores
+void applyJournalRecord(uint8_t type, RecordReader& in, ProductBST& bst, SupplierList& suppliers, StockList& stocks) {
+    switch (type) {
+        case JOURNAL_PRODUCT_INSERT: {
+            TextScope scope(&bst.textArena());
+            Product p;
+            p.productID = in.getInt();
+            p.price = in.getDouble();
+            p.setName(in.getString());
+            p.setCategory(in.getString());
+            if (!in.atEnd()) p.reorderLevel = in.getInt();
+            if (!in.ok) return;
+            if (bst.search(p.productID)) bst.remove(p.productID);
+            bst.insert(p);
+            break;
+        }
+        case JOURNAL_PRODUCT_REMOVE: {
+            int id = in.getInt();
+            bool cascade = !in.atEnd() && in.getInt() != 0;
+            if (!in.ok) return;
+            if (bst.search(id)) bst.remove(id);
+            if (cascade) stocks.removeProductStocks(id);
+            break;
+        }
+        case JOURNAL_SUPPLIER_ADD: {
+            TextScope scope(&suppliers.textArena());
+            Supplier s;
+            s.supplierID = in.getInt();
+            s.setName(in.getString());
+            s.setContactInfo(in.getString());
+            if (in.ok && !suppliers.findSupplier(s.supplierID)) suppliers.addSupplier(s);
+            break;
+        }
+        case JOURNAL_STOCK_DELTA: {
+            int productID = in.getInt();
+            int supplierID = in.getInt();
+            in.getInt();    // delta, kept for readers of the log
+            int result = in.getInt();
+            if (!in.ok) return;
+            Stock* existing = stocks.findStock(productID, supplierID);
+            int current = existing ? existing->quantity : 0;
+            if (!existing || current != result)
+                stocks.addStock(Stock(productID, supplierID, result - current));
+            break;
+        }
+        default:
+            in.ok = false;
+            break;
+    }
+}
+
+// Replays every intact record of a journal file and returns how many bytes
+// they span; anything after the first torn or corrupt record is ignored.
+uintmax_t replayJournal(const string& path, ProductBST& bst, SupplierList& suppliers, StockList& stocks, long long& applied) {
+    applied = 0;
+    if (!filesystem::exists(path)) return 0;
+
+    MappedFile file(path);
+    const char* p = file.begin();
+    const char* end = file.end();
+    while (end - p >= 9) {
+        uint32_t length;
+        memcpy(&length, p, 4);
+        if (length == 0 || (uint64_t)(end - p) < 8 + (uint64_t)length) break;
+        const char* body = p + 4;
+        uint32_t stored;
+        memcpy(&stored, body + length, 4);
+        if (stored != checksum32(body, length)) break;
+
+        RecordReader in(body + 1, body + length);
+        applyJournalRecord((uint8_t)body[0], in, bst, suppliers, stocks);
+        if (!in.ok) break;
+        applied++;
+        p = body + length + 4;
+    }
+    return (uintmax_t)(p - file.begin());
+}
+
+// False if the data could not be forced to disk
+inline bool syncFile(FILE* f) {
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+class Journal {
+private:
+    string path;
+    string sealedPath;
+    string productFile, supplierFile, stockFile;
+
+    FILE* file;
+    uintmax_t durableBytes;    // journal length up to the last successful flush
+    string writeError;         // why the last flush failed; empty once one succeeds
+    string pending;
+    mutex bufferMutex;      // guards pending and stopping
+    mutex writeMutex;       // serializes writes to the journal file, guards durableBytes and writeError
+    condition_variable wake;
+    bool stopping;
+    thread flusher;
+
+    thread compactor;
+    atomic<bool> compacting;
+    string compactionError;
+
+    void append(uint8_t type, const RecordWriter& record) {
+        uint32_t length = (uint32_t)record.bytes.size() + 1;
+        string body;
+        body.reserve(length);
+        body.push_back((char)type);
+        body += record.bytes;
+        uint32_t sum = checksum32(body.data(), body.size());
+
+        lock_guard<mutex> lock(bufferMutex);
+        pending.append((const char*)&length, 4);
+        pending += body;
+        pending.append((const char*)&sum, 4);
+        if (pending.size() >= JOURNAL_GROUP_BYTES)
+            wake.notify_one();
+    }
+
+    // Writes and syncs the pending records. On failure (a full disk, an I/O
+    // error) the journal is cut back to its last durable length, so no torn
+    // record is left for replay to stop at, and the records are queued again
+    // in front of newer ones for the next flush; replay is idempotent, so
+    // writing one twice is harmless. Returns the error, empty on success.
+    string flushPending() {
+        lock_guard<mutex> writer(writeMutex);
+        string batch;
+        {
+            lock_guard<mutex> lock(bufferMutex);
+            batch.swap(pending);
+        }
+        if (batch.empty()) return writeError;
+        errno = 0;
+        bool written = file && fwrite(batch.data(), 1, batch.size(), file) == batch.size();
+        written = written && fflush(file) == 0;
+        written = written && syncFile(file);
+        if (written) {
+            durableBytes += batch.size();
+            writeError.clear();
+            return writeError;
+        }
+
+        writeError = "Cannot write journal " + path + ": " + (errno ? strerror(errno) : "write failed");
+        if (file) fclose(file);
+        error_code ec;
+        filesystem::resize_file(path, durableBytes, ec);
+        file = fopen(path.c_str(), "ab");
+        {
+            lock_guard<mutex> lock(bufferMutex);
+            pending.insert(0, batch);
+        }
+        return writeError;
+    }
+
+    void flusherLoop() {
+        unique_lock<mutex> lock(bufferMutex);
+        while (!stopping) {
+            wake.wait_for(lock, chrono::milliseconds(JOURNAL_FLUSH_INTERVAL_MS),
+                          [this] { return stopping || pending.size() >= JOURNAL_GROUP_BYTES; });
+            if (pending.empty()) continue;
+            lock.unlock();
+            string error = flushPending();    // commit() reports it; keep retrying
+            lock.lock();
+            if (!error.empty())
+                wake.wait_for(lock, chrono::milliseconds(JOURNAL_FLUSH_INTERVAL_MS), [this] { return stopping; });
+        }
+    }
+
+    void reopen(const char* mode) {
+        if (file) fclose(file);
+        file = fopen(path.c_str(), mode);
+        if (!file)
+            throw FileException("Cannot open journal " + path + ".");
+        error_code ec;
+        durableBytes = filesystem::file_size(path, ec);
+        if (ec) durableBytes = 0;
+    }
+
+    // Loads the base files and sealed journal into fresh stores off the UI
+    // thread, rewrites the base files, then drops the sealed journal
+    void compactSealed() {
+        try {
+            ProductBST bst;
+            SupplierList suppliers;
+            StockList stocks;
+            LoadReport reports[3];
+            loadAllParallel(bst, suppliers, stocks, productFile, supplierFile, stockFile,
+                            sharedThreadPool(), reports);
+            long long applied;
+            replayJournal(sealedPath, bst, suppliers, stocks, applied);
+
+            saveAllParallel(bst, suppliers, stocks, productFile, supplierFile, stockFile, sharedThreadPool());
+            filesystem::remove(sealedPath);
+        } catch (const exception& e) {
+            compactionError = e.what();
+        }
+        compacting = false;
+    }
+
+public:
+    Journal(const string& journalPath, const string& products, const string& suppliersPath, const string& stocksPath)
+        : path(journalPath), sealedPath(journalPath + ".old"),
+          productFile(products), supplierFile(suppliersPath), stockFile(stocksPath),
+          file(nullptr), durableBytes(0), stopping(false), compacting(false) {
+        reopen("ab");
+        flusher = thread(&Journal::flusherLoop, this);
+    }
+
+    ~Journal() {
+        {
+            lock_guard<mutex> lock(bufferMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        flusher.join();
+        string error = flushPending();
+        if (!error.empty())
+            cerr << "Warning: " << error << "; the last changes were not saved.\n";
+        if (compactor.joinable()) compactor.join();
+        if (file) fclose(file);
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    const string& activePath() const { return path; }
+    const string& sealedJournalPath() const { return sealedPath; }
+
+    void logProductInsert(const Product& p) {
+        RecordWriter r;
+        r.putInt(p.productID);
+        r.putDouble(p.price);
+        r.putString(p.name());
+        r.putString(p.category());
+        r.putInt(p.reorderLevel);
+        append(JOURNAL_PRODUCT_INSERT, r);
+    }
+
+    // cascade: the product's stock records were removed with it
+    void logProductRemove(int productID, bool cascade = false) {
+        RecordWriter r;
+        r.putInt(productID);
+        if (cascade) r.putInt(1);
+        append(JOURNAL_PRODUCT_REMOVE, r);
+    }
+
+    void logSupplierAdd(const Supplier& s) {
+        RecordWriter r;
+        r.putInt(s.supplierID);
+        r.putString(s.name());
+        r.putString(s.contactInfo());
+        append(JOURNAL_SUPPLIER_ADD, r);
+    }
+
+    void logStockDelta(int productID, int supplierID, int delta, int resultingQuantity) {
+        RecordWriter r;
+        r.putInt(productID);
+        r.putInt(supplierID);
+        r.putInt(delta);
+        r.putInt(resultingQuantity);
+        append(JOURNAL_STOCK_DELTA, r);
+    }
+
+    // Forces everything appended so far to disk; throws if it cannot
+    void commit() {
+        METRIC_TIMER(OP_JOURNAL_COMMIT);
+        string error = flushPending();
+        if (!error.empty())
+            throw FileException(error + " (changes are kept in memory and retried)");
+    }
+
+    uintmax_t size() {
+        commit();
+        error_code ec;
+        uintmax_t bytes = filesystem::file_size(path, ec);
+        return ec ? 0 : bytes;
+    }
+
+    // Cuts off a torn tail found during replay so new records follow
+    // directly after the last intact one
+    void truncateTo(uintmax_t length) {
+        lock_guard<mutex> writer(writeMutex);
+        if (file) fclose(file);
+        file = nullptr;
+        error_code ec;
+        if (filesystem::file_size(path, ec) > length && !ec)
+            filesystem::resize_file(path, length);
+        reopen("ab");
+    }
+
+    bool isCompacting() const { return compacting; }
+
+    // Seals the active journal and folds it into the base files on a
+    // background thread. A sealed journal left by an interrupted run is
+    // finished first; new changes keep going to a fresh active journal.
+    void startCompaction() {
+        if (compacting) return;
+        if (compactor.joinable()) compactor.join();
+        compactionError.clear();
+
+        if (!filesystem::exists(sealedPath)) {
+            commit();
+            lock_guard<mutex> writer(writeMutex);
+            fclose(file);
+            file = nullptr;
+            error_code ec;
+            filesystem::rename(path, sealedPath, ec);
+            reopen("ab");    // the fresh journal, or the same one if it could not be sealed
+            if (ec)
+                throw FileException("Cannot seal journal " + path + ": " + ec.message());
+        }
+        compacting = true;
+        compactor = thread(&Journal::compactSealed, this);
+    }
+
+    // Blocks until a running compaction has finished; throws if it failed
+    void waitForCompaction() {
+        if (compactor.joinable()) compactor.join();
+        if (!compactionError.empty()) {
+            string error = compactionError;
+            compactionError.clear();
+            throw FileException("Journal compaction failed: " + error);
+        }
+    }
+
+    // True, once, when a compaction started earlier has finished since
+    // the last call or wait; throws if it failed
+    bool compactionFinished() {
+        if (!compactor.joinable() || compacting) return false;
+        waitForCompaction();
+        return true;
+    }
+
+    // Called after the base files were rewritten with the full current
+    // state: every journal record is now redundant
+    void reset() {
+        waitForCompaction();
+        {
+            lock_guard<mutex> lock(bufferMutex);
+            pending.clear();
+        }
+        lock_guard<mutex> writer(writeMutex);
+        reopen("wb");
+        reopen("ab");
+        filesystem::remove(sealedPath);
+    }
+};
+
+// Rebuilds the stores from the base text files plus every journal record
+// written since they were last compacted. Missing files count as empty.
+long long recoverInventory(ProductBST& bst, SupplierList& suppliers, StockList& stocks,
+                           const string& productFile, const string& supplierFile, const string& stockFile,
+                           Journal& journal) {
+    journal.waitForCompaction();
+    journal.commit();
+
+    bst.clear();
+    suppliers.clear();
+    stocks.clear();
+    LoadReport reports[3];
+    loadAllParallel(bst, suppliers, stocks, productFile, supplierFile, stockFile, sharedThreadPool(), reports);
+    printLoadReport(productFile, reports[0]);
+    printLoadReport(supplierFile, reports[1]);
+    printLoadReport(stockFile, reports[2]);
+
+    long long sealedRecords = 0, activeRecords = 0;
+    replayJournal(journal.sealedJournalPath(), bst, suppliers, stocks, sealedRecords);
+    uintmax_t intact = replayJournal(journal.activePath(), bst, suppliers, stocks, activeRecords);
+    journal.truncateTo(intact);
+    syncReorderLevels(bst, stocks);
+    printIntegrityReport(checkReferentialIntegrity(bst, suppliers, stocks, sharedThreadPool()));
+
+    if (filesystem::exists(journal.sealedJournalPath()))
+        journal.startCompaction();
+    return sealedRecords + activeRecords;
+}
+
+// --------- Product Removal ---------
+// Shared by the menu and batch mode. A product that still has stock records
+// is rejected unless cascade is set, in which case its records go with it;
+// either way no stock record is left pointing at a missing product.
+// Returns the number of stock records removed.
+int removeProduct(int productID, bool cascade, ProductBST& products, StockList& stocks, Journal& journal) {
+    if (!products.search(productID))
+        throw NotFoundException("Product ID not found: " + to_string(productID));
+    int degree = stocks.productDegree(productID);
+    if (degree > 0 && !cascade)
+        throw IntegrityException("Product " + to_string(productID) + " still has " + to_string(degree) +
+                                 " stock records");
+
+    products.remove(productID);
+    stocks.setReorderLevel(productID, 0);    // stop watching before its stock goes
+    int removed = stocks.removeProductStocks(productID);
+    journal.logProductRemove(productID, removed > 0);
+    return removed;
+}
+
+// --------- Export ---------
+// Streams a whole table as CSV (with a header row) or as JSON lines to a
+// file or pipe through AsyncFileWriter.
+enum ExportFormat { EXPORT_CSV, EXPORT_JSONL };
+
+bool parseExportFormat(const string& name, ExportFormat& format) {
+    if (name == "csv") format = EXPORT_CSV;
+    else if (name == "jsonl" || name == "json") format = EXPORT_JSONL;
+    else return false;
+    return true;
+}
+
+// Quotes the field only when it contains a comma, quote or line break
+void writeCsvField(OutBuffer& out, string_view field) {
+    if (field.find_first_of(",\"\r\n") == string_view::npos) {
+        out << field;
+        return;
+    }
+    out << '"';
+    for (char c : field) {
+        if (c == '"') out << '"';
+        out << c;
+    }
+    out << '"';
+}
+
+void writeJsonString(OutBuffer& out, string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (c == '\n') out << "\\n";
+        else if (c == '\t') out << "\\t";
+        else if ((unsigned char)c < 0x20) out << "\\u00" << hex[(c >> 4) & 0xF] << hex[c & 0xF];
+        else out << c;
+    }
+    out << '"';
+}
+
+// Exact price, unlike the six digits used on screen
+void writeExactNumber(OutBuffer& out, double value) {
+    char text[32];
+    out.write(text, to_chars(text, text + sizeof(text), value).ptr - text);
+}
+
+long long exportProducts(ProductBST& bst, OutBuffer& out, ExportFormat format) {
+    vector<Product*> rows(bst.getCount());
+    rows.resize(bst.getAllProducts(rows.data(), (int)rows.size()));
+    if (format == EXPORT_CSV) out << "productID,name,price,category,reorderLevel\n";
+    for (Product* p : rows) {
+        if (format == EXPORT_CSV) {
+            out << p->productID << ',';
+            writeCsvField(out, p->name());
+            out << ',';
+            writeExactNumber(out, p->price);
+            out << ',';
+            writeCsvField(out, p->category());
+            out << ',' << p->reorderLevel << '\n';
+        } else {
+            out << "{\"productID\":" << p->productID << ",\"name\":";
+            writeJsonString(out, p->name());
+            out << ",\"price\":";
+            writeExactNumber(out, p->price);
+            out << ",\"category\":";
+            writeJsonString(out, p->category());
+            out << ",\"reorderLevel\":" << p->reorderLevel << "}\n";
+        }
+    }
+    return (long long)rows.size();
+}
+
+long long exportSuppliers(SupplierList& list, OutBuffer& out, ExportFormat format) {
+    vector<Supplier*> rows(list.count());
+    rows.resize(list.getAllSuppliers(rows.data(), (int)rows.size()));
+    if (format == EXPORT_CSV) out << "supplierID,name,contactInfo\n";
+    for (Supplier* s : rows) {
+        if (format == EXPORT_CSV) {
+            out << s->supplierID << ',';
+            writeCsvField(out, s->name());
+            out << ',';
+            writeCsvField(out, s->contactInfo());
+            out << '\n';
+        } else {
+            out << "{\"supplierID\":" << s->supplierID << ",\"name\":";
+            writeJsonString(out, s->name());
+            out << ",\"contactInfo\":";
+            writeJsonString(out, s->contactInfo());
+            out << "}\n";
+        }
+    }
+    return (long long)rows.size();
+}
+
+long long exportStocks(StockList& list, OutBuffer& out, ExportFormat format) {
+    vector<Stock*> rows(list.count());
+    rows.resize(list.getAllStocks(rows.data(), (int)rows.size()));
+    if (format == EXPORT_CSV) out << "productID,supplierID,quantity\n";
+    for (Stock* s : rows) {
+        if (format == EXPORT_CSV)
+            out << s->productID << ',' << s->supplierID << ',' << s->quantity << '\n';
+        else
+            out << "{\"productID\":" << s->productID << ",\"supplierID\":" << s->supplierID
+                << ",\"quantity\":" << s->quantity << "}\n";
+    }
+    return (long long)rows.size();
+}
+
+// Exports "products", "suppliers" or "stocks" to path ("-" is stdout) and
+// returns the number of records written
+long long exportTable(const string& table, ExportFormat format, const string& path,
+                      ProductBST& products, SupplierList& suppliers, StockList& stocks) {
+    if (table != "products" && table != "suppliers" && table != "stocks")
+        throw NotFoundException("Unknown table (expected products, suppliers or stocks): " + table);
+
+    AsyncFileWriter out(path);
+    long long records;
+    if (table == "products") records = exportProducts(products, out, format);
+    else if (table == "suppliers") records = exportSuppliers(suppliers, out, format);
+    else records = exportStocks(stocks, out, format);
+    out.close();
+    return records;
+}
+
+// --------- Batch Mode ---------
+// Non-interactive command stream, one command per line, fields separated
+// by commas like the data files:
+//
+//   product,<id>,<name>,<price>,<category>[,<reorderLevel>]
+//   supplier,<id>,<name>,<contact>
+//   stock,<productID>,<supplierID>,<delta>
+//   remove,<productID>[,cascade]
+//   query,product,<id> | query,supplier,<id> | query,stock,<productID>,<supplierID>
+//   query,name,<text>[,<limit>]
+//
+// Blank lines and lines starting with '#' are ignored. Commands are parsed
+// BATCH_GROUP_SIZE lines at a time (in parallel, BATCH_CHUNK_SIZE lines per
+// task), applied in order, and the journal is committed once per group.
+// Runs of at least BATCH_PARALLEL_DELTAS consecutive stock commands are
+// applied by all threads at once (see applyStockDeltas). Query results and
+// a single summary are written at the end instead of prompting and
+// flushing per field. A name query answers on one line with the matching
+// productIDs, "names,<id>,<id>,..." (see ProductBST::searchByName).
+const size_t BATCH_GROUP_SIZE = 16384;
+const size_t BATCH_CHUNK_SIZE = 1024;
+const size_t BATCH_PARALLEL_DELTAS = 4096;
+
+enum BatchOp {
+    BATCH_ADD_PRODUCT,
+    BATCH_ADD_SUPPLIER,
+    BATCH_STOCK_DELTA,
+    BATCH_REMOVE_PRODUCT,
+    BATCH_QUERY_PRODUCT,
+    BATCH_QUERY_SUPPLIER,
+    BATCH_QUERY_STOCK,
+    BATCH_QUERY_NAME
+};
+
+struct BatchCommand {
+    BatchOp op;
+    long long line;
+    Product product;
+    Supplier supplier;
+    Stock stock;     // also holds the IDs of stock queries
+    int id;          // product or supplier ID for remove/query; result limit of a name query
+    bool cascade;    // remove: also remove the product's stock records
+    string text;     // name query text
+};
+
+struct BatchSummary {
+    long long commands = 0;
+    long long productsAdded = 0;
+    long long productsRemoved = 0;
+    long long stockRecordsRemoved = 0;
+    long long suppliersAdded = 0;
+    long long stockUpdates = 0;
+    long long queries = 0;
+    long long rejected = 0;
+    long long malformed = 0;
+    long long alerts = 0;
+    vector<pair<long long, string>> messages;   // (line, message), first MAX_LOAD_MESSAGES only
+
+    void note(long long line, const string& msg) {
+        if (messages.size() < MAX_LOAD_MESSAGES)
+            messages.emplace_back(line, msg);
+    }
+};
+
+// Response line of a name query
+string nameQueryResult(ProductBST& products, const BatchCommand& cmd) {
+    vector<Product*> matches = products.searchByName(cmd.text, (size_t)cmd.id);
+    if (matches.empty()) return "notfound,name," + cmd.text;
+    string line = "names";
+    for (Product* p : matches) {
+        line += ',';
+        appendNumber(line, p->productID);
+    }
+    return line;
+}
+
+inline bool quantityInRange(long long quantity) {
+    return quantity >= INT_MIN && quantity <= INT_MAX;
+}
+
+// Throws if applying the delta in s would take its record's quantity out
+// of the int range, rather than letting it wrap
+void requireQuantityInRange(StockList& stocks, const Stock& s) {
+    Stock* existing = stocks.findStock(s.productID, s.supplierID);
+    if (!quantityInRange((long long)(existing ? existing->quantity : 0) + s.quantity))
+        throw runtime_error("Stock quantity out of range for product " + to_string(s.productID) + ", supplier " +
+                            to_string(s.supplierID));
+}
+
+// Parses one command line; on failure returns false and sets error. Names
+// and contacts go straight into the arena of the store they are bound for.
+bool parseBatchCommand(const char* begin, const char* end, BatchCommand& cmd, const char*& error,
+                       TextArena& productText, TextArena& supplierText) {
+    const char* keyEnd = fieldEnd(begin, end);
+    string keyword(begin, keyEnd);
+    const char* rest = keyEnd == end ? end : keyEnd + 1;
+
+    if (keyword == "product") {
+        cmd.op = BATCH_ADD_PRODUCT;
+        TextScope scope(&productText);
+        return Product::parse(rest, end, cmd.product, error);
+    }
+    if (keyword == "supplier") {
+        cmd.op = BATCH_ADD_SUPPLIER;
+        TextScope scope(&supplierText);
+        return Supplier::parse(rest, end, cmd.supplier, error);
+    }
+    if (keyword == "stock") {
+        cmd.op = BATCH_STOCK_DELTA;
+        return Stock::parse(rest, end, cmd.stock, error);
+    }
+    if (keyword == "remove") {
+        cmd.op = BATCH_REMOVE_PRODUCT;
+        const char* idEnd = fieldEnd(rest, end);
+        if (!parseIntField(rest, idEnd, cmd.id)) { error = "invalid product ID"; return false; }
+        string option(idEnd == end ? end : idEnd + 1, end);
+        if (!option.empty() && option != "cascade") { error = "expected remove,<productID>[,cascade]"; return false; }
+        cmd.cascade = !option.empty();
+        return true;
+    }
+    if (keyword == "query") {
+        const char* kindEnd = fieldEnd(rest, end);
+        string kind(rest, kindEnd);
+        const char* args = kindEnd == end ? end : kindEnd + 1;
+        if (kind == "product" || kind == "supplier") {
+            cmd.op = kind == "product" ? BATCH_QUERY_PRODUCT : BATCH_QUERY_SUPPLIER;
+            if (!parseIntField(args, end, cmd.id)) { error = "invalid ID"; return false; }
+            return true;
+        }
+        if (kind == "stock") {
+            cmd.op = BATCH_QUERY_STOCK;
+            const char* pEnd = fieldEnd(args, end);
+            if (pEnd == end || !parseIntField(args, pEnd, cmd.stock.productID) ||
+                !parseIntField(pEnd + 1, end, cmd.stock.supplierID)) {
+                error = "expected query,stock,<productID>,<supplierID>";
+                return false;
+            }
+            return true;
+        }
+        if (kind == "name") {
+            cmd.op = BATCH_QUERY_NAME;
+            const char* textEnd = fieldEnd(args, end);
+            cmd.text.assign(args, textEnd);
+            cmd.id = (int)NAME_SEARCH_DEFAULT_LIMIT;
+            if (cmd.text.empty()) { error = "expected query,name,<text>[,<limit>]"; return false; }
+            if (textEnd != end && (!parseIntField(textEnd + 1, end, cmd.id) || cmd.id <= 0 ||
+                                   (size_t)cmd.id > NAME_SEARCH_MAX_LIMIT)) {
+                error = "invalid limit (1 to 1000)";
+                return false;
+            }
+            return true;
+        }
+        error = "unknown query (expected product, supplier, stock or name)";
+        return false;
+    }
+    error = "unknown command";
+    return false;
+}
+
+void applyBatchCommand(const BatchCommand& cmd, ProductBST& products, SupplierList& suppliers, StockList& stocks,
+                       Journal& journal, BatchSummary& summary, string& out) {
+    try {
+        switch (cmd.op) {
+            case BATCH_ADD_PRODUCT:
+                products.insert(cmd.product);
+                if (cmd.product.reorderLevel > 0)
+                    stocks.setReorderLevel(cmd.product.productID, cmd.product.reorderLevel);
+                journal.logProductInsert(cmd.product);
+                summary.productsAdded++;
+                break;
+            case BATCH_ADD_SUPPLIER:
+                suppliers.addSupplier(cmd.supplier);
+                journal.logSupplierAdd(cmd.supplier);
+                summary.suppliersAdded++;
+                break;
+            case BATCH_STOCK_DELTA: {
+                const Stock& s = cmd.stock;
+                if (!products.search(s.productID))
+                    throw NotFoundException("Product ID not found: " + to_string(s.productID));
+                if (!suppliers.findSupplier(s.supplierID))
+                    throw NotFoundException("Supplier ID not found: " + to_string(s.supplierID));
+                requireQuantityInRange(stocks, s);
+                stocks.addStock(s);
+                journal.logStockDelta(s.productID, s.supplierID, s.quantity,
+                                      stocks.findStock(s.productID, s.supplierID)->quantity);
+                summary.stockUpdates++;
+                break;
+            }
+            case BATCH_REMOVE_PRODUCT:
+                summary.stockRecordsRemoved += removeProduct(cmd.id, cmd.cascade, products, stocks, journal);
+                summary.productsRemoved++;
+                break;
+            case BATCH_QUERY_PRODUCT: {
+                Product* p = products.search(cmd.id);
+                out += p ? "product," + p->toString() : "notfound,product," + to_string(cmd.id);
+                out += '\n';
+                summary.queries++;
+                break;
+            }
+            case BATCH_QUERY_SUPPLIER: {
+                Supplier* s = suppliers.findSupplier(cmd.id);
+                out += s ? "supplier," + s->toString() : "notfound,supplier," + to_string(cmd.id);
+                out += '\n';
+                summary.queries++;
+                break;
+            }
+            case BATCH_QUERY_STOCK: {
+                Stock* s = stocks.findStock(cmd.stock.productID, cmd.stock.supplierID);
+                out += s ? "stock," + s->toString()
+                         : "notfound,stock," + to_string(cmd.stock.productID) + "," + to_string(cmd.stock.supplierID);
+                out += '\n';
+                summary.queries++;
+                break;
+            }
+            case BATCH_QUERY_NAME:
+                products.ensureNameIndex();
+                out += nameQueryResult(products, cmd);
+                out += '\n';
+                summary.queries++;
+                break;
+        }
+    } catch (const exception& e) {
+        summary.rejected++;
+        summary.note(cmd.line, e.what());
+    }
+}
+
+// Applies a run of stock commands with the same end result as applying
+// them one by one. Threads check the IDs and sum the deltas per
+// product-supplier pair in a StockCounters; each sum is then applied and
+// journaled once, at the position of its first delta so new records keep
+// their order. Deltas of products with a reorder level are not summed but
+// applied one by one in that merge, so their low-stock alerts are raised
+// exactly as before.
+void applyStockDeltas(const BatchCommand* cmds, size_t n, ProductBST& products, SupplierList& suppliers,
+                      StockList& stocks, Journal& journal, BatchSummary& summary, string& out, ThreadPool& pool) {
+    StockCounters counters;
+    size_t tasks = (n + BATCH_CHUNK_SIZE - 1) / BATCH_CHUNK_SIZE;
+    vector<BatchSummary> local(tasks);
+    vector<vector<size_t>> watched(tasks);
+    pool.run(tasks, [&](size_t task) {
+        StockCounters::Batch batch(counters);
+        size_t last = min(n, (task + 1) * BATCH_CHUNK_SIZE);
+        for (size_t i = task * BATCH_CHUNK_SIZE; i < last; ++i) {
+            const Stock& s = cmds[i].stock;
+            if (stocks.reorderLevel(s.productID) > 0) {
+                watched[task].push_back(i);
+            } else if (!products.search(s.productID)) {
+                local[task].rejected++;
+                local[task].note(cmds[i].line, "Product ID not found: " + to_string(s.productID));
+            } else if (!suppliers.findSupplier(s.supplierID)) {
+                local[task].rejected++;
+                local[task].note(cmds[i].line, "Supplier ID not found: " + to_string(s.supplierID));
+            } else {
+                batch.add(s.productID, s.supplierID, s.quantity, cmds[i].line);
+                local[task].stockUpdates++;
+            }
+        }
+    });
+
+    // Each task noted its own first rejections; keep the earliest overall
+    vector<pair<long long, string>> messages;
+    for (BatchSummary& l : local) {
+        summary.rejected += l.rejected;
+        summary.stockUpdates += l.stockUpdates;
+        messages.insert(messages.end(), l.messages.begin(), l.messages.end());
+    }
+    sort(messages.begin(), messages.end());
+    for (const auto& msg : messages)
+        summary.note(msg.first, msg.second);
+
+    // Both sequences are in line order; merge them
+    vector<size_t> single;
+    for (const vector<size_t>& indices : watched)
+        single.insert(single.end(), indices.begin(), indices.end());
+    vector<StockCounters::Counter*> sums = counters.byFirstUse();
+    size_t next = 0;
+    for (StockCounters::Counter* c : sums) {
+        long long first = c->firstLine.load(memory_order_relaxed);
+        for (; next < single.size() && cmds[single[next]].line < first; ++next)
+            applyBatchCommand(cmds[single[next]], products, suppliers, stocks, journal, summary, out);
+        long long sum = c->delta.load(memory_order_relaxed);
+        long long bound = c->magnitude.load(memory_order_relaxed);
+        Stock* existing = stocks.findStock(c->productID, c->supplierID);
+        long long base = existing ? existing->quantity : 0;
+        if (!quantityInRange(base + bound) || !quantityInRange(base - bound)) {
+            // Some partial sum may not fit in a quantity: apply this pair's
+            // deltas one at a time instead, rejecting each one that would
+            // overflow, exactly as the serial path would
+            for (size_t i = 0; i < n; ++i) {
+                const Stock& s = cmds[i].stock;
+                if (s.productID != c->productID || s.supplierID != c->supplierID || stocks.reorderLevel(s.productID) > 0)
+                    continue;
+                summary.stockUpdates--;    // counted when it was summed
+                applyBatchCommand(cmds[i], products, suppliers, stocks, journal, summary, out);
+            }
+            continue;
+        }
+        int delta = (int)sum;
+        if (delta == 0 && existing) continue;
+        stocks.addStock(Stock(c->productID, c->supplierID, delta));
+        journal.logStockDelta(c->productID, c->supplierID, delta, stocks.findStock(c->productID, c->supplierID)->quantity);
+    }
+    for (; next < single.size(); ++next)
+        applyBatchCommand(cmds[single[next]], products, suppliers, stocks, journal, summary, out);
+}
+
+// Runs a command stream from a file, or from stdin when source is "-".
+// Returns the process exit code.
+int runBatch(const string& source, ProductBST& products, SupplierList& suppliers, StockList& stocks, Journal& journal) {
+    ios::sync_with_stdio(false);
+    auto started = chrono::steady_clock::now();
+
+    string input;
+    unique_ptr<MappedFile> file;
+    const char* p;
+    const char* end;
+    try {
+        if (source == "-") {
+            input.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+            p = input.data();
+            end = input.data() + input.size();
+        } else {
+            file.reset(new MappedFile(source));
+            p = file->begin();
+            end = file->end();
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    BatchSummary summary;
+    string out;
+    stocks.setLowStockListener([&summary, &out](const LowStockEvent& e) {
+        summary.alerts++;
+        out += (e.belowLevel ? "alert,below," : "alert,recovered,") + to_string(e.productID) + "," +
+               to_string(e.total) + "," + to_string(e.reorderLevel) + "\n";
+    });
+
+    ThreadPool& pool = sharedThreadPool();
+    vector<BatchCommand> group(BATCH_GROUP_SIZE);
+    vector<pair<const char*, const char*>> lines(BATCH_GROUP_SIZE);
+    vector<const char*> errors(BATCH_GROUP_SIZE);
+    long long line = 0;
+    const char *lineBegin, *lineEnd;
+    while (p < end) {
+        // Collect a group of command lines and parse them in parallel
+        size_t count = 0;
+        while (count < group.size() && nextLine(p, end, lineBegin, lineEnd)) {
+            line++;
+            while (lineBegin < lineEnd && isBlank(*lineBegin)) ++lineBegin;
+            if (lineBegin == lineEnd || *lineBegin == '#') continue;
+            lines[count] = make_pair(lineBegin, lineEnd);
+            group[count].line = line;
+            count++;
+        }
+        pool.run((count + BATCH_CHUNK_SIZE - 1) / BATCH_CHUNK_SIZE, [&](size_t task) {
+            size_t last = min(count, (task + 1) * BATCH_CHUNK_SIZE);
+            for (size_t i = task * BATCH_CHUNK_SIZE; i < last; ++i) {
+                errors[i] = nullptr;
+                parseBatchCommand(lines[i].first, lines[i].second, group[i], errors[i], products.textArena(),
+                                  suppliers.textArena());
+            }
+        });
+
+        size_t parsed = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (errors[i]) {
+                summary.malformed++;
+                summary.note(group[i].line, errors[i]);
+                continue;
+            }
+            if (parsed != i) swap(group[parsed], group[i]);
+            parsed++;
+        }
+
+        // Apply the group in order, then make it durable in one commit
+        for (size_t i = 0; i < parsed;) {
+            size_t run = i;
+            while (run < parsed && group[run].op == BATCH_STOCK_DELTA) run++;
+            if (run - i >= BATCH_PARALLEL_DELTAS && pool.size() > 1) {
+                applyStockDeltas(&group[i], run - i, products, suppliers, stocks, journal, summary, out, pool);
+            } else {
+                for (size_t j = i; j < run; ++j)
+                    applyBatchCommand(group[j], products, suppliers, stocks, journal, summary, out);
+            }
+            if (run < parsed)
+                applyBatchCommand(group[run++], products, suppliers, stocks, journal, summary, out);
+            i = run;
+        }
+        summary.commands += (long long)parsed;
+        try {
+            journal.commit();
+        } catch (const exception& e) {
+            cout.write(out.data(), (streamsize)out.size());
+            cerr << "Error: " << e.what() << "\nStopped after " << summary.commands
+                 << " commands; the last group is not durable.\n";
+            return 1;
+        }
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    cout.write(out.data(), (streamsize)out.size());
+    cout << "Batch complete: " << summary.commands << " commands in " << seconds << " s";
+    if (seconds > 0) cout << " (" << (long long)(summary.commands / seconds) << " ops/sec)";
+    cout << "\n  products added: " << summary.productsAdded
+         << ", removed: " << summary.productsRemoved
+         << " (with " << summary.stockRecordsRemoved << " stock records)"
+         << ", suppliers added: " << summary.suppliersAdded
+         << ", stock updates: " << summary.stockUpdates
+         << ", queries: " << summary.queries
+         << ", low-stock alerts: " << summary.alerts
+         << "\n  rejected: " << summary.rejected << ", malformed: " << summary.malformed << "\n";
+    // Malformed lines are noted while parsing, rejections while applying
+    sort(summary.messages.begin(), summary.messages.end());
+    for (const auto& msg : summary.messages)
+        cout << "  line " << msg.first << ": " << msg.second << "\n";
+    long long problems = summary.rejected + summary.malformed;
+    if (problems > (long long)summary.messages.size())
+        cout << "  ... and " << problems - (long long)summary.messages.size() << " more\n";
+    cout.flush();
+    return 0;
+}
+
+// --------- Server Mode ---------
+// Serves many terminals at once over a local Unix socket. The protocol is
+// the batch command language, one request per line, each answered by one
+// line: "ok", "ok,<value>", a query result as in batch mode, or
+// "error,<message>". Clients may pipeline requests; whatever has arrived
+// is answered in one write.
+//
+// SharedInventory puts the locking around the stores. Adding or removing
+// records changes shared structure (tree, hash indexes, columns) and takes
+// the structure lock exclusively. Everything else holds it shared plus the
+// lock of the product's shard, exclusively for a stock update to an
+// existing record and shared for a query, so updates to products in
+// different shards run in parallel and never wait for each other.
+const int LOCK_SHARDS = 64;
+const size_t SERVER_DEFAULT_WORKERS = 64;
+const size_t SERVER_READ_SIZE = 64 * 1024;
+
+class SharedInventory {
+private:
+    struct alignas(64) Shard {
+        shared_mutex lock;
+    };
+
+    ProductBST& products;
+    SupplierList& suppliers;
+    StockList& stocks;
+    Journal& journal;
+    shared_mutex structure;
+    Shard shards[LOCK_SHARDS];
+
+    shared_mutex& shardFor(int productID) {
+        return shards[(uint32_t)productID % LOCK_SHARDS].lock;
+    }
+
+    void requireProductAndSupplier(const Stock& s) {
+        if (!products.search(s.productID))
+            throw NotFoundException("Product ID not found: " + to_string(s.productID));
+        if (!suppliers.findSupplier(s.supplierID))
+            throw NotFoundException("Supplier ID not found: " + to_string(s.supplierID));
+    }
+
+    string stockDelta(const Stock& s) {
+        int quantity;
+        {
+            shared_lock<shared_mutex> shared(structure);
+            requireProductAndSupplier(s);
+            unique_lock<shared_mutex> shard(shardFor(s.productID));
+            requireQuantityInRange(stocks, s);
+            if (stocks.addToExisting(s, quantity)) {
+                journal.logStockDelta(s.productID, s.supplierID, s.quantity, quantity);
+                return "ok," + to_string(quantity);
+            }
+        }
+        // First stock of this pair: a new record
+        unique_lock<shared_mutex> exclusive(structure);
+        requireProductAndSupplier(s);
+        stocks.addStock(s);
+        quantity = stocks.findStock(s.productID, s.supplierID)->quantity;
+        journal.logStockDelta(s.productID, s.supplierID, s.quantity, quantity);
+        return "ok," + to_string(quantity);
+    }
+
+public:
+    SharedInventory(ProductBST& p, SupplierList& sup, StockList& st, Journal& j)
+        : products(p), suppliers(sup), stocks(st), journal(j) {}
+
+    // Runs one request and returns its response line (without the newline)
+    string execute(const BatchCommand& cmd) {
+        try {
+            switch (cmd.op) {
+                case BATCH_ADD_PRODUCT: {
+                    unique_lock<shared_mutex> exclusive(structure);
+                    products.insert(cmd.product);
+                    if (cmd.product.reorderLevel > 0)
+                        stocks.setReorderLevel(cmd.product.productID, cmd.product.reorderLevel);
+                    journal.logProductInsert(cmd.product);
+                    return "ok";
+                }
+                case BATCH_ADD_SUPPLIER: {
+                    unique_lock<shared_mutex> exclusive(structure);
+                    suppliers.addSupplier(cmd.supplier);
+                    journal.logSupplierAdd(cmd.supplier);
+                    return "ok";
+                }
+                case BATCH_STOCK_DELTA:
+                    return stockDelta(cmd.stock);
+                case BATCH_REMOVE_PRODUCT: {
+                    unique_lock<shared_mutex> exclusive(structure);
+                    return "ok," + to_string(removeProduct(cmd.id, cmd.cascade, products, stocks, journal));
+                }
+                case BATCH_QUERY_PRODUCT: {
+                    shared_lock<shared_mutex> shared(structure);
+                    Product* p = products.search(cmd.id);
+                    return p ? "product," + p->toString() : "notfound,product," + to_string(cmd.id);
+                }
+                case BATCH_QUERY_SUPPLIER: {
+                    shared_lock<shared_mutex> shared(structure);
+                    Supplier* s = suppliers.findSupplier(cmd.id);
+                    return s ? "supplier," + s->toString() : "notfound,supplier," + to_string(cmd.id);
+                }
+                case BATCH_QUERY_NAME: {
+                    {
+                        shared_lock<shared_mutex> shared(structure);
+                        if (products.nameIndex().ready()) return nameQueryResult(products, cmd);
+                    }
+                    // First name search: building the index changes the tree's state
+                    unique_lock<shared_mutex> exclusive(structure);
+                    products.ensureNameIndex();
+                    return nameQueryResult(products, cmd);
+                }
+                case BATCH_QUERY_STOCK: {
+                    shared_lock<shared_mutex> shared(structure);
+                    shared_lock<shared_mutex> shard(shardFor(cmd.stock.productID));
+                    Stock* s = stocks.findStock(cmd.stock.productID, cmd.stock.supplierID);
+                    return s ? "stock," + s->toString()
+                             : "notfound,stock," + to_string(cmd.stock.productID) + "," +
+                               to_string(cmd.stock.supplierID);
+                }
+            }
+        } catch (const exception& e) {
+            return string("error,") + e.what();
+        }
+        return "error,unknown command";
+    }
+
+    // Parses and runs one request line
+    string execute(const char* begin, const char* end) {
+        BatchCommand cmd;
+        const char* error = nullptr;
+        if (!parseBatchCommand(begin, end, cmd, error, products.textArena(), suppliers.textArena()))
+            return string("error,") + error;
+        return execute(cmd);
+    }
+};
+
+#ifndef _WIN32
+
+atomic<bool> serverStopRequested(false);
+
+void requestServerStop(int) {
+    serverStopRequested = true;
+}
+
+// Writes all of data, retrying short writes
+bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = ::write(fd, data, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// Any number of terminals may stay connected. The accept thread polls the
+// listening socket and every idle connection; a connection with input is
+// handed to a worker, which answers everything that has arrived and gives
+// it back through a wake-up pipe. Workers bound how many requests run at
+// once, not how many terminals are connected, and one connection is never
+// served by two workers at a time, so its replies stay in order.
+class InventoryServer {
+private:
+    struct Connection {
+        int fd;
+        string pendingLine;    // a request line split across reads
+        bool open;             // false once the client closed or failed
+    };
+
+    SharedInventory& inventory;
+    string path;
+    int listenFd;
+    int wakeFds[2];    // workers write a byte when they give a connection back
+    vector<thread> workers;
+    deque<Connection*> ready;       // connections with input, waiting for a worker
+    deque<Connection*> finished;    // served, waiting to be polled again
+    mutex queueMutex;               // guards ready and finished
+    condition_variable clientReady;
+    atomic<long long> requests;
+
+    // Answers whatever has arrived on the connection
+    void serveClient(Connection& c) {
+        char input[SERVER_READ_SIZE];
+        ssize_t n;
+        do {
+            n = ::read(c.fd, input, sizeof(input));
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            c.open = false;
+            return;
+        }
+
+        string replies;
+        const char* p = input;
+        const char* end = p + n;
+        while (p < end) {
+            const char* newline = (const char*)memchr(p, '\n', end - p);
+            if (!newline) {
+                c.pendingLine.append(p, end);
+                break;
+            }
+            const char* lineBegin = p;
+            const char* lineEnd = newline;
+            if (!c.pendingLine.empty()) {
+                c.pendingLine.append(p, newline);
+                lineBegin = c.pendingLine.data();
+                lineEnd = lineBegin + c.pendingLine.size();
+            }
+            if (lineEnd > lineBegin && lineEnd[-1] == '\r') --lineEnd;
+            if (lineEnd > lineBegin) {
+                replies += inventory.execute(lineBegin, lineEnd);
+                replies += '\n';
+                requests++;
+            }
+            c.pendingLine.clear();
+            p = newline + 1;
+        }
+        if (!replies.empty() && !writeAll(c.fd, replies.data(), replies.size())) c.open = false;
+    }
+
+    void workerLoop() {
+        while (true) {
+            Connection* c;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                clientReady.wait_for(lock, chrono::milliseconds(200),
+                                     [this] { return serverStopRequested || !ready.empty(); });
+                if (ready.empty()) {
+                    if (serverStopRequested) return;
+                    continue;
+                }
+                c = ready.front();
+                ready.pop_front();
+            }
+            serveClient(*c);
+            {
+                lock_guard<mutex> lock(queueMutex);
+                finished.push_back(c);
+            }
+            char wake = 1;
+            ssize_t ignored = ::write(wakeFds[1], &wake, 1);
+            (void)ignored;    // a full pipe already holds a wake-up
+        }
+    }
+
+public:
+    InventoryServer(SharedInventory& inv, const string& socketPath)
+        : inventory(inv), path(socketPath), listenFd(-1), wakeFds{-1, -1}, requests(0) {}
+
+    ~InventoryServer() {
+        if (listenFd >= 0) {
+            ::close(listenFd);
+            ::unlink(path.c_str());
+        }
+        for (int fd : wakeFds)
+            if (fd >= 0) ::close(fd);
+    }
+
+    // Serves until SIGINT or SIGTERM
+    void run(size_t workerCount) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+            throw FileException("Socket path too long: " + path);
+        strcpy(address.sun_path, path.c_str());
+
+        ::unlink(path.c_str());
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0 || ::bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 ||
+            listen(listenFd, 128) != 0)
+            throw FileException("Cannot listen on " + path + ": " + strerror(errno));
+        if (pipe(wakeFds) != 0)
+            throw FileException(string("Cannot create the server's wake-up pipe: ") + strerror(errno));
+        for (int fd : wakeFds) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, requestServerStop);
+        signal(SIGTERM, requestServerStop);
+        for (size_t i = 0; i < workerCount; ++i)
+            workers.emplace_back(&InventoryServer::workerLoop, this);
+        cout << "Serving on " << path << " with " << workerCount << " workers (Ctrl+C to stop)." << endl;
+
+        unordered_map<int, unique_ptr<Connection>> connections;
+        vector<Connection*> idle;
+        vector<pollfd> polled;
+        while (!serverStopRequested) {
+            polled.clear();
+            polled.push_back(pollfd{listenFd, POLLIN, 0});
+            polled.push_back(pollfd{wakeFds[0], POLLIN, 0});
+            for (Connection* c : idle) polled.push_back(pollfd{c->fd, POLLIN, 0});
+            if (poll(polled.data(), polled.size(), 200) <= 0) continue;
+
+            // Connections with input (or a hangup) go to the workers
+            vector<Connection*> stillIdle;
+            size_t dispatched = 0;
+            {
+                lock_guard<mutex> lock(queueMutex);
+                for (size_t i = 0; i < idle.size(); ++i) {
+                    if (polled[i + 2].revents) {
+                        ready.push_back(idle[i]);
+                        dispatched++;
+                    } else {
+                        stillIdle.push_back(idle[i]);
+                    }
+                }
+            }
+            idle.swap(stillIdle);
+            for (size_t i = 0; i < dispatched; ++i) clientReady.notify_one();
+
+            // Served connections are polled again, or closed
+            if (polled[1].revents) {
+                char drain[256];
+                while (::read(wakeFds[0], drain, sizeof(drain)) > 0) {}
+                deque<Connection*> done;
+                {
+                    lock_guard<mutex> lock(queueMutex);
+                    done.swap(finished);
+                }
+                for (Connection* c : done) {
+                    if (c->open) {
+                        idle.push_back(c);
+                    } else {
+                        ::close(c->fd);
+                        connections.erase(c->fd);
+                    }
+                }
+            }
+
+            if (polled[0].revents) {
+                int client = accept(listenFd, nullptr, nullptr);
+                if (client >= 0) {
+                    Connection* c = new Connection{client, string(), true};
+                    connections[client].reset(c);
+                    idle.push_back(c);
+                }
+            }
+        }
+
+        clientReady.notify_all();
+        for (thread& t : workers) t.join();
+        for (auto& entry : connections) ::close(entry.first);
+        cout << "Server stopped after " << requests.load() << " requests." << endl;
+    }
+};
+
+// --------- Load Generator ---------
+// Opens one connection per client thread and sends a mix of stock updates
+// (80%) and stock queries (20%), one request at a time, timing each round
+// trip. It works on its own products (IDs from LOADGEN_BASE_ID) and
+// supplier LOADGEN_BASE_ID, creates them first and removes the products
+// again at the end. Runs once per thread count and prints throughput and
+// latency percentiles for each.
+const int LOADGEN_BASE_ID = 900000000;
+const int LOADGEN_PRODUCTS = 1024;
+
+class LineClient {
+private:
+    int fd;
+    string buffer;
+
+public:
+    explicit LineClient(const string& path) : fd(-1) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+            throw FileException("Socket path too long: " + path);
+        strcpy(address.sun_path, path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            if (fd >= 0) ::close(fd);
+            throw FileException("Cannot connect to " + path + ": " + strerror(errno));
+        }
+    }
+
+    ~LineClient() {
+        ::close(fd);
+    }
+
+    LineClient(const LineClient&) = delete;
+    LineClient& operator=(const LineClient&) = delete;
+
+    // Sends one request line and waits for its response line
+    string request(const string& line) {
+        string message = line + "\n";
+        if (!writeAll(fd, message.data(), message.size()))
+            throw FileException("Connection lost");
+        size_t newline;
+        while ((newline = buffer.find('\n')) == string::npos) {
+            char chunk[4096];
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw FileException("Connection lost");
+            buffer.append(chunk, (size_t)n);
+        }
+        string response = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        return response;
+    }
+};
+
+int runLoadGenerator(const string& path, const vector<int>& threadCounts, long long requestsPerThread) {
+    signal(SIGPIPE, SIG_IGN);
+    try {
+        LineClient setup(path);
+        setup.request("supplier," + to_string(LOADGEN_BASE_ID) + ",Load Generator,-");
+        for (int i = 0; i < LOADGEN_PRODUCTS; ++i) {
+            int id = LOADGEN_BASE_ID + i;
+            setup.request("product," + to_string(id) + ",Load Test " + to_string(i) + ",1,LoadTest");
+            setup.request("stock," + to_string(id) + "," + to_string(LOADGEN_BASE_ID) + ",0");
+        }
+
+        cout << "threads  requests/s   p50 (us)   p99 (us)   max (us)\n";
+        for (int threads : threadCounts) {
+            vector<vector<float>> latencies(threads);
+            atomic<long long> failures(0);
+            auto started = chrono::steady_clock::now();
+            vector<thread> clients;
+            for (int t = 0; t < threads; ++t) {
+                clients.emplace_back([&, t] {
+                    try {
+                        LineClient client(path);
+                        uint64_t state = 0x9E3779B97F4A7C15ULL * (t + 1);
+                        latencies[t].reserve((size_t)requestsPerThread);
+                        for (long long r = 0; r < requestsPerThread; ++r) {
+                            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                            int id = LOADGEN_BASE_ID + (int)((state >> 33) % LOADGEN_PRODUCTS);
+                            string line = (state >> 20) % 5 == 0
+                                ? "query,stock," + to_string(id) + "," + to_string(LOADGEN_BASE_ID)
+                                : "stock," + to_string(id) + "," + to_string(LOADGEN_BASE_ID) + (r % 2 ? ",-1" : ",1");
+                            auto sent = chrono::steady_clock::now();
+                            string response = client.request(line);
+                            latencies[t].push_back(
+                                chrono::duration<float, micro>(chrono::steady_clock::now() - sent).count());
+                            if (response.compare(0, 5, "error") == 0) failures++;
+                        }
+                    } catch (const exception&) {
+                        failures++;
+                    }
+                });
+            }
+            for (thread& c : clients) c.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+            vector<float> all;
+            for (const vector<float>& l : latencies) all.insert(all.end(), l.begin(), l.end());
+            if (all.empty()) throw FileException("No requests completed");
+            auto percentile = [&all](double q) {
+                size_t k = min(all.size() - 1, (size_t)(q * all.size()));
+                nth_element(all.begin(), all.begin() + k, all.end());
+                return all[k];
+            };
+            float p50 = percentile(0.50), p99 = percentile(0.99);
+            float worst = *max_element(all.begin(), all.end());
+            char row[128];
+            snprintf(row, sizeof(row), "%7d %11.0f %10.1f %10.1f %10.1f", threads, all.size() / seconds, p50, p99, worst);
+            cout << row;
+            if (failures > 0) cout << "   (" << failures.load() << " failed)";
+            cout << endl;
+        }
+
+        for (int i = 0; i < LOADGEN_PRODUCTS; ++i)
+            setup.request("remove," + to_string(LOADGEN_BASE_ID + i) + ",cascade");
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << "\n";
+        return 1;
     }
+    return 0;
 }
 
-// Merge Sort for Stocks by quantity (descending)
-void merge(Stock* arr[], int l, int m, int r) {
-    int n1 = m - l + 1;
-    int n2 = r - m;
+#endif
 
-    Stock* L[n1];
-    Stock* R[n2];
+// --------- Dataset Generator ---------
+// Synthetic inventories for benchmarks: n products with IDs 1..n,
+// max(10, n / 100) suppliers and n stock records (distinct product-supplier
+// pairs). The key distribution decides the record order and which keys
+// lookups ask for:
+//
+//   sorted  records and lookups in ascending ID order
+//   random  records shuffled, lookups uniform over the keys
+//   zipf    records shuffled, lookups and stocked products Zipf-skewed
+//           (exponent ZIPF_EXPONENT), so a few keys get most of the traffic
+enum KeyDistribution {
+    KEYS_SORTED,
+    KEYS_RANDOM,
+    KEYS_ZIPF
+};
 
-    for (int i = 0; i < n1; i++) L[i] = arr[l + i];
-    for (int j = 0; j < n2; j++) R[j] = arr[m + 1 + j];
+const char* const KEY_DISTRIBUTION_NAMES[] = {"sorted", "random", "zipf"};
+const double ZIPF_EXPONENT = 0.99;
+const size_t BENCH_MAX_LOOKUPS = 1000000;
 
-    int i=0, j=0, k=l;
-    while (i < n1 && j < n2) {
-        if (L[i]->quantity >= R[j]->quantity) {
-            arr[k++] = L[i++];
-        } else {
-            arr[k++] = R[j++];
+bool parseKeyDistribution(const string& name, KeyDistribution& dist) {
+    for (int d = KEYS_SORTED; d <= KEYS_ZIPF; ++d) {
+        if (name == KEY_DISTRIBUTION_NAMES[d]) {
+            dist = (KeyDistribution)d;
+            return true;
         }
     }
-    while (i < n1) arr[k++] = L[i++];
-    while (j < n2) arr[k++] = R[j++];
+    return false;
 }
 
-void mergeSortStocks(Stock* arr[], int l, int r) {
-    if (l < r) {
-        int m = l + (r-l)/2;
-        mergeSortStocks(arr, l, m);
-        mergeSortStocks(arr, m+1, r);
-        merge(arr, l, m, r);
-    }
+// A record count such as 5000, 100K or 10M
+bool parseRecordCount(const string& text, size_t& n) {
+    if (text.empty()) return false;
+    size_t scale = 1;
+    string digits = text;
+    char suffix = text.back();
+    if (suffix == 'k' || suffix == 'K') scale = 1000;
+    if (suffix == 'm' || suffix == 'M') scale = 1000000;
+    if (scale != 1) digits.pop_back();
+    int value;
+    if (!parseIntField(digits.data(), digits.data() + digits.size(), value) || value <= 0) return false;
+    n = (size_t)value * scale;
+    return true;
 }
 
-// --------- Searching Functions ---------
+// Draws ranks 1..n with P(k) proportional to 1 / k^s by rejection-inversion
+// (Hormann and Derflinger), in O(1) per draw and without tables
+class ZipfGenerator {
+private:
+    double n;
+    double s;
+    double hIntegralX1;
+    double hIntegralN;
+    double threshold;
 
-// Linear Search for Product by productID in array
-int linearSearchProduct(Product* arr[], int n, int productID) {
-    for (int i=0; i<n; i++) {
-        if (arr[i]->productID == productID) return i;
+    static double helper1(double x) {
+        return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
     }
-    return -1;
-}
 
-// Binary Search for Product by productID in sorted array
-int binarySearchProduct(Product* arr[], int n, int productID) {
-    int low = 0, high = n -1;
-    while (low <= high) {
-        int mid = low + (high - low)/2;
-        if (arr[mid]->productID == productID)
-            return mid;
-        else if (arr[mid]->productID < productID)
-            low = mid + 1;
-        else
-            high = mid -1;
+    static double helper2(double x) {
+        return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
     }
-    return -1;
-}
 
-// Linear Search for Supplier by supplierID in array
-int linearSearchSupplier(Supplier* arr[], int n, int supplierID) {
-    for (int i=0; i<n; i++) {
-        if (arr[i]->supplierID == supplierID) return i;
+    double h(double x) const {
+        return exp(-s * log(x));
     }
-    return -1;
-}
 
-// Binary Search for Supplier by supplierID in sorted array
-int binarySearchSupplier(Supplier* arr[], int n, int supplierID) {
-    int low = 0, high = n -1;
-    while (low <= high) {
-        int mid = low + (high - low)/2;
-        if (arr[mid]->supplierID == supplierID)
-            return mid;
-        else if (arr[mid]->supplierID < supplierID)
-            low = mid + 1;
-        else
-            high = mid -1;
+    double hIntegral(double x) const {
+        double logX = log(x);
+        return helper2((1 - s) * logX) * logX;
     }
-    return -1;
-}
 
-// --------- File Handling ---------
+    double hIntegralInverse(double x) const {
+        double t = max(-1.0, x * (1 - s));
+        return exp(helper1(t) * x);
+    }
 
-void saveProductsToFile(ProductBST& bst, const string& filename) {
-    ofstream ofs(filename);
-    if (!ofs)
-        throw FileException("Cannot open products file for writing.");
+public:
+    ZipfGenerator(size_t count, double exponent) : n((double)count), s(exponent) {
+        hIntegralX1 = hIntegral(1.5) - 1;
+        hIntegralN = hIntegral(n + 0.5);
+        threshold = 2 - hIntegralInverse(hIntegral(2.5) - h(2));
+    }
+
+    template <typename Rng>
+    size_t operator()(Rng& rng) {
+        uniform_real_distribution<double> uniform(0.0, 1.0);
+        while (true) {
+            double u = hIntegralN + uniform(rng) * (hIntegralX1 - hIntegralN);
+            double x = hIntegralInverse(u);
+            double k = min(n, max(1.0, floor(x + 0.5)));
+            if (k - x <= threshold || u >= hIntegral(k + 0.5) - h(k))
+                return (size_t)k;
+        }
+    }
+};
 
-    int count = bst.getCount();
-    Product* products[count];
-    int n = bst.getAllProducts(products, count);
+struct BenchDataset {
+    KeyDistribution distribution;
+    vector<Product> products;      // in file (and insert) order
+    vector<Supplier> suppliers;
+    vector<Stock> stocks;
+    vector<int> productProbes;     // product IDs to look up
+    vector<int> supplierProbes;
+    vector<Stock> stockProbes;     // deltas to existing stock records
+};
 
-    for (int i=0; i<n; i++) {
-        ofs << products[i]->toString() << "\n";
+// Indices 0..count-1 drawn by the distribution: in order, uniformly, or by
+// Zipf rank (rank k is the k-th element, and the elements are shuffled)
+vector<size_t> drawIndices(size_t draws, size_t count, KeyDistribution dist, mt19937_64& rng) {
+    vector<size_t> result(draws);
+    if (dist == KEYS_SORTED) {
+        for (size_t i = 0; i < draws; ++i) result[i] = i % count;
+    } else if (dist == KEYS_RANDOM) {
+        uniform_int_distribution<size_t> uniform(0, count - 1);
+        for (size_t& r : result) r = uniform(rng);
+    } else {
+        ZipfGenerator zipf(count, ZIPF_EXPONENT);
+        for (size_t& r : result) r = zipf(rng) - 1;
     }
-    ofs.close();
+    return result;
 }
 
-void loadProductsFromFile(ProductBST& bst, const string& filename) {
-    ifstream ifs(filename);
-    if (!ifs) throw FileException("Cannot open products file for reading.");
+BenchDataset generateDataset(size_t n, KeyDistribution dist, uint64_t seed) {
+    mt19937_64 rng(seed);
+    BenchDataset data;
+    data.distribution = dist;
 
-    string line;
-    while (getline(ifs, line)) {
-        if (line.empty()) continue;
-        Product p = Product::fromString(line);
-        try {
-            bst.insert(p);
-        } catch (const DuplicateIDException& e) {
-            cout << "Warning: " << e.what() << endl;
+    uniform_int_distribution<int> cents(50, 50000);
+    data.products.reserve(n);
+    for (size_t i = 1; i <= n; ++i)
+        data.products.emplace_back((int)i, "Product" + to_string(i), cents(rng) / 100.0,
+                                   "Category" + to_string(i % 50));
+    size_t supplierCount = max<size_t>(10, n / 100);
+    data.suppliers.reserve(supplierCount);
+    for (size_t i = 1; i <= supplierCount; ++i)
+        data.suppliers.emplace_back((int)i, "Supplier" + to_string(i), "supplier" + to_string(i) + "@example.com");
+
+    // Stocked products follow the distribution; a pair that is already
+    // taken is replaced by a uniform one so all n pairs stay distinct
+    uniform_int_distribution<size_t> anyProduct(1, n);
+    uniform_int_distribution<size_t> anySupplier(1, supplierCount);
+    uniform_int_distribution<int> quantity(0, 500);
+    vector<size_t> stocked = drawIndices(n, n, dist, rng);
+    HashIndex<char> taken;
+    taken.reserve(n);
+    data.stocks.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        int productID = (int)stocked[i] + 1;
+        int supplierID = dist == KEYS_SORTED ? (int)(i % supplierCount) + 1 : (int)anySupplier(rng);
+        while (!taken.insert(stockKey(productID, supplierID), 1)) {
+            productID = (int)anyProduct(rng);
+            supplierID = (int)anySupplier(rng);
         }
+        data.stocks.emplace_back(productID, supplierID, quantity(rng));
+    }
+    if (dist == KEYS_SORTED) {
+        sort(data.stocks.begin(), data.stocks.end(), [](const Stock& a, const Stock& b) {
+            return stockKey(a.productID, a.supplierID) < stockKey(b.productID, b.supplierID);
+        });
+    } else {
+        shuffle(data.products.begin(), data.products.end(), rng);
+        shuffle(data.suppliers.begin(), data.suppliers.end(), rng);
+        shuffle(data.stocks.begin(), data.stocks.end(), rng);
     }
-    ifs.close();
+
+    size_t lookups = min(n, BENCH_MAX_LOOKUPS);
+    uniform_int_distribution<int> delta(-5, 5);
+    for (size_t i : drawIndices(lookups, n, dist, rng))
+        data.productProbes.push_back(data.products[i].productID);
+    for (size_t i : drawIndices(lookups, supplierCount, dist, rng))
+        data.supplierProbes.push_back(data.suppliers[i].supplierID);
+    for (size_t i : drawIndices(lookups, n, dist, rng))
+        data.stockProbes.emplace_back(data.stocks[i].productID, data.stocks[i].supplierID, delta(rng));
+    return data;
 }
 
-void saveSuppliersToFile(SupplierList& list, const string& filename) {
-    ofstream ofs(filename);
-    if (!ofs)
-        throw FileException("Cannot open suppliers file for writing.");
+template <typename Record>
+vector<const Record*> recordPointers(const vector<Record>& records) {
+    vector<const Record*> rows;
+    rows.reserve(records.size());
+    for (const Record& r : records) rows.push_back(&r);
+    return rows;
+}
+
+// Writes products.txt, suppliers.txt and stocks.txt into dir
+void writeDataset(const BenchDataset& data, const string& dir) {
+    filesystem::create_directories(dir);
+    ThreadPool& pool = sharedThreadPool();
+    writeRecordsFile(recordPointers(data.products), dir + "/products.txt", "products", &pool);
+    writeRecordsFile(recordPointers(data.suppliers), dir + "/suppliers.txt", "suppliers", &pool);
+    writeRecordsFile(recordPointers(data.stocks), dir + "/stocks.txt", "stocks", &pool);
+}
 
-    int count = list.count();
-    Supplier* suppliers[count];
-    int n = list.getAllSuppliers(suppliers, count);
+// --------- Benchmarks ---------
+// Times the core operations on generated datasets. Each result is one JSON
+// line (benchmark, distribution, size, ops, seconds, ops_per_sec and
+// p50/p90/p99/max latency in nanoseconds), so runs can be diffed or
+// plotted to catch regressions. Per-record operations are timed one call
+// at a time; sorts, saves and loads are whole-table operations repeated
+// BENCH_REPEATS times. Bubble sort is only run up to BENCH_QUADRATIC_MAX
+// records and linear search is limited to about BENCH_LINEAR_WORK
+// comparisons per benchmark. save_stocks_changed saves after
+// BENCH_CHANGED_RECORDS stock updates, the cost of an incremental save;
+// the *_stocks_compressed entries use the compressed segment format.
+// Name searches run BENCH_NAME_QUERIES prefix and substring queries cut
+// from the names of looked-up products.
+const int BENCH_REPEATS = 3;
+const size_t BENCH_CHANGED_RECORDS = 16;
+const size_t BENCH_NAME_QUERIES = 10000;
+const size_t BENCH_QUADRATIC_MAX = 20000;
+const size_t BENCH_LINEAR_WORK = 200000000;
 
-    for (int i=0; i<n; i++) {
-        ofs << suppliers[i]->toString() << "\n";
+volatile uintptr_t benchSink;    // keeps timed lookups from being optimized away
+
+class BenchRecorder {
+private:
+    OutBuffer& out;
+    bool echo;
+    const char* distribution;
+    size_t size;
+    vector<long long> samples;
+
+    long long percentile(double p) {
+        size_t k = min(samples.size() - 1, (size_t)(p * (double)samples.size()));
+        nth_element(samples.begin(), samples.begin() + (ptrdiff_t)k, samples.end());
+        return samples[k];
     }
-    ofs.close();
-}
 
-void loadSuppliersFromFile(SupplierList& list, const string& filename) {
-    ifstream ifs(filename);
-    if (!ifs) throw FileException("Cannot open suppliers file for reading.");
+    void begin(const char* benchmark) {
+        out << "{\"benchmark\":\"" << benchmark << "\",\"distribution\":\"" << distribution
+            << "\",\"size\":" << (long long)size;
+    }
 
-    string line;
-    while (getline(ifs, line)) {
-        if (line.empty()) continue;
-        Supplier s = Supplier::fromString(line);
-        try {
-            list.addSupplier(s);
-        } catch (const DuplicateIDException& e) {
-            cout << "Warning: " << e.what() << endl;
+public:
+    // With echo set, a readable line per result also goes to stderr
+    BenchRecorder(OutBuffer& o, bool echoResults) : out(o), echo(echoResults), distribution(""), size(0) {}
+
+    void setDataset(KeyDistribution dist, size_t n) {
+        distribution = KEY_DISTRIBUTION_NAMES[dist];
+        size = n;
+    }
+
+    // Calls op(0) .. op(ops - 1), timing each call
+    template <typename Op>
+    void measure(const char* benchmark, size_t ops, Op op) {
+        if (ops == 0) return;
+        samples.assign(ops, 0);
+        auto started = chrono::steady_clock::now();
+        for (size_t i = 0; i < ops; ++i) {
+            auto t0 = chrono::steady_clock::now();
+            op(i);
+            samples[i] = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count();
         }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        double opsPerSec = seconds > 0 ? (double)ops / seconds : 0;
+        long long p50 = percentile(0.50), p90 = percentile(0.90), p99 = percentile(0.99);
+        long long worst = *max_element(samples.begin(), samples.end());
+
+        begin(benchmark);
+        out << ",\"ops\":" << (long long)ops << ",\"seconds\":" << seconds << ",\"ops_per_sec\":" << (long long)opsPerSec
+            << ",\"p50_ns\":" << p50 << ",\"p90_ns\":" << p90 << ",\"p99_ns\":" << p99 << ",\"max_ns\":" << worst
+            << "}\n";
+        if (echo)
+            cerr << "  " << benchmark << " (" << distribution << ", " << size << "): " << (long long)opsPerSec
+                 << " ops/sec, p50 " << p50 << " ns, p99 " << p99 << " ns\n";
     }
-    ifs.close();
-}
 
-void saveStocksToFile(StockList& list, const string& filename) {
-    ofstream ofs(filename);
-    if (!ofs)
-        throw FileException("Cannot open stocks file for writing.");
+    void skip(const char* benchmark, const char* reason) {
+        begin(benchmark);
+        out << ",\"skipped\":\"" << reason << "\"}\n";
+    }
+};
 
-    int count = list.count();
-    Stock* stocks[count];
-    int n = list.getAllStocks(stocks, count);
+void runBenchmarks(const BenchDataset& data, BenchRecorder& bench, const string& workDir) {
+    ThreadPool& pool = sharedThreadPool();
+    size_t n = data.products.size();
+    size_t lookups = data.productProbes.size();
+    bench.setDataset(data.distribution, n);
 
-    for (int i=0; i<n; i++) {
-        ofs << stocks[i]->toString() << "\n";
+    ProductBST products;
+    bench.measure("product_insert", n, [&](size_t i) { products.insert(data.products[i]); });
+    bench.measure("product_search", lookups, [&](size_t i) {
+        benchSink = (uintptr_t)products.search(data.productProbes[i]);
+    });
+
+    SupplierList suppliers;
+    bench.measure("supplier_add", data.suppliers.size(), [&](size_t i) { suppliers.addSupplier(data.suppliers[i]); });
+    bench.measure("supplier_find", lookups, [&](size_t i) {
+        benchSink = (uintptr_t)suppliers.findSupplier(data.supplierProbes[i]);
+    });
+
+    StockList stocks;
+    bench.measure("stock_add_new", n, [&](size_t i) { stocks.addStock(data.stocks[i]); });
+    bench.measure("stock_add_existing", lookups, [&](size_t i) { stocks.addStock(data.stockProbes[i]); });
+
+    // Searches over the ID-sorted arrays the menu builds
+    vector<Product*> productArray(n);
+    productArray.resize(products.getAllProducts(productArray.data(), (int)n));
+    vector<Supplier*> supplierArray(suppliers.count());
+    supplierArray.resize(suppliers.getAllSuppliers(supplierArray.data(), (int)supplierArray.size()));
+    sort(supplierArray.begin(), supplierArray.end(),
+         [](const Supplier* a, const Supplier* b) { return a->supplierID < b->supplierID; });
+    int productCount = (int)productArray.size();
+    int supplierCount = (int)supplierArray.size();
+    size_t linearProductOps = min(lookups, max<size_t>(1, BENCH_LINEAR_WORK / n));
+    size_t linearSupplierOps = min(lookups, max<size_t>(1, BENCH_LINEAR_WORK / supplierArray.size()));
+    bench.measure("binary_search_product", lookups, [&](size_t i) {
+        benchSink = (uintptr_t)binarySearchProduct(productArray.data(), productCount, data.productProbes[i]);
+    });
+    bench.measure("linear_search_product", linearProductOps, [&](size_t i) {
+        benchSink = (uintptr_t)linearSearchProduct(productArray.data(), productCount, data.productProbes[i]);
+    });
+    bench.measure("binary_search_supplier", lookups, [&](size_t i) {
+        benchSink = (uintptr_t)binarySearchSupplier(supplierArray.data(), supplierCount, data.supplierProbes[i]);
+    });
+    bench.measure("linear_search_supplier", linearSupplierOps, [&](size_t i) {
+        benchSink = (uintptr_t)linearSearchSupplier(supplierArray.data(), supplierCount, data.supplierProbes[i]);
+    });
+
+    // Name searches: a name less its last two characters as a prefix, and
+    // four characters from near its end as a substring
+    vector<string> namePrefixes, nameParts;
+    for (size_t i = 0; i < lookups && namePrefixes.size() < BENCH_NAME_QUERIES; ++i) {
+        Product* p = products.search(data.productProbes[i]);
+        if (!p || p->name().size() < 6) continue;
+        string_view name = p->name();
+        namePrefixes.emplace_back(name.substr(0, name.size() - 2));
+        nameParts.emplace_back(name.substr(name.size() - 5, 4));
+    }
+    bench.measure("name_index_build", 1, [&](size_t) { products.ensureNameIndex(); });
+    bench.measure("name_search_prefix", namePrefixes.size(), [&](size_t i) {
+        benchSink = products.searchByName(namePrefixes[i], NAME_SEARCH_DEFAULT_LIMIT).size();
+    });
+    bench.measure("name_search_substring", nameParts.size(), [&](size_t i) {
+        benchSink = products.searchByName(nameParts[i], NAME_SEARCH_DEFAULT_LIMIT).size();
+    });
+
+    // Sorts start from the dataset's own record order each time
+    vector<Product*> unsortedProducts;
+    for (const Product& p : data.products) unsortedProducts.push_back(products.search(p.productID));
+    vector<Product*> productWork;
+    if (n <= BENCH_QUADRATIC_MAX) {
+        bench.measure("bubble_sort_products", BENCH_REPEATS, [&](size_t) {
+            productWork = unsortedProducts;
+            bubbleSortProducts(productWork.data(), (int)productWork.size());
+        });
+    } else {
+        bench.skip("bubble_sort_products", "quadratic; only run up to 20000 records");
+    }
+    vector<Stock*> stockArray(stocks.count());
+    stockArray.resize(stocks.getAllStocks(stockArray.data(), (int)stockArray.size()));
+    vector<Stock*> stockWork;
+    bench.measure("merge_sort_stocks", BENCH_REPEATS, [&](size_t) {
+        stockWork = stockArray;
+        mergeSortStocks(stockWork.data(), 0, (int)stockWork.size() - 1);
+    });
+
+    // Text files and the binary snapshot, in a scratch directory
+    const string productFile = workDir + "/products.txt";
+    const string supplierFile = workDir + "/suppliers.txt";
+    const string stockFile = workDir + "/stocks.txt";
+    const string snapshotFile = workDir + "/inventory.snap";
+    // Full saves: every segment counts as changed
+    bench.measure("save_products", BENCH_REPEATS, [&](size_t) {
+        products.changes().markAll();
+        saveProductsToFile(products, productFile, &pool);
+    });
+    bench.measure("save_suppliers", BENCH_REPEATS, [&](size_t) {
+        suppliers.changes().markAll();
+        saveSuppliersToFile(suppliers, supplierFile, &pool);
+    });
+    bench.measure("save_stocks", BENCH_REPEATS, [&](size_t) {
+        stocks.changes().markAll();
+        saveStocksToFile(stocks, stockFile, &pool);
+    });
+    // Incremental saves after a few stock updates rewrite only their segments
+    bench.measure("save_stocks_changed", BENCH_REPEATS, [&](size_t r) {
+        for (size_t i = 0; i < BENCH_CHANGED_RECORDS; ++i)
+            stocks.addStock(data.stockProbes[(r * BENCH_CHANGED_RECORDS + i) % lookups]);
+        saveStocksToFile(stocks, stockFile, &pool);
+    });
+    const string compressedStockFile = workDir + "/stocks_compressed.txt";
+    TableFormat savedFormat = storageFormat;
+    storageFormat = TABLE_COMPRESSED;
+    bench.measure("save_stocks_compressed", BENCH_REPEATS, [&](size_t) {
+        stocks.changes().markAll();
+        saveStocksToFile(stocks, compressedStockFile, &pool);
+    });
+    storageFormat = savedFormat;
+    bench.measure("save_snapshot", BENCH_REPEATS, [&](size_t) {
+        saveSnapshot(products, suppliers, stocks, snapshotFile);
+    });
+    bench.measure("load_products", BENCH_REPEATS, [&](size_t) {
+        ProductBST loaded;
+        loadProductsFromFile(loaded, productFile, &pool);
+    });
+    bench.measure("load_suppliers", BENCH_REPEATS, [&](size_t) {
+        SupplierList loaded;
+        loadSuppliersFromFile(loaded, supplierFile, &pool);
+    });
+    bench.measure("load_stocks", BENCH_REPEATS, [&](size_t) {
+        StockList loaded;
+        loadStocksFromFile(loaded, stockFile, &pool);
+    });
+    bench.measure("load_stocks_compressed", BENCH_REPEATS, [&](size_t) {
+        StockList loaded;
+        loadStocksFromFile(loaded, compressedStockFile, &pool);
+    });
+    bench.measure("load_snapshot", BENCH_REPEATS, [&](size_t) {
+        ProductBST loadedProducts;
+        SupplierList loadedSuppliers;
+        StockList loadedStocks;
+        loadSnapshot(loadedProducts, loadedSuppliers, loadedStocks, snapshotFile);
+    });
+
+    // Removal last: sorted datasets remove in ID order, the others shuffled
+    bench.measure("product_remove", n, [&](size_t i) { products.remove(data.products[i].productID); });
+}
+
+// Generates and benchmarks each size for each distribution. Returns the
+// process exit code.
+int runBenchmarkSuite(const vector<size_t>& sizes, const vector<KeyDistribution>& dists, const string& path) {
+    string workDir = (filesystem::temp_directory_path() /
+                      ("inventory-bench-" + to_string(chrono::steady_clock::now().time_since_epoch().count())))
+                         .string();
+    try {
+        filesystem::create_directories(workDir);
+        AsyncFileWriter out(path);
+        BenchRecorder bench(out, path != "-");
+        for (size_t n : sizes) {
+            for (KeyDistribution dist : dists) {
+                BenchDataset data = generateDataset(n, dist, n * 31 + dist);
+                runBenchmarks(data, bench, workDir);
+            }
+        }
+        out.close();
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << "\n";
+        filesystem::remove_all(workDir);
+        return 1;
     }
+    filesystem::remove_all(workDir);
+    return 0;
+}
+
+// --------- Metrics Dump ---------
+// Writes the metrics to a file, through a temporary file and a rename so a
+// scraper (e.g. the node_exporter textfile collector) never reads half of it
+void writeMetricsFile(const string& path) {
+    string text = renderMetrics();
+    string temp = path + ".tmp";
+    ofstream ofs(temp, ios::binary);
+    if (!ofs)
+        throw FileException("Cannot open " + temp + " for writing.");
+    ofs.write(text.data(), (streamsize)text.size());
     ofs.close();
+    if (!ofs)
+        throw FileException("Failed writing " + temp + ".");
+    replaceFile(temp, path);
 }
 
-void loadStocksFromFile(StockList& list, const string& filename) {
-    ifstream ifs(filename);
-    if (!ifs) throw FileException("Cannot open stocks file for reading.");
+const int METRICS_DUMP_INTERVAL_S = 10;
 
-    string line;
-    while (getline(ifs, line)) {
-        if (line.empty()) continue;
-        Stock s = Stock::fromString(line);
-        list.addStock(s);
+// Rewrites the metrics file every interval in the background, and once
+// more when destroyed so the file ends with the final numbers
+class MetricsDumper {
+private:
+    string path;
+    chrono::seconds interval;
+    mutex stopMutex;
+    condition_variable wake;
+    bool stopping;
+    bool reported;
+    thread worker;
+
+    void dump() {
+        try {
+            writeMetricsFile(path);
+        } catch (const exception& e) {
+            if (!reported) cerr << "Metrics dump: " << e.what() << "\n";
+            reported = true;
+        }
+    }
+
+    void loop() {
+        unique_lock<mutex> lock(stopMutex);
+        while (!wake.wait_for(lock, interval, [this] { return stopping; })) {
+            lock.unlock();
+            dump();
+            lock.lock();
+        }
+    }
+
+public:
+    MetricsDumper(const string& file, int seconds)
+        : path(file), interval(seconds), stopping(false), reported(false) {
+        worker = thread(&MetricsDumper::loop, this);
+    }
+
+    ~MetricsDumper() {
+        {
+            lock_guard<mutex> lock(stopMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+        dump();
     }
-    ifs.close();
-}
+
+    MetricsDumper(const MetricsDumper&) = delete;
+    MetricsDumper& operator=(const MetricsDumper&) = delete;
+};
 
 // --------- Menu & Interaction ---------
 
@@ -668,18 +7983,241 @@ void displayMainMenu() {
     cout << "11. Sort Stocks\n";
     cout << "12. Save All Data\n";
     cout << "13. Load All Data\n";
+    cout << "14. Save Binary Snapshot\n";
+    cout << "15. Load Binary Snapshot\n";
+    cout << "16. Compact Journal into Data Files\n";
+    cout << "17. Top-K Stocks by Quantity\n";
+    cout << "18. Stocks by Quantity Rank (page)\n";
+    cout << "19. Set Product Reorder Level\n";
+    cout << "20. Show Low-Stock Watchlist\n";
+    cout << "21. Export Data (CSV / JSON lines)\n";
+    cout << "22. Show Memory Usage\n";
+    cout << "23. Stock Analytics\n";
+    cout << "24. Products by Category\n";
+    cout << "25. List Categories\n";
+    cout << "26. Stock Drill-Down (by product or supplier)\n";
+    cout << "27. Inventory Valuation Report\n";
+    cout << "28. Show Metrics (Prometheus format)\n";
+    cout << "29. Search Products by Name\n";
     cout << "0. Exit\n";
     cout << "Enter your choice: ";
 }
 
-int main() {
+void printUsage(const char* program) {
+    cerr << "Usage: " << program << "                                      interactive menu\n"
+         << "       " << program << " --batch FILE|-                       run a command file or stdin\n"
+         << "       " << program << " --export TABLE csv|jsonl [FILE|-]    stream products, suppliers or stocks\n"
+         << "       " << program << " --serve [SOCKET] [WORKERS]           serve terminals on a Unix socket\n"
+         << "       " << program << " --loadgen SOCKET THREADS[,...] [N]   benchmark a running server\n"
+         << "       " << program << " --generate DIR SIZE [DIST] [SEED]    write a synthetic dataset\n"
+         << "       " << program << " --bench SIZE[,...] [DIST|all] [FILE|-]  benchmark core operations (JSON lines)\n"
+         << "       " << program << " --check-format                       round-trip check of the compressed format\n"
+         << "  SIZE is a record count such as 5000, 100K or 10M; DIST is sorted, random or zipf\n"
+         << "  Any mode: --metrics-file FILE [--metrics-interval SECONDS] keeps FILE updated with\n"
+         << "  Prometheus-format metrics (every " << METRICS_DUMP_INTERVAL_S << " s by default)\n"
+         << "  Any mode: --storage text|compressed converts the data files on the next save\n"
+         << "  (by default saves keep the format the files already use)\n";
+}
+
+int main(int argc, char* argv[]) {
+    // The storage and metrics options may accompany any mode; take them out first
+    string metricsFile;
+    int metricsInterval = METRICS_DUMP_INTERVAL_S;
+    vector<char*> args;
+    for (int i = 0; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--storage") {
+            string format = i + 1 < argc ? argv[i + 1] : "";
+            if (format != "text" && format != "compressed") {
+                printUsage(argv[0]);
+                return 1;
+            }
+            storageFormat = format == "text" ? TABLE_TEXT : TABLE_COMPRESSED;
+            i++;
+            continue;
+        }
+        if (arg == "--metrics-file" || arg == "--metrics-interval") {
+            if (i + 1 >= argc || (arg == "--metrics-interval" &&
+                                  (!parseIntField(argv[i + 1], argv[i + 1] + strlen(argv[i + 1]), metricsInterval) ||
+                                   metricsInterval <= 0))) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            if (arg == "--metrics-file") metricsFile = argv[i + 1];
+            i++;
+            continue;
+        }
+        args.push_back(argv[i]);
+    }
+    argc = (int)args.size();
+    argv = args.data();
+    unique_ptr<MetricsDumper> metricsDumper;
+    if (!metricsFile.empty())
+        metricsDumper.reset(new MetricsDumper(metricsFile, metricsInterval));
+
+    string batchSource, exportTableName, exportPath, serveSocket;
+    size_t serveWorkers = SERVER_DEFAULT_WORKERS;
+    ExportFormat exportFormat = EXPORT_CSV;
+    string mode = argc >= 2 ? argv[1] : "";
+    if (mode == "--batch")
+        batchSource = argc >= 3 ? argv[2] : "-";
+    else if (mode == "--export" && argc >= 4 && parseExportFormat(argv[3], exportFormat)) {
+        exportTableName = argv[2];
+        exportPath = argc >= 5 ? argv[4] : "-";
+    } else if (mode == "--serve") {
+        serveSocket = argc >= 3 ? argv[2] : "inventory.sock";
+        int workers;
+        if (argc >= 4 && parseIntField(argv[3], argv[3] + strlen(argv[3]), workers) && workers > 0)
+            serveWorkers = (size_t)workers;
+    } else if (mode == "--loadgen" && argc >= 4) {
+#ifndef _WIN32
+        vector<int> threadCounts;
+        const char* p = argv[3];
+        const char* end = p + strlen(p);
+        while (p < end) {
+            const char* countEnd = fieldEnd(p, end);
+            int count;
+            if (!parseIntField(p, countEnd, count) || count <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            threadCounts.push_back(count);
+            p = countEnd == end ? end : countEnd + 1;
+        }
+        int perThread = 10000;
+        if (argc >= 5 && (!parseIntField(argv[4], argv[4] + strlen(argv[4]), perThread) || perThread <= 0)) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        return runLoadGenerator(argv[2], threadCounts, perThread);
+#else
+        cerr << "The load generator needs Unix sockets and is not available on this platform.\n";
+        return 1;
+#endif
+    } else if (mode == "--generate" && argc >= 4) {
+        size_t n;
+        KeyDistribution dist = KEYS_RANDOM;
+        int seed = 1;
+        if (!parseRecordCount(argv[3], n) || (argc >= 5 && !parseKeyDistribution(argv[4], dist)) ||
+            (argc >= 6 && !parseIntField(argv[5], argv[5] + strlen(argv[5]), seed))) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        try {
+            writeDataset(generateDataset(n, dist, (uint64_t)seed), argv[2]);
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        cout << "Wrote " << n << " products and stock records (" << KEY_DISTRIBUTION_NAMES[dist] << ") to "
+             << argv[2] << "\n";
+        return 0;
+    } else if (mode == "--bench" && argc >= 3) {
+        vector<size_t> sizes;
+        const char* p = argv[2];
+        const char* end = p + strlen(p);
+        while (p < end) {
+            const char* sizeEnd = fieldEnd(p, end);
+            size_t n;
+            if (!parseRecordCount(string(p, sizeEnd), n)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            sizes.push_back(n);
+            p = sizeEnd == end ? end : sizeEnd + 1;
+        }
+        vector<KeyDistribution> dists = {KEYS_SORTED, KEYS_RANDOM, KEYS_ZIPF};
+        KeyDistribution dist;
+        if (argc >= 4 && string(argv[3]) != "all") {
+            if (!parseKeyDistribution(argv[3], dist)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            dists.assign(1, dist);
+        }
+        return runBenchmarkSuite(sizes, dists, argc >= 5 ? argv[4] : "-");
+    } else if (mode == "--check-format") {
+        return runFormatCheck();
+    } else if (argc >= 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
     ProductBST products;
     SupplierList suppliers;
     StockList stocks;
+    products.publishMetrics();
+    suppliers.publishMetrics();
+    stocks.publishMetrics();
 
     const string productFile = "products.txt";
     const string supplierFile = "suppliers.txt";
     const string stockFile = "stocks.txt";
+    const string snapshotFile = "inventory.snap";
+    const string journalFile = "inventory.journal";
+
+    // Every change is journaled; start from the data files plus the journal
+    // (an export may be going to stdout, so its load messages go to stderr)
+    Journal journal(journalFile, productFile, supplierFile, stockFile);
+    streambuf* coutBuffer = cout.rdbuf();
+    if (!exportTableName.empty()) cout.rdbuf(cerr.rdbuf());
+    try {
+        long long replayed = recoverInventory(products, suppliers, stocks,
+                                              productFile, supplierFile, stockFile, journal);
+        if (replayed > 0)
+            cout << "Recovered " << replayed << " journaled changes.\n";
+    } catch (const exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+    cout.rdbuf(coutBuffer);
+
+    if (!batchSource.empty())
+        return runBatch(batchSource, products, suppliers, stocks, journal);
+    if (!serveSocket.empty()) {
+#ifndef _WIN32
+        stocks.setLowStockListener([](const LowStockEvent& e) {
+            cout << (e.belowLevel ? "Alert: Product " : "Notice: Product ") << e.productID
+                 << (e.belowLevel ? " is below" : " is back above") << " its reorder level ("
+                 << e.total << " in stock, level " << e.reorderLevel << ")." << endl;
+        });
+        try {
+            SharedInventory inventory(products, suppliers, stocks, journal);
+            InventoryServer server(inventory, serveSocket);
+            server.run(serveWorkers);
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        try {
+            journal.commit();
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+#else
+        cerr << "Server mode needs Unix sockets and is not available on this platform.\n";
+        return 1;
+#endif
+    }
+    if (!exportTableName.empty()) {
+        try {
+            exportTable(exportTableName, exportFormat, exportPath, products, suppliers, stocks);
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    stocks.setLowStockListener([](const LowStockEvent& e) {
+        if (e.belowLevel)
+            cout << "Alert: Product " << e.productID << " is below its reorder level ("
+                 << e.total << " in stock, level " << e.reorderLevel << ").\n";
+        else
+            cout << "Notice: Product " << e.productID << " is back above its reorder level ("
+                 << e.total << " in stock, level " << e.reorderLevel << ").\n";
+    });
 
     bool running = true;
     while (running) {
@@ -688,6 +8226,14 @@ int main() {
         cin >> choice;
         cin.ignore(); // clear newline
 
+        // A background compaction (option 16, or one resumed at startup)
+        // reports here, at the first choice after it finishes
+        try {
+            if (journal.compactionFinished()) cout << "Journal compacted into data files.\n";
+        } catch (const exception& e) {
+            cout << "Error: " << e.what() << endl;
+        }
+
         try {
             switch (choice) {
                 case 1: {
@@ -699,7 +8245,9 @@ int main() {
                     cout << "Enter Product Price: "; cin >> price; cin.ignore();
                     cout << "Enter Product Category: "; getline(cin, category);
 
-                    products.insert(Product(id, name, price, category));
+                    Product p(id, name, price, category);
+                    products.insert(p);
+                    journal.logProductInsert(p);
                     cout << "Product added successfully.\n";
                     break;
                 }
@@ -724,8 +8272,22 @@ int main() {
                     cout << "Enter Product ID to remove: ";
                     cin >> id; cin.ignore();
 
-                    products.remove(id);
-                    cout << "Product removed successfully.\n";
+                    bool cascade = false;
+                    int degree = stocks.productDegree(id);
+                    if (degree > 0 && products.search(id)) {
+                        char answer;
+                        cout << "Product has " << degree << " stock records. Remove them too (y/n): ";
+                        cin >> answer; cin.ignore();
+                        if (answer != 'y' && answer != 'Y') {
+                            cout << "Product not removed.\n";
+                            break;
+                        }
+                        cascade = true;
+                    }
+                    int removed = removeProduct(id, cascade, products, stocks, journal);
+                    cout << "Product removed successfully";
+                    if (removed > 0) cout << " with " << removed << " stock records";
+                    cout << ".\n";
                     break;
                 }
                 case 5: {
@@ -735,7 +8297,9 @@ int main() {
                     cout << "Enter Supplier Name: "; getline(cin, name);
                     cout << "Enter Supplier Contact Info: "; getline(cin, contact);
 
-                    suppliers.addSupplier(Supplier(id, name, contact));
+                    Supplier s(id, name, contact);
+                    suppliers.addSupplier(s);
+                    journal.logSupplierAdd(s);
                     cout << "Supplier added successfully.\n";
                     break;
                 }
@@ -772,6 +8336,7 @@ int main() {
                     }
 
                     stocks.addStock(Stock(pID, sID, qty));
+                    journal.logStockDelta(pID, sID, qty, stocks.findStock(pID, sID)->quantity);
                     cout << "Stock added/updated successfully.\n";
                     break;
                 }
@@ -780,63 +8345,404 @@ int main() {
                     break;
 
                 case 10: {
-                    // Sort Products using bubble sort
+                    // Sort Products by ID (radix sort)
                     int n = products.getCount();
                     if (n == 0) {
                         cout << "No products to sort.\n";
                         break;
                     }
-                    Product* arr[n];
-                    products.getAllProducts(arr, n);
+                    vector<Product*> arr(n);
+                    products.getAllProducts(arr.data(), n);
 
-                    bubbleSortProducts(arr, n);
-                    cout << "--- Products Sorted by ID ---\n";
+                    sortProductsByID(arr.data(), n);
+                    StreamOut& out = console();
+                    out << "--- Products Sorted by ID ---\n";
                     for (int i=0; i<n; i++) {
-                        arr[i]->display();
+                        arr[i]->display(out);
                     }
-                    cout << "-----------------------------\n";
+                    out << "-----------------------------\n";
+                    out.flush();
                     break;
                 }
                 case 11: {
-                    // Sort Stocks by quantity (merge sort descending)
+                    // Sort Stocks by quantity (radix sort, descending)
                     int n = stocks.count();
                     if (n == 0) {
                         cout << "No stocks to sort.\n";
                         break;
                     }
-                    Stock* arr[n];
-                    stocks.getAllStocks(arr, n);
+                    vector<Stock*> arr(n);
+                    stocks.getAllStocks(arr.data(), n);
 
-                    mergeSortStocks(arr, 0, n-1);
-                    cout << "--- Stocks Sorted by Quantity ---\n";
+                    sortStocksByQuantity(arr.data(), n);
+                    StreamOut& out = console();
+                    out << "--- Stocks Sorted by Quantity ---\n";
                     for (int i=0; i<n; i++) {
-                        arr[i]->display();
+                        arr[i]->display(out);
                     }
-                    cout << "----------------------------------------\n";
+                    out << "----------------------------------------\n";
+                    out.flush();
                     break;
                 }
                 case 12: {
-                    // Save all data
-                    saveProductsToFile(products, productFile);
-                    saveSuppliersToFile(suppliers, supplierFile);
-                    saveStocksToFile(stocks, stockFile);
-                    cout << "Data saved successfully.\n";
+                    // Save all data: rewrite only the files whose records
+                    // changed, after which the journal is redundant
+                    journal.commit();
+                    journal.waitForCompaction();
+                    size_t files = saveAllParallel(products, suppliers, stocks, productFile, supplierFile,
+                                                   stockFile, sharedThreadPool());
+                    if (files > 0) journal.reset();
+                    cout << "Data saved successfully (" << files << " files written or removed).\n";
                     break;
                 }
                 case 13: {
-                    // Load all data
-                    products = ProductBST();   // clear existing
-                    suppliers = SupplierList();
-                    stocks = StockList();
+                    // Load all data (data files plus journal)
+                    recoverInventory(products, suppliers, stocks, productFile, supplierFile, stockFile, journal);
+                    cout << "Data loaded successfully.\n";
+                    break;
+                }
+                case 14: {
+                    // Save binary snapshot
+                    saveSnapshot(products, suppliers, stocks, snapshotFile);
+                    cout << "Snapshot saved to " << snapshotFile << ".\n";
+                    break;
+                }
+                case 15: {
+                    // Load binary snapshot into scratch stores first, so a
+                    // missing or damaged snapshot leaves the inventory as it is
+                    {
+                        ProductBST loadedProducts;
+                        SupplierList loadedSuppliers;
+                        StockList loadedStocks;
+                        loadSnapshot(loadedProducts, loadedSuppliers, loadedStocks, snapshotFile);
+                        replaceStores(products, suppliers, stocks, loadedProducts, loadedSuppliers, loadedStocks);
+                    }
+
+                    // The snapshot replaces the journaled state, so make it the new base
+                    journal.waitForCompaction();
+                    saveAllParallel(products, suppliers, stocks, productFile, supplierFile, stockFile,
+                                    sharedThreadPool());
+                    journal.reset();
+                    cout << "Snapshot loaded: " << products.getCount() << " products, "
+                         << suppliers.count() << " suppliers, " << stocks.count() << " stock records.\n";
+                    break;
+                }
+                case 16: {
+                    // Fold the journal into the data files in the background;
+                    // the outcome is reported once it is done (see above)
+                    if (journal.isCompacting()) {
+                        cout << "Journal compaction is already running.\n";
+                        break;
+                    }
+                    journal.startCompaction();
+                    cout << "Journal compaction started in the background.\n";
+                    break;
+                }
+                case 17: {
+                    // Highest or lowest K stock records
+                    char order; int k;
+                    cout << "Highest or lowest stock (h/l): "; cin >> order; cin.ignore();
+                    cout << "How many records: "; cin >> k; cin.ignore();
+                    bool highest = order != 'l' && order != 'L';
 
-                    loadProductsFromFile(products, productFile);
-                    loadSuppliersFromFile(suppliers, supplierFile);
-                    loadStocksFromFile(stocks, stockFile);
+                    vector<Stock*> top = stocks.topByQuantity(k > 0 ? k : 0, highest);
+                    if (top.empty()) {
+                        cout << "No stock records to display.\n";
+                        break;
+                    }
+                    StreamOut& out = console();
+                    out << "--- " << (highest ? "Highest" : "Lowest") << " " << (int)top.size() << " Stocks ---\n";
+                    for (Stock* s : top) s->display(out);
+                    out << "----------------------------------------\n";
+                    out.flush();
+                    break;
+                }
+                case 18: {
+                    // A page of the quantity ranking, e.g. ranks 1000-1100
+                    int from, to;
+                    cout << "From rank (1 = highest quantity): "; cin >> from; cin.ignore();
+                    cout << "To rank: "; cin >> to; cin.ignore();
+                    if (from < 1 || to < from) {
+                        cout << "Invalid rank range.\n";
+                        break;
+                    }
 
-                    cout << "Data loaded successfully.\n";
+                    vector<Stock*> page = stocks.rankByQuantity(from - 1, to - from + 1);
+                    StreamOut& out = console();
+                    out << "--- Stocks Ranked " << from << " to " << from - 1 + (int)page.size() << " ---\n";
+                    for (Stock* s : page) s->display(out);
+                    out << "----------------------------------------\n";
+                    out.flush();
+                    break;
+                }
+                case 19: {
+                    // Set reorder level (0 stops watching the product)
+                    int id, level;
+                    cout << "Enter Product ID: "; cin >> id; cin.ignore();
+                    Product* p = products.search(id);
+                    if (!p) {
+                        cout << "Product ID not found.\n";
+                        break;
+                    }
+                    cout << "Enter Reorder Level (0 to clear): "; cin >> level; cin.ignore();
+
+                    p->reorderLevel = level > 0 ? level : 0;
+                    products.markChanged(id);
+                    stocks.setReorderLevel(id, p->reorderLevel);
+                    journal.logProductInsert(*p);
+                    cout << "Reorder level updated.\n";
+                    break;
+                }
+                case 20: {
+                    // Products whose total stock is below their reorder level
+                    vector<int> low = stocks.lowStockProducts();
+                    if (low.empty()) {
+                        cout << "No products below their reorder level.\n";
+                        break;
+                    }
+                    StreamOut& out = console();
+                    out << "--- Low-Stock Watchlist ---\n";
+                    for (int id : low) {
+                        Product* p = products.search(id);
+                        out << "Product ID: " << id
+                            << ", Name: " << (p ? p->name() : string_view("(unknown)"))
+                            << ", In Stock: " << stocks.productTotal(id)
+                            << ", Reorder Level: " << stocks.reorderLevel(id) << '\n';
+                    }
+                    out << "---------------------------\n";
+                    out.flush();
+                    break;
+                }
+                case 21: {
+                    // Stream a table to a CSV or JSON-lines file
+                    string table, formatName, path;
+                    cout << "Table (products/suppliers/stocks): "; getline(cin, table);
+                    cout << "Format (csv/jsonl): "; getline(cin, formatName);
+                    cout << "Output file: "; getline(cin, path);
+                    ExportFormat format;
+                    if (!parseExportFormat(formatName, format)) {
+                        cout << "Unknown format.\n";
+                        break;
+                    }
+                    long long records = exportTable(table, format, path, products, suppliers, stocks);
+                    cout << "Exported " << records << " records to " << path << ".\n";
+                    break;
+                }
+                case 22: {
+                    // Node memory held by the pools
+                    auto row = [](const char* name, const PoolStats& st) {
+                        cout << name << st.live << " in use / " << st.capacity << " slots, "
+                             << st.bytes / 1024 << " KiB\n";
+                    };
+                    cout << "--- Node Memory ---\n";
+                    row("Product tree:    ", products.treeMemory());
+                    row("Suppliers:       ", suppliers.nodeMemory());
+                    row("Stock records:   ", stocks.nodeMemory());
+                    cout << "Text arenas:     " << TextChunks::instance().reservedBytes() / 1024 << " KiB ("
+                         << products.textArena().reservedBytes() / 1024 << " products, "
+                         << suppliers.textArena().reservedBytes() / 1024 << " suppliers), "
+                         << CategoryPool::instance().size() << " categories\n";
+                    const NameIndex& names = products.nameIndex();
+                    if (names.ready())
+                        cout << "Name index:      " << names.nodeCount() << " trie nodes, " << names.trigramCount()
+                             << " trigrams, " << names.bytes() / 1024 << " KiB\n";
+                    cout << "-------------------\n";
+                    break;
+                }
+                case 23: {
+                    // Aggregates over the columnar copy of the stock table
+                    int threshold;
+                    string supplierText;
+                    cout << "Quantity threshold (count records below it): "; cin >> threshold; cin.ignore();
+                    cout << "Supplier ID to filter on (blank for all): "; getline(cin, supplierText);
+                    optional<int> supplierID;
+                    if (!supplierText.empty()) {
+                        int id;
+                        if (!parseIntField(supplierText.data(), supplierText.data() + supplierText.size(), id)) {
+                            cout << "Invalid supplier ID.\n";
+                            break;
+                        }
+                        supplierID = id;
+                    }
+
+                    const StockColumns& table = stocks.columns();
+                    StreamOut& out = console();
+                    out << "--- Stock Analytics ---\n";
+                    out << "Records: " << (long long)table.size() << ", total units: " << table.totalUnits() << '\n';
+                    out << "Records with quantity < " << threshold;
+                    if (supplierID) out << " from supplier " << *supplierID;
+                    out << ": " << (long long)table.countBelow(threshold, supplierID) << '\n';
+                    if (supplierID)
+                        out << "Units from supplier " << *supplierID << ": " << table.supplierUnits(*supplierID) << '\n';
+                    out << "Units by supplier:\n";
+                    for (const auto& group : table.unitsBy(table.supplierIDs))
+                        out << "  Supplier ID: " << group.first << ", Units: " << group.second << '\n';
+                    out << "-----------------------\n";
+                    out.flush();
+                    break;
+                }
+                case 24: {
+                    // Category query joined to stock totals
+                    string category;
+                    char lowOnly;
+                    cout << "Enter Category: "; getline(cin, category);
+                    cout << "Only products below their reorder level (y/n): "; cin >> lowOnly; cin.ignore();
+
+                    const vector<int>* inCategory = products.categoryIndex().find(category);
+                    if (!inCategory || inCategory->empty()) {
+                        cout << "No products in that category.\n";
+                        break;
+                    }
+                    vector<int> ids = *inCategory;
+                    if (lowOnly == 'y' || lowOnly == 'Y') {
+                        vector<int> low = stocks.lowStockProducts();
+                        sort(low.begin(), low.end());
+                        ids = intersectSorted(ids, low);
+                    }
+
+                    StreamOut& out = console();
+                    out << "--- Category: " << category << " (" << (int)ids.size() << " products) ---\n";
+                    long long units = 0;
+                    for (int id : ids) {
+                        Product* p = products.search(id);
+                        long long total = stocks.productTotal(id);
+                        units += total;
+                        out << "Product ID: " << id << ", Name: " << p->name()
+                            << ", Price: $" << p->price << ", In Stock: " << total << '\n';
+                    }
+                    out << "Total units: " << units << '\n';
+                    out << "------------------------------\n";
+                    out.flush();
+                    break;
+                }
+                case 25: {
+                    // Categories with product counts
+                    vector<pair<string, size_t>> summary = products.categoryIndex().summary();
+                    if (summary.empty()) {
+                        cout << "No categories.\n";
+                        break;
+                    }
+                    StreamOut& out = console();
+                    out << "--- Categories ---\n";
+                    for (const auto& c : summary)
+                        out << c.first << ": " << (long long)c.second << " products\n";
+                    out << "------------------\n";
+                    out.flush();
+                    break;
+                }
+                case 26: {
+                    // Stock records of one product or one supplier
+                    char kind; int id;
+                    cout << "Drill down by product or supplier (p/s): "; cin >> kind; cin.ignore();
+                    cout << "Enter ID: "; cin >> id; cin.ignore();
+                    bool byProduct = kind != 's' && kind != 'S';
+
+                    vector<Stock*> rows = byProduct ? stocks.stocksForProduct(id) : stocks.stocksForSupplier(id);
+                    if (rows.empty()) {
+                        cout << "No stock records.\n";
+                        break;
+                    }
+                    StreamOut& out = console();
+                    out << "--- Stock of " << (byProduct ? "Product " : "Supplier ") << id
+                        << " (" << (int)rows.size() << " records) ---\n";
+                    long long units = 0;
+                    for (Stock* s : rows) {
+                        s->display(out);
+                        units += s->quantity;
+                    }
+                    out << "Total units: " << units << '\n';
+                    out << "----------------------------------------\n";
+                    out.flush();
+                    break;
+                }
+                case 27: {
+                    // Stock value (quantity x price) overall and by group
+                    auto started = chrono::steady_clock::now();
+                    ValuationReport report = valueInventory(products, stocks, sharedThreadPool());
+                    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+
+                    const size_t shown = 20;
+                    auto list = [shown](StreamOut& out, const char* title, const char* label,
+                                        const vector<ValuationGroup>& groups) {
+                        out << title << '\n';
+                        for (size_t i = 0; i < groups.size() && i < shown; ++i) {
+                            out << "  " << label;
+                            if (groups[i].name.empty()) out << groups[i].id;
+                            else out << groups[i].name;
+                            out << ", Units: " << groups[i].units << ", Value: $";
+                            out.fixed(groups[i].value, 2) << '\n';
+                        }
+                        if (groups.size() > shown)
+                            out << "  ... and " << (long long)(groups.size() - shown) << " more\n";
+                    };
+
+                    StreamOut& out = console();
+                    out << "--- Inventory Valuation ---\n";
+                    out << "Total value: $";
+                    out.fixed(report.value, 2) << " (" << report.units << " units in "
+                        << report.rows << " stock records)\n";
+                    if (report.orphanRows > 0)
+                        out << "Not valued: " << report.orphanRows << " stock records without a product\n";
+                    list(out, "By category:", "", report.byCategory);
+                    list(out, "By supplier:", "Supplier ID: ", report.bySupplier);
+                    list(out, "By product:", "Product ID: ", report.byProduct);
+                    out << "Computed in " << ms << " ms\n";
+                    out << "---------------------------\n";
+                    out.flush();
+                    break;
+                }
+                case 28: {
+                    // Operation counts, latency histograms and gauges
+                    string path;
+                    cout << "Output file (Enter to show here): "; getline(cin, path);
+                    if (path.empty()) {
+                        StreamOut& out = console();
+                        out << renderMetrics();
+                        out.flush();
+                    } else {
+                        writeMetricsFile(path);
+                        cout << "Metrics written to " << path << ".\n";
+                    }
+                    break;
+                }
+                case 29: {
+                    // Prefix matches first, then names containing the text
+                    string text;
+                    cout << "Enter name or part of it: "; getline(cin, text);
+
+                    bool building = !products.nameIndex().ready();
+                    auto started = chrono::steady_clock::now();
+                    products.ensureNameIndex();
+                    auto built = chrono::steady_clock::now();
+                    vector<Product*> matches = products.searchByName(text, NAME_SEARCH_DEFAULT_LIMIT);
+                    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - built).count();
+
+                    if (building)
+                        cout << "Name index built in "
+                             << chrono::duration<double, milli>(built - started).count() << " ms.\n";
+                    if (matches.empty()) {
+                        cout << "No matching products.\n";
+                        break;
+                    }
+                    StreamOut& out = console();
+                    out << "--- Products matching \"" << text << "\" ---\n";
+                    for (Product* p : matches) p->display(out);
+                    out << "Found in " << ms << " ms\n";
+                    out << "------------------------------\n";
+                    out.flush();
                     break;
                 }
                 case 0:
+                    try {
+                        journal.commit();
+                    } catch (const exception& e) {
+                        // Stay in the menu so the changes can still be saved, unless input has ended
+                        cout << "Error: " << e.what() << endl;
+                        if (cin) {
+                            cout << "Free some space and choose 0 again (Ctrl+C discards the changes).\n";
+                            break;
+                        }
+                    }
                     running = false;
                     cout << "Exiting program.\n";
                     break;